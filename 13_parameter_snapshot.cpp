@@ -0,0 +1,284 @@
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "al/core/app/al_App.hpp"
+#include "al/core/graphics/al_Shapes.hpp"
+#include "al/core/math/al_Random.hpp"
+#include "al/util/ui/al_Parameter.hpp"
+#include "al/util/ui/al_ControlGUI.hpp"
+
+#include "Gamma/Oscillator.h"
+#include "Gamma/Domain.h"
+
+using namespace al;
+
+/*
+ * This tutorial shows how to read a group of parameters from the audio
+ * thread without locks and without "tearing".
+ *
+ * Parameters can be changed at any time from the GUI, OSC or the keyboard.
+ * If you call get() on three parameters inside onSound(), another thread can
+ * change one of them in between, so a single audio block might see a new X
+ * together with an old Y. Calling get() for every sample also adds
+ * synchronization cost that grows with the number of parameters.
+ *
+ * The solution shown here has two parts:
+ *
+ * A SnapshotGroup holds a copy of the values of a group of parameters. It is
+ * kept up to date through the parameters' change callbacks and is protected
+ * by a sequence lock (seqlock): writers bump a counter before and after
+ * writing, and readers retry if the counter changed while they were copying.
+ *
+ * A ParameterSnapshot is owned by one reader (e.g. the audio callback or the
+ * graphics thread). Calling capture() once at the start of the block copies
+ * all the values in one go. Readers never block: if writers keep the group
+ * busy for too long, capture() gives up after a few attempts and keeps the
+ * previous (consistent) values for this block.
+*/
+
+class SnapshotGroup
+{
+public:
+    /*
+     * Parameters must be registered before audio starts, as registration
+     * reallocates the internal storage.
+     */
+    SnapshotGroup &operator<< (Parameter &param) {
+        registerParameter(param);
+        return *this;
+    }
+
+    void registerParameter(Parameter &param) {
+        size_t index = mParameters.size();
+        std::unique_ptr<std::atomic<float>[]> values(new std::atomic<float>[index + 1]);
+        for (size_t i = 0; i < index; i++) {
+            values[i].store(mValues[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+        values[index].store(param.get(), std::memory_order_relaxed);
+        mValues = std::move(values);
+        mParameters.push_back(&param);
+
+        param.registerChangeCallback([this, index](float value) {
+            write(index, value);
+        });
+    }
+
+    int indexOf(Parameter &param) const {
+        for (size_t i = 0; i < mParameters.size(); i++) {
+            if (mParameters[i] == &param) {
+                return (int) i;
+            }
+        }
+        return -1;
+    }
+
+    size_t size() const { return mParameters.size(); }
+
+    /*
+     * Use beginChanges() and endChanges() around a set of parameter changes
+     * that must be seen together (e.g. when randomizing X and Y at once).
+     * Readers will either see all of the changes or none of them.
+     */
+    void beginChanges() {
+        std::thread::id self = std::this_thread::get_id();
+        if (mOwner.load(std::memory_order_relaxed) == self) {
+            mDepth++;
+            return;
+        }
+        while (mWriteLock.test_and_set(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+        mOwner.store(self, std::memory_order_relaxed);
+        mDepth = 1;
+        mSequence.store(mSequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    void endChanges() {
+        if (--mDepth > 0) {
+            return;
+        }
+        mSequence.store(mSequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        mOwner.store(std::thread::id(), std::memory_order_relaxed);
+        mWriteLock.clear(std::memory_order_release);
+    }
+
+    // Writes are protected against other writers, but never wait for readers
+    void write(size_t index, float value) {
+        beginChanges();
+        mValues[index].store(value, std::memory_order_relaxed);
+        endChanges();
+    }
+
+private:
+    friend class ParameterSnapshot;
+
+    std::vector<Parameter *> mParameters;
+    std::unique_ptr<std::atomic<float>[]> mValues;
+
+    std::atomic<uint32_t> mSequence {0}; // Odd while a write is in progress
+    std::atomic_flag mWriteLock = ATOMIC_FLAG_INIT;
+    std::atomic<std::thread::id> mOwner {std::thread::id()};
+    int mDepth {0};
+};
+
+class ParameterSnapshot
+{
+public:
+    ParameterSnapshot(SnapshotGroup &group, int maxAttempts = 8) :
+        mGroup(group), mMaxAttempts(maxAttempts)
+    {}
+
+    /*
+     * Copy the current values of all the parameters in the group.
+     * Returns false if no consistent copy could be made, in which case the
+     * values from the previous capture() are kept.
+     * Only one thread should call capture() on a given snapshot.
+     */
+    bool capture() {
+        size_t count = mGroup.size();
+        if (mBuffers[0].size() != count) { // Allocate on first use
+            mBuffers[0].resize(count);
+            mBuffers[1].resize(count);
+            for (size_t i = 0; i < count; i++) {
+                mBuffers[mCurrent][i] = mGroup.mParameters[i]->get();
+            }
+        }
+        std::vector<float> &next = mBuffers[1 - mCurrent];
+        for (int attempt = 0; attempt < mMaxAttempts; attempt++) {
+            uint32_t before = mGroup.mSequence.load(std::memory_order_acquire);
+            if (before & 1) {
+                continue; // A writer is busy
+            }
+            for (size_t i = 0; i < count; i++) {
+                next[i] = mGroup.mValues[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (mGroup.mSequence.load(std::memory_order_relaxed) == before) {
+                mCurrent = 1 - mCurrent;
+                return true;
+            }
+        }
+        mMissedCaptures++;
+        return false;
+    }
+
+    // Values are read from the last successful capture()
+    float operator[](size_t index) const { return mBuffers[mCurrent][index]; }
+
+    const float *values() const { return mBuffers[mCurrent].data(); }
+
+    uint64_t missedCaptures() const { return mMissedCaptures; }
+
+private:
+    SnapshotGroup &mGroup;
+    int mMaxAttempts;
+    std::vector<float> mBuffers[2];
+    int mCurrent {0};
+    uint64_t mMissedCaptures {0};
+};
+
+
+class MyApp : public App
+{
+public:
+
+    virtual void onCreate() override {
+        nav().pos(Vec3d(0,0,8)); // Set the camera to view the scene
+        addCone(mesh); // Prepare mesh to draw a cone
+        mesh.primitive(Mesh::LINE_STRIP);
+
+        gui << X << Y << Size; // Register the parameters with the GUI
+        gui.init(); // Initialize GUI. Don't forget this!
+    }
+
+    virtual void onInit() override {
+        // Register the parameters with the group. This must be done before
+        // audio starts running.
+        group << X << Y << Size;
+
+        // Cache the indeces so we don't need to look them up on every block
+        xIndex = group.indexOf(X);
+        yIndex = group.indexOf(Y);
+        sizeIndex = group.indexOf(Size);
+    }
+
+    virtual void onAnimate(double dt) override {
+        navControl().active(!gui.usingInput());
+    }
+
+    virtual void onDraw(Graphics &g) override
+    {
+        // The graphics thread has its own snapshot of the same group
+        graphicsSnapshot.capture();
+
+        g.clear();
+        g.pushMatrix();
+        g.translate(graphicsSnapshot[xIndex], graphicsSnapshot[yIndex], 0);
+        g.scale(graphicsSnapshot[sizeIndex]);
+        g.draw(mesh); // Draw the mesh
+        g.popMatrix();
+
+        gui.draw(g);
+    }
+
+    virtual void onSound(AudioIOData &io) override {
+        // Capture all parameters once per block. Inside the loop we only
+        // read plain floats, so there is no synchronization per sample.
+        audioSnapshot.capture();
+        float pan = (audioSnapshot[xIndex] + 1.0f) * 0.5f;
+        float frequency = 220.0f * powf(2.0f, audioSnapshot[yIndex] + 1.0f);
+        float amp = audioSnapshot[sizeIndex] * 0.05f;
+
+        mSource.freq(frequency);
+        while(io()) {
+            float sample = mSource() * amp;
+            io.out(0) += sample * (1.0f - pan);
+            io.out(1) += sample * pan;
+        }
+    }
+
+    virtual void onKeyDown(const Keyboard& k) override
+    {
+        if (k.key() == ' ') {
+            // Randomize all parameters together. The audio thread will see
+            // either the old or the new position, never a mix of both.
+            group.beginChanges();
+            X = randomGenerator.uniformS();
+            Y = randomGenerator.uniformS();
+            Size = 0.1 + randomGenerator.uniform() * 2.0;
+            group.endChanges();
+        }
+    }
+
+private:
+    Mesh mesh;
+
+    Parameter X {"X", "Position", 0.0, "", -1.0f, 1.0f};
+    Parameter Y {"Y", "Position", 0.0, "", -1.0f, 1.0f};
+    Parameter Size {"Scale", "Size", 1.0, "", 0.1f, 3.0f};
+
+    SnapshotGroup group;
+    ParameterSnapshot audioSnapshot {group};
+    ParameterSnapshot graphicsSnapshot {group};
+    int xIndex {0}, yIndex {0}, sizeIndex {0};
+
+    gam::Sine<> mSource; // Sine wave oscillator source
+
+    rnd::Random<> randomGenerator; // Random number generator
+
+    ControlGUI gui;
+};
+
+
+int main(int argc, char *argv[])
+{
+    MyApp app;
+    app.dimensions(800, 600);
+    app.initAudio(44100, 256, 2, 0);
+    gam::sampleRate(44100);
+    app.start();
+    return 0;
+}
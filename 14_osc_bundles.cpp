@@ -0,0 +1,375 @@
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "al/core/app/al_App.hpp"
+#include "al/core/graphics/al_Shapes.hpp"
+#include "al/core/protocol/al_OSC.hpp"
+#include "al/util/ui/al_Parameter.hpp"
+#include "al/util/ui/al_ControlGUI.hpp"
+
+using namespace al;
+
+/*
+ * This tutorial shows how to broadcast parameter changes to OSC listeners
+ * in bundles instead of sending one UDP packet for every change.
+ *
+ * When you call parameterServer().addListener() every change to every
+ * parameter is sent immediately as its own message. This is fine for a
+ * handful of parameters, but a preset morph or a GUI drag can change dozens
+ * of parameters on every frame, and each change becomes a tiny packet.
+ *
+ * The BundledBroadcaster below only remembers the latest value of each
+ * changed parameter (the last value wins, intermediate values are dropped).
+ * Once per frame (or per configured interval) it packs all pending changes
+ * into OSC bundles and sends them. Each listener can also be rate limited,
+ * for example to send to a slow visualizer only 10 times per second.
+ *
+ * Run with the argument "--benchmark" to compare the number of packets and
+ * the CPU time used by both approaches over the loopback interface.
+*/
+
+class BundledBroadcaster
+{
+public:
+
+    BundledBroadcaster &operator<< (Parameter &param) {
+        registerParameter(param);
+        return *this;
+    }
+
+    void registerParameter(Parameter &param) {
+        std::unique_lock<std::mutex> lk(mLock);
+        size_t index = mAddresses.size();
+        mAddresses.push_back(param.getFullAddress());
+        mValues.push_back(param.get());
+        for (auto &listener: mListeners) {
+            listener->dirty.push_back(false);
+        }
+        lk.unlock();
+        param.registerChangeCallback([this, index](float value) {
+            valueChanged(index, value);
+        });
+    }
+
+    /*
+     * maxBundlesPerSecond limits how often a listener is sent updates.
+     * Use 0 to send on every flush.
+     */
+    void addListener(std::string address, uint16_t port, float maxBundlesPerSecond = 0) {
+        std::unique_lock<std::mutex> lk(mLock);
+        std::unique_ptr<Listener> listener(new Listener(address, port));
+        listener->minInterval = maxBundlesPerSecond > 0 ? 1.0 / maxBundlesPerSecond : 0.0;
+        listener->dirty.resize(mAddresses.size(), false);
+        mListeners.push_back(std::move(listener));
+    }
+
+    // Time between flushes when using update(). 0 flushes on every call.
+    void setInterval(double seconds) { mInterval = seconds; }
+
+    /*
+     * Keep bundles small enough to fit in a single UDP datagram. This must
+     * not be larger than the buffer of osc::Send. A message that doesn't
+     * fit in a bundle on its own is not sent, and counted.
+     */
+    void setMaxBundleSize(size_t bytes) { mMaxBundleSize = bytes; }
+
+    /*
+     * Call update() once per frame (e.g. from onAnimate()) passing the
+     * elapsed time.
+     */
+    void update(double dt) {
+        mTime += dt;
+        if (mTime - mLastFlush >= mInterval) {
+            mLastFlush = mTime;
+            flush();
+        }
+    }
+
+    /*
+     * Send all pending changes to listeners that are not rate limited.
+     * The changes are collected under the lock, and sent after releasing
+     * it, so threads that change parameters never wait for the network.
+     */
+    void flush() {
+        std::unique_lock<std::mutex> sendLk(mSendLock); // One flush at a time
+        std::unique_lock<std::mutex> lk(mLock);
+        mDue.clear();
+        for (auto &listener: mListeners) {
+            if (!listener->pending || mTime - listener->lastSend < listener->minInterval) {
+                continue;
+            }
+            listener->lastSend = mTime;
+            listener->pending = false;
+            listener->outgoing.clear();
+            for (size_t i = 0; i < listener->dirty.size(); i++) {
+                if (listener->dirty[i]) {
+                    listener->dirty[i] = false;
+                    listener->outgoing.push_back({&mAddresses[i], mValues[i]});
+                }
+            }
+            mDue.push_back(listener.get()); // Listeners are never removed
+        }
+        lk.unlock();
+
+        for (Listener *listener: mDue) {
+            size_t bundleSize = 0;
+            for (auto &change: listener->outgoing) {
+                const std::string &address = *change.first;
+                size_t messageSize = encodedSize(address);
+                if (BUNDLE_HEADER_SIZE + messageSize > mMaxBundleSize) {
+                    mMessagesTooLarge++;
+                    continue;
+                }
+                if (bundleSize > 0 && bundleSize + messageSize > mMaxBundleSize) {
+                    sendBundle(*listener);
+                    bundleSize = 0;
+                }
+                if (bundleSize == 0) {
+                    listener->send.beginBundle();
+                    bundleSize = BUNDLE_HEADER_SIZE;
+                }
+                listener->send.beginMessage(address);
+                listener->send << change.second;
+                listener->send.endMessage();
+                bundleSize += messageSize;
+                mMessagesSent++;
+            }
+            if (bundleSize > 0) {
+                sendBundle(*listener);
+            }
+        }
+    }
+
+    uint64_t packetsSent() const { return mPacketsSent; }
+    uint64_t messagesSent() const { return mMessagesSent; }
+    uint64_t messagesTooLarge() const { return mMessagesTooLarge; }
+
+private:
+    struct Listener {
+        Listener(std::string address, uint16_t port) :
+            send(port, address.c_str()) {}
+
+        osc::Send send;
+        std::vector<bool> dirty;
+        std::vector<std::pair<const std::string *, float>> outgoing; // Changes being sent
+        bool pending {false};
+        double minInterval {0};
+        double lastSend {-1e9};
+    };
+
+    void valueChanged(size_t index, float value) {
+        std::unique_lock<std::mutex> lk(mLock);
+        mValues[index] = value; // Last value wins
+        for (auto &listener: mListeners) {
+            listener->dirty[index] = true;
+            listener->pending = true;
+        }
+    }
+
+    // "#bundle" and a time tag
+    static const size_t BUNDLE_HEADER_SIZE = 16;
+
+    // Size of a float message inside a bundle: element size, address and
+    // type tags padded to 4 bytes, and the float
+    static size_t encodedSize(const std::string &address) {
+        return 4 + (address.size() + 4) / 4 * 4 + 4 + 4;
+    }
+
+    void sendBundle(Listener &listener) {
+        listener.send.endBundle();
+        listener.send.send();
+        listener.send.clear();
+        mPacketsSent++;
+    }
+
+    std::mutex mLock;
+    std::mutex mSendLock;
+    std::vector<Listener *> mDue; // Only used while holding mSendLock
+    std::deque<std::string> mAddresses; // Adding doesn't move the others
+    std::vector<float> mValues;
+    std::vector<std::unique_ptr<Listener>> mListeners;
+
+    double mTime {0};
+    double mLastFlush {0};
+    double mInterval {0};
+    size_t mMaxBundleSize {1024};
+
+    std::atomic<uint64_t> mPacketsSent {0};
+    std::atomic<uint64_t> mMessagesSent {0};
+    std::atomic<uint64_t> mMessagesTooLarge {0};
+};
+
+
+class MyApp : public App
+{
+public:
+
+    virtual void onCreate() override {
+        nav().pos(Vec3d(0,0,8)); // Set the camera to view the scene
+        addCone(mesh); // Prepare mesh to draw a cone
+        mesh.primitive(Mesh::LINE_STRIP);
+
+        gui << X << Y << Size; // Register the parameters with the GUI
+        gui.init(); // Initialize GUI. Don't forget this!
+
+        // The parameter server is still used to receive OSC
+        parameterServer() << X << Y << Size;
+
+        /*
+            Instead of adding the listener to the parameter server, we add it
+            to the broadcaster. Here we limit the listener to 30 bundles per
+            second, even if the app runs at a higher frame rate.
+        */
+        broadcaster << X << Y << Size;
+        broadcaster.addListener("127.0.0.1", 13560, 30);
+
+        parameterServer().print();
+    }
+
+    virtual void onAnimate(double dt) override {
+        navControl().active(!gui.usingInput());
+        // Send all changes accumulated during this frame
+        broadcaster.update(dt);
+    }
+
+    virtual void onDraw(Graphics &g) override
+    {
+        g.clear();
+
+        g.pushMatrix();
+        g.translate(X.get(), Y.get(), 0);
+        g.scale(Size.get());
+        g.draw(mesh); // Draw the mesh
+        g.popMatrix();
+
+        gui.draw(g);
+    }
+
+private:
+    Mesh mesh;
+
+    Parameter X {"X", "Position", 0.0, "", -1.0f, 1.0f};
+    Parameter Y {"Y", "Position", 0.0, "", -1.0f, 1.0f};
+    Parameter Size {"Scale", "Size", 1.0, "", 0.1f, 3.0f};
+
+    BundledBroadcaster broadcaster;
+
+    ControlGUI gui;
+};
+
+/*
+ * Counts the messages that arrive at the receiving end of the benchmark.
+ * Messages inside bundles are delivered one by one to onMessage().
+*/
+class MessageCounter : public osc::PacketHandler
+{
+public:
+    virtual void onMessage(osc::Message &) override {
+        mCount++;
+    }
+    std::atomic<uint64_t> mCount {0};
+};
+
+/*
+ * Simulates a morph that changes every parameter on every frame and
+ * measures what gets sent over the network.
+ */
+void runBenchmark()
+{
+    const int numParameters = 64;
+    const int numFrames = 600; // 10 seconds at 60 frames per second
+    const uint16_t port = 13561;
+
+    MessageCounter counter;
+    osc::Recv recv(port, "127.0.0.1", 0.001);
+    recv.handler(counter);
+    recv.start();
+
+    std::vector<std::unique_ptr<Parameter>> params;
+    for (int i = 0; i < numParameters; i++) {
+        params.emplace_back(new Parameter("P" + std::to_string(i), "Bench", 0.0));
+    }
+
+    // Immediate mode: one packet per change, like ParameterServer listeners
+    osc::Send immediateSend(port, "127.0.0.1");
+    bool immediate = true;
+    uint64_t immediatePackets = 0;
+    for (auto &p: params) {
+        std::string address = p->getFullAddress();
+        p->registerChangeCallback([&, address](float value) {
+            if (immediate) {
+                immediateSend.beginMessage(address);
+                immediateSend << value;
+                immediateSend.endMessage();
+                immediateSend.send();
+                immediateSend.clear();
+                immediatePackets++;
+            }
+        });
+    }
+
+    BundledBroadcaster broadcaster;
+    for (auto &p: params) {
+        broadcaster << *p;
+    }
+
+    auto runFrames = [&](bool bundled) {
+        std::clock_t start = std::clock();
+        for (int frame = 0; frame < numFrames; frame++) {
+            for (int i = 0; i < numParameters; i++) {
+                // Several writes per frame to each parameter, as in a morph
+                // running faster than the frame rate
+                for (int step = 0; step < 4; step++) {
+                    params[i]->set((frame * 4 + step + i) % 100 / 100.0f);
+                }
+            }
+            if (bundled) {
+                broadcaster.update(1.0 / 60.0);
+            }
+        }
+        return double(std::clock() - start) / CLOCKS_PER_SEC;
+    };
+
+    double immediateCpu = runFrames(false);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    uint64_t immediateReceived = counter.mCount.exchange(0);
+
+    immediate = false;
+    broadcaster.addListener("127.0.0.1", port);
+    double bundledCpu = runFrames(true);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    uint64_t bundledReceived = counter.mCount.exchange(0);
+
+    recv.stop();
+
+    double seconds = numFrames / 60.0;
+    std::cout << numParameters << " parameters, " << numFrames << " frames" << std::endl;
+    std::cout << "Immediate: " << immediatePackets << " packets ("
+              << immediatePackets / seconds << " packets/sec) "
+              << immediateReceived << " messages received, "
+              << immediateCpu * 1000.0 << " ms CPU" << std::endl;
+    std::cout << "Bundled:   " << broadcaster.packetsSent() << " packets ("
+              << broadcaster.packetsSent() / seconds << " packets/sec) "
+              << bundledReceived << " messages received, "
+              << bundledCpu * 1000.0 << " ms CPU" << std::endl;
+}
+
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1 && std::string(argv[1]) == "--benchmark") {
+        runBenchmark();
+        return 0;
+    }
+    MyApp app;
+    app.dimensions(800, 600);
+    app.start();
+    return 0;
+}
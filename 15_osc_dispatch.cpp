@@ -0,0 +1,352 @@
+#include <chrono>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "al/core/app/al_App.hpp"
+#include "al/core/graphics/al_Shapes.hpp"
+#include "al/core/protocol/al_OSC.hpp"
+#include "al/util/ui/al_Parameter.hpp"
+#include "al/util/ui/al_ControlGUI.hpp"
+
+using namespace al;
+
+/*
+ * This tutorial shows how to dispatch incoming OSC messages efficiently when
+ * you have thousands of parameters.
+ *
+ * A simple dispatcher compares the address of each incoming message with the
+ * address of every registered parameter, so the cost of each message grows
+ * with the number of parameters. The OSCAddressIndex below builds two
+ * structures when parameters are registered:
+ *
+ * - A hash table from full address to parameter. Plain addresses like
+ *   /Position/X are found with a single lookup.
+ * - A tree of address segments ("Position", then "X"). Addresses that contain
+ *   OSC pattern characters are matched segment by segment, so only the
+ *   branches that can match are visited.
+ *
+ * The OSC pattern syntax is supported within each segment:
+ *   ?        matches any single character
+ *   *        matches any sequence of characters
+ *   [abc]    matches any character in the list, [a-z] a range and [!abc]
+ *            any character not in the list
+ *   {foo,bar} matches any of the comma separated strings
+ *
+ * For example /agent1[0-9]/Position/X sets the X position of agent10 to
+ * agent19 and /Position/{X,Y} sets both X and Y.
+ *
+ * Run with "--benchmark" to dispatch 1 million messages against 10,000
+ * registered parameters.
+*/
+
+class OSCAddressIndex : public osc::PacketHandler
+{
+public:
+
+    OSCAddressIndex &operator<< (Parameter &param) {
+        registerParameter(param);
+        return *this;
+    }
+
+    // Register parameters before starting to receive messages
+    void registerParameter(Parameter &param) {
+        std::string address = param.getFullAddress();
+        mExact[address] = &param;
+
+        Node *node = &mRoot;
+        for (auto &segment: splitAddress(address)) {
+            std::unique_ptr<Node> &child = node->children[segment];
+            if (!child) {
+                child.reset(new Node);
+            }
+            node = child.get();
+        }
+        node->parameters.push_back(&param);
+    }
+
+    /*
+     * Set all parameters matching address to value.
+     * Returns the number of parameters that matched.
+     */
+    int dispatch(const std::string &address, float value) {
+        if (address.find_first_of("*?[{") == std::string::npos) {
+            auto found = mExact.find(address);
+            if (found == mExact.end()) {
+                return 0;
+            }
+            found->second->set(value);
+            return 1;
+        }
+        std::vector<std::string> segments = splitAddress(address);
+        return dispatchPattern(mRoot, segments, 0, value);
+    }
+
+    virtual void onMessage(osc::Message &m) override {
+        float value;
+        if (m.typeTags() == "f") {
+            m >> value;
+        } else if (m.typeTags() == "i") {
+            int intValue;
+            m >> intValue;
+            value = intValue;
+        } else {
+            return;
+        }
+        dispatch(m.addressPattern(), value);
+    }
+
+    /*
+     * Match a single address segment against an OSC pattern segment.
+     */
+    static bool matchSegment(const std::string &pattern, size_t p,
+                             const std::string &name, size_t n) {
+        while (p < pattern.size()) {
+            char c = pattern[p];
+            if (c == '*') {
+                // Try to match the rest of the pattern at every position
+                for (size_t i = n; i <= name.size(); i++) {
+                    if (matchSegment(pattern, p + 1, name, i)) {
+                        return true;
+                    }
+                }
+                return false;
+            } else if (c == '?') {
+                if (n >= name.size()) {
+                    return false;
+                }
+            } else if (c == '[') {
+                size_t end = pattern.find(']', p);
+                if (end == std::string::npos || n >= name.size()) {
+                    return false;
+                }
+                bool negate = pattern[p + 1] == '!';
+                bool found = false;
+                for (size_t i = p + (negate ? 2 : 1); i < end; i++) {
+                    if (i + 2 < end && pattern[i + 1] == '-') {
+                        found |= name[n] >= pattern[i] && name[n] <= pattern[i + 2];
+                        i += 2;
+                    } else {
+                        found |= name[n] == pattern[i];
+                    }
+                }
+                if (found == negate) {
+                    return false;
+                }
+                p = end;
+            } else if (c == '{') {
+                size_t end = pattern.find('}', p);
+                if (end == std::string::npos) {
+                    return false;
+                }
+                size_t start = p + 1;
+                while (start <= end) {
+                    size_t comma = pattern.find(',', start);
+                    if (comma == std::string::npos || comma > end) {
+                        comma = end;
+                    }
+                    size_t length = comma - start;
+                    if (name.compare(n, length, pattern, start, length) == 0
+                            && matchSegment(pattern, end + 1, name, n + length)) {
+                        return true;
+                    }
+                    start = comma + 1;
+                }
+                return false;
+            } else if (n >= name.size() || name[n] != c) {
+                return false;
+            }
+            p++;
+            n++;
+        }
+        return n == name.size();
+    }
+
+private:
+    struct Node {
+        std::unordered_map<std::string, std::unique_ptr<Node>> children;
+        std::vector<Parameter *> parameters;
+    };
+
+    static std::vector<std::string> splitAddress(const std::string &address) {
+        std::vector<std::string> segments;
+        size_t start = address[0] == '/' ? 1 : 0;
+        while (start <= address.size()) {
+            size_t end = address.find('/', start);
+            if (end == std::string::npos) {
+                end = address.size();
+            }
+            segments.push_back(address.substr(start, end - start));
+            start = end + 1;
+        }
+        return segments;
+    }
+
+    int dispatchPattern(Node &node, const std::vector<std::string> &segments,
+                        size_t level, float value) {
+        if (level == segments.size()) {
+            for (auto *param: node.parameters) {
+                param->set(value);
+            }
+            return (int) node.parameters.size();
+        }
+        const std::string &segment = segments[level];
+        if (segment.find_first_of("*?[{") == std::string::npos) {
+            // Literal segment, no need to visit all the children
+            auto child = node.children.find(segment);
+            if (child == node.children.end()) {
+                return 0;
+            }
+            return dispatchPattern(*child->second, segments, level + 1, value);
+        }
+        int count = 0;
+        for (auto &child: node.children) {
+            if (matchSegment(segment, 0, child.first, 0)) {
+                count += dispatchPattern(*child.second, segments, level + 1, value);
+            }
+        }
+        return count;
+    }
+
+    std::unordered_map<std::string, Parameter *> mExact;
+    Node mRoot;
+};
+
+
+class MyApp : public App
+{
+public:
+
+    virtual void onCreate() override {
+        nav().pos(Vec3d(0,0,8)); // Set the camera to view the scene
+        addCone(mesh); // Prepare mesh to draw a cone
+        mesh.primitive(Mesh::LINE_STRIP);
+
+        gui << X << Y << Size; // Register the parameters with the GUI
+        gui.init(); // Initialize GUI. Don't forget this!
+
+        // Register the parameters with the index and start a receiver that
+        // passes all incoming messages to it. Try sending:
+        //
+        // /Position/X 0.5
+        // /Position/{X,Y} -0.5
+        // /*/* 0.2
+        index << X << Y << Size;
+        recv.handler(index);
+        recv.start();
+        std::cout << "Listening for OSC on port 9020" << std::endl;
+    }
+
+    virtual void onAnimate(double dt) override {
+        navControl().active(!gui.usingInput());
+    }
+
+    virtual void onDraw(Graphics &g) override
+    {
+        g.clear();
+
+        g.pushMatrix();
+        g.translate(X.get(), Y.get(), 0);
+        g.scale(Size.get());
+        g.draw(mesh); // Draw the mesh
+        g.popMatrix();
+
+        gui.draw(g);
+    }
+
+    virtual void onExit() override {
+        recv.stop();
+    }
+
+private:
+    Mesh mesh;
+
+    Parameter X {"X", "Position", 0.0, "", -1.0f, 1.0f};
+    Parameter Y {"Y", "Position", 0.0, "", -1.0f, 1.0f};
+    Parameter Size {"Scale", "Size", 1.0, "", 0.1f, 3.0f};
+
+    OSCAddressIndex index;
+    osc::Recv recv {9020, "127.0.0.1", 0.01};
+
+    ControlGUI gui;
+};
+
+
+void runBenchmark()
+{
+    const int numAgents = 2500; // Each agent has 4 parameters
+    const int numMessages = 1000000;
+    const int numLinearMessages = 10000; // The linear scan is much slower
+
+    std::vector<std::unique_ptr<Parameter>> params;
+    std::vector<std::string> addresses;
+    OSCAddressIndex index;
+    for (int i = 0; i < numAgents; i++) {
+        std::string prefix = "agent" + std::to_string(i);
+        for (const char *name: {"X", "Y", "Z", "Scale"}) {
+            params.emplace_back(new Parameter(name, "Position", 0.0, prefix));
+            index << *params.back();
+            addresses.push_back(params.back()->getFullAddress());
+        }
+    }
+    std::cout << params.size() << " registered parameters" << std::endl;
+
+    // Pick addresses in a scrambled order so we don't just hit the cache
+    std::vector<size_t> order(numMessages);
+    for (int i = 0; i < numMessages; i++) {
+        order[i] = (i * 7919ull) % addresses.size();
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    int matched = 0;
+    for (int i = 0; i < numMessages; i++) {
+        matched += index.dispatch(addresses[order[i]], i * 0.001f);
+    }
+    std::chrono::duration<double> indexed = std::chrono::high_resolution_clock::now() - start;
+    std::cout << "Indexed: " << numMessages << " messages, " << matched << " matched in "
+              << indexed.count() << " s (" << indexed.count() * 1e9 / numMessages
+              << " ns/message)" << std::endl;
+
+    // Compare every message against every registered address
+    start = std::chrono::high_resolution_clock::now();
+    matched = 0;
+    for (int i = 0; i < numLinearMessages; i++) {
+        const std::string &address = addresses[order[i]];
+        for (size_t j = 0; j < addresses.size(); j++) {
+            if (addresses[j] == address) {
+                params[j]->set(i * 0.001f);
+                matched++;
+            }
+        }
+    }
+    std::chrono::duration<double> linear = std::chrono::high_resolution_clock::now() - start;
+    std::cout << "Linear:  " << numLinearMessages << " messages, " << matched << " matched in "
+              << linear.count() << " s (" << linear.count() * 1e9 / numLinearMessages
+              << " ns/message)" << std::endl;
+
+    // Pattern dispatch touching a subset of agents
+    const int numPatternMessages = 10000;
+    start = std::chrono::high_resolution_clock::now();
+    matched = 0;
+    for (int i = 0; i < numPatternMessages; i++) {
+        matched += index.dispatch("/agent1[0-4]?/Position/{X,Y}", i * 0.001f);
+    }
+    std::chrono::duration<double> pattern = std::chrono::high_resolution_clock::now() - start;
+    std::cout << "Pattern: " << numPatternMessages << " messages, " << matched << " matched in "
+              << pattern.count() << " s (" << pattern.count() * 1e9 / numPatternMessages
+              << " ns/message)" << std::endl;
+}
+
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1 && std::string(argv[1]) == "--benchmark") {
+        runBenchmark();
+        return 0;
+    }
+    MyApp app;
+    app.dimensions(800, 600);
+    app.start();
+    return 0;
+}
@@ -0,0 +1,353 @@
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Everything the tutorials include, so that their own includes, inside
+// the namespaces below, are already done
+#include "al/core/app/al_App.hpp"
+#include "al/core/graphics/al_Shapes.hpp"
+#include "al/core/math/al_Random.hpp"
+#include "al/util/ui/al_Parameter.hpp"
+#include "al/util/ui/al_PresetSequencer.hpp"
+#include "al/util/ui/al_ControlGUI.hpp"
+#include "al/util/imgui/al_Imgui.hpp"
+
+#include "al/util/scene/al_SynthSequencer.hpp"
+#include "al/util/scene/al_SynthRecorder.hpp"
+#include "al/util/scene/al_DynamicScene.hpp"
+
+#include "al/core/sound/al_StereoPanner.hpp"
+#include "al/core/sound/al_Vbap.hpp"
+#include "al/core/sound/al_Dbap.hpp"
+#include "al/core/sound/al_Ambisonics.hpp"
+#include "al/util/sound/al_OutputMaster.hpp"
+
+#include "Gamma/Oscillator.h"
+#include "Gamma/Envelope.h"
+#include "Gamma/Domain.h"
+
+using namespace al;
+
+/*
+ * This tutorial shows how to run the audio side of an App without a window
+ * or an audio device, for example to profile onSound() on a headless
+ * machine or in continuous integration.
+ *
+ * The HeadlessDriver calls the App's onInit() and then alternates calls to
+ * onSound() and onAnimate() with the App's audioIO(), set up as an
+ * AudioIOData object that is not connected to any audio device. Since
+ * nothing waits for the sound card, the App runs as fast as the CPU allows.
+ * Key presses can be scripted at given times to trigger voices.
+ *
+ * For every audio block the driver measures how long onSound() took and
+ * reports latency percentiles, the worst block and the number of key
+ * presses (or events) per second of CPU time.
+ *
+ * The benchmarks run the tutorials' own code. Each tutorial source is
+ * included in its own namespace with its main() renamed, so that their
+ * MyApp and MyVoice classes don't clash. The driver doesn't create a window,
+ * so onCreate() is not called, and main() is not run: what they do that
+ * the audio needs (registering voice classes, connecting the recorder,
+ * allocating buses) is repeated by each benchmark.
+ *
+ * Run without arguments to run all benchmarks, or pass the name of a
+ * benchmark and optionally the number of seconds of audio to render:
+ *
+ * 16_headless_benchmark 06_trigger 60
+ *
+ * There is a benchmark for each tutorial from 05 to 12 that produces audio.
+ * 09_bundles and 10_distributedapp have no onSound() (they only draw and
+ * share parameters over the network), so there is nothing to measure
+ * headless for them. Their audio-less cost is in onAnimate()/onDraw() and
+ * in the network, which a benchmark without a window or a peer can't show.
+ *
+ * 05_polysynth and 12_audio_spatialization_scene end their voices from
+ * onProcess(Graphics &), counting graphics frames. Without graphics their
+ * voices sound until the end of the benchmark, so these two measure a
+ * number of voices that grows with each key press.
+*/
+
+struct BenchmarkResult {
+    std::vector<double> blockTimes; // seconds spent in onSound() per block
+    double audioSeconds {0};
+    double cpuSeconds {0};
+    uint64_t keysPressed {0};
+
+    double percentile(double p) const {
+        if (blockTimes.size() == 0) {
+            return 0;
+        }
+        std::vector<double> sorted = blockTimes;
+        std::sort(sorted.begin(), sorted.end());
+        size_t index = std::min(sorted.size() - 1, size_t(p / 100.0 * sorted.size()));
+        return sorted[index];
+    }
+
+    void print(std::string name, double blockDuration) const {
+        std::cout << name << ": " << blockTimes.size() << " blocks, "
+                  << audioSeconds << " s of audio in " << cpuSeconds << " s ("
+                  << audioSeconds / cpuSeconds << "x realtime)" << std::endl;
+        std::cout << "    block time us: p50 " << percentile(50) * 1e6
+                  << " p90 " << percentile(90) * 1e6
+                  << " p99 " << percentile(99) * 1e6
+                  << " worst " << percentile(100) * 1e6
+                  << " (budget " << blockDuration * 1e6 << ")" << std::endl;
+        std::cout << "    key presses/sec: " << keysPressed / cpuSeconds << std::endl;
+    }
+};
+
+template<class AppType>
+class HeadlessDriver
+{
+public:
+    HeadlessDriver(AppType &app, double sampleRate = 44100,
+                   int framesPerBuffer = 256, int channels = 2) :
+        mApp(app), mIO(app.audioIO()) // Only its AudioIOData part is used
+    {
+        mIO.framesPerSecond(sampleRate);
+        mIO.framesPerBuffer(framesPerBuffer);
+        mIO.channelsOut(channels);
+    }
+
+    // Allocate internal buses, as done in main() for 11_audio_spatialization
+    void setBusChannels(int channels) { mIO.channelsBus(channels); }
+
+    // Schedule a key press (down = true) or release at a time in seconds
+    void scheduleKey(double time, int key, bool down) {
+        mKeyEvents.push_back({time, key, down});
+    }
+
+    // onAnimate() is called at this rate in audio time
+    void setAnimationRate(double framesPerSecond) { mAnimationRate = framesPerSecond; }
+
+    AudioIOData &io() { return mIO; }
+
+    double blockDuration() { return mIO.framesPerBuffer() / mIO.framesPerSecond(); }
+
+    BenchmarkResult run(double seconds) {
+        BenchmarkResult result;
+        std::stable_sort(mKeyEvents.begin(), mKeyEvents.end(),
+                         [](const KeyEvent &a, const KeyEvent &b) { return a.time < b.time; });
+        size_t nextKey = 0;
+        double time = 0;
+        double nextAnimate = 0;
+        int numBlocks = int(seconds / blockDuration());
+        result.blockTimes.reserve(numBlocks);
+
+        mApp.onInit();
+        auto startTotal = std::chrono::high_resolution_clock::now();
+        for (int block = 0; block < numBlocks; block++) {
+            // Key events are delivered between blocks, as in a live App
+            while (nextKey < mKeyEvents.size() && mKeyEvents[nextKey].time <= time) {
+                Keyboard k;
+                k.setKey(mKeyEvents[nextKey].key, mKeyEvents[nextKey].down);
+                if (mKeyEvents[nextKey].down) {
+                    mApp.onKeyDown(k);
+                    result.keysPressed++;
+                } else {
+                    mApp.onKeyUp(k);
+                }
+                nextKey++;
+            }
+            if (time >= nextAnimate) {
+                mApp.onAnimate(1.0 / mAnimationRate);
+                nextAnimate += 1.0 / mAnimationRate;
+            }
+            mIO.zeroOut();
+            mIO.frame(0);
+            auto start = std::chrono::high_resolution_clock::now();
+            mApp.onSound(mIO);
+            std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+            result.blockTimes.push_back(elapsed.count());
+            time += blockDuration();
+        }
+        std::chrono::duration<double> total = std::chrono::high_resolution_clock::now() - startTotal;
+        result.audioSeconds = time;
+        result.cpuSeconds = total.count();
+        mApp.onExit();
+        return result;
+    }
+
+private:
+    struct KeyEvent {
+        double time;
+        int key;
+        bool down;
+    };
+
+    AppType &mApp;
+    AudioIOData &mIO;
+    std::vector<KeyEvent> mKeyEvents;
+    double mAnimationRate {60};
+};
+
+
+namespace tutorial05 {
+#define main main_05
+#include "05_polysynth.cpp"
+#undef main
+}
+
+namespace tutorial06 {
+#define main main_06
+#include "06_trigger.cpp"
+#undef main
+}
+
+namespace tutorial07 {
+#define main main_07
+#include "07_event_sequencer.cpp"
+#undef main
+}
+
+namespace tutorial08 {
+#define main main_08
+#include "08_event_recorder.cpp"
+#undef main
+}
+
+namespace tutorial11 {
+#define main main_11
+#include "11_audio_spatialization.cpp"
+#undef main
+#undef SpatializerType
+}
+
+namespace tutorial12 {
+#define main main_12
+#include "12_audio_spatialization_scene.cpp"
+#undef main
+#undef SpatializerType
+}
+
+
+/*
+ * Each benchmark is a named function that takes the number of seconds of
+ * audio to render.
+*/
+struct Benchmark {
+    std::string name;
+    std::function<void(double)> run;
+};
+
+// Chords of four notes, four times per second
+template<class AppType>
+void scheduleChords(HeadlessDriver<AppType> &driver, double seconds)
+{
+    const char keys[] = "asdfghjkl";
+    for (double time = 0; time < seconds; time += 0.25) {
+        for (int i = 0; i < 4; i++) {
+            int key = keys[(int(time * 4) + i * 2) % 9];
+            driver.scheduleKey(time, key, true);
+            driver.scheduleKey(time + 0.2, key, false);
+        }
+    }
+}
+
+std::vector<Benchmark> benchmarks = {
+    {"05_polysynth", [](double seconds) {
+        tutorial05::MyApp app;
+        HeadlessDriver<tutorial05::MyApp> driver(app);
+        // One new voice a second. They never end here, see above.
+        const char keys[] = "asdfghjkl";
+        for (double time = 0; time < seconds; time += 1.0) {
+            driver.scheduleKey(time, keys[int(time) % 9], true);
+        }
+        BenchmarkResult result = driver.run(seconds);
+        result.print("05_polysynth", driver.blockDuration());
+    }},
+    {"06_trigger", [](double seconds) {
+        tutorial06::MyApp app;
+        HeadlessDriver<tutorial06::MyApp> driver(app);
+        scheduleChords(driver, seconds);
+        BenchmarkResult result = driver.run(seconds);
+        result.print("06_trigger", driver.blockDuration());
+    }},
+    {"06_trigger_dense", [](double seconds) {
+        tutorial06::MyApp app;
+        HeadlessDriver<tutorial06::MyApp> driver(app);
+        // Hold many notes at once to stress polyphony
+        const char keys[] = "qwertyuiopasdfghjklzxcvbnm";
+        for (double time = 0; time < seconds; time += 0.01) {
+            int key = keys[int(time * 100) % 26];
+            driver.scheduleKey(time, key, true);
+            driver.scheduleKey(time + 1.0, key, false);
+        }
+        BenchmarkResult result = driver.run(seconds);
+        result.print("06_trigger_dense", driver.blockDuration());
+    }},
+    {"07_event_sequencer", [](double seconds) {
+        tutorial07::MyApp app;
+        HeadlessDriver<tutorial07::MyApp> driver(app);
+        // A score that covers the whole benchmark, instead of the few
+        // events added in the tutorial's main()
+        rnd::Random<> randomGenerator;
+        uint64_t numEvents = 0;
+        for (double time = 0; time < seconds; time += 0.05) {
+            float freq = randomGenerator.uniform(220.0, 880.0);
+            app.sequencer().add<tutorial07::MyVoice>(time, 0.5).set(0, 0, 0.5, freq, 0.1, 0.5);
+            numEvents++;
+        }
+        BenchmarkResult result = driver.run(seconds);
+        result.keysPressed = numEvents;
+        result.print("07_event_sequencer (events as key presses)", driver.blockDuration());
+    }},
+    {"08_event_recorder", [](double seconds) {
+        tutorial08::MyApp app;
+        HeadlessDriver<tutorial08::MyApp> driver(app);
+        // Done by the tutorial in main() and onCreate()
+        app.sequencer().synth().registerSynthClass<tutorial08::MyVoice>("MyVoice");
+        app.recorder() << app.sequencer().synth();
+        // Record the same chords as 06_trigger
+        app.recorder().startRecord("16_headless_benchmark", true, false);
+        scheduleChords(driver, seconds);
+        BenchmarkResult result = driver.run(seconds);
+        app.recorder().stopRecord();
+        result.print("08_event_recorder", driver.blockDuration());
+    }},
+    {"11_audio_spatialization", [](double seconds) {
+        tutorial11::MyApp app;
+        HeadlessDriver<tutorial11::MyApp> driver(app);
+        driver.setBusChannels(1); // Done by the tutorial in main()
+        scheduleChords(driver, seconds);
+        BenchmarkResult result = driver.run(seconds);
+        result.print("11_audio_spatialization", driver.blockDuration());
+    }},
+    {"12_audio_spatialization_scene", [](double seconds) {
+        tutorial12::MyApp app;
+        HeadlessDriver<tutorial12::MyApp> driver(app);
+        // One new agent per second. They never end here, see above.
+        for (double time = 0; time < seconds; time += 1.0) {
+            driver.scheduleKey(time, ' ', true);
+        }
+        BenchmarkResult result = driver.run(seconds);
+        result.print("12_audio_spatialization_scene", driver.blockDuration());
+    }},
+};
+
+
+int main(int argc, char *argv[])
+{
+    // gam::sampleRate() must match the driver's sample rate
+    gam::sampleRate(44100);
+
+    std::string name = argc > 1 ? argv[1] : "";
+    double seconds = argc > 2 ? std::stod(argv[2]) : 30.0;
+    bool found = false;
+    for (auto &benchmark: benchmarks) {
+        if (name.size() == 0 || name == benchmark.name) {
+            benchmark.run(seconds);
+            found = true;
+        }
+    }
+    if (!found) {
+        std::cout << "Unknown benchmark: " << name << ". Available:" << std::endl;
+        for (auto &benchmark: benchmarks) {
+            std::cout << "    " << benchmark.name << std::endl;
+        }
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,240 @@
+#include <atomic>
+#include <functional>
+#include <limits>
+#include <vector>
+
+#include "al/core/app/al_App.hpp"
+#include "al/core/graphics/al_Shapes.hpp"
+#include "al/util/ui/al_Parameter.hpp"
+#include "al/util/ui/al_PresetSequencer.hpp"
+
+#include "al/util/scene/al_SynthSequencer.hpp"
+#include "al/util/scene/al_SynthRecorder.hpp"
+#include "al/util/ui/al_ControlGUI.hpp"
+
+#include "Gamma/Oscillator.h"
+#include "Gamma/Envelope.h"
+#include "Gamma/Domain.h"
+
+using namespace al;
+
+/*
+ * This tutorial shows how to defer parameter change callbacks and run them
+ * in a single batch.
+ *
+ * In the event recorder tutorial, the voice registers change callbacks on
+ * its internal parameters to update the oscillator and the envelope. These
+ * callbacks run synchronously every time a parameter is set, so triggering
+ * a voice with set() or from a sequence runs all of them, one after the
+ * other, on the thread that triggers. If a parameter is set several times
+ * before the voice starts, the callback runs every time.
+ *
+ * The DeferredCallbacks class below doesn't register anything with the
+ * parameters, so setting a parameter costs nothing more than storing its
+ * value. Instead, flush() compares the value of each parameter with the
+ * value it saw last time, and runs the callbacks of the parameters that
+ * changed. Repeated writes between two flushes are collapsed, and the
+ * callback is called once with the last value.
+ *
+ * The voice calls flush() at the start of onProcess(), so the callbacks
+ * run on the audio thread, right before the block that uses the new
+ * values. As onTriggerOn() runs on the thread that triggers the voice, the
+ * voice only marks that it must start, and resets its envelope in
+ * onProcess() after flushing, once the envelope lengths are set.
+ *
+ * A parameter set while flush() runs on another thread is seen by this
+ * flush or by the next one.
+*/
+
+class DeferredCallbacks
+{
+public:
+    /*
+     * Register a callback for param that will be run on flush() when the
+     * value of param has changed. Register all callbacks before the first
+     * flush().
+     */
+    void registerChangeCallback(Parameter &param, std::function<void(float)> callback) {
+        // NaN differs from any value, so the first flush runs every callback
+        mEntries.push_back({&param, callback, std::numeric_limits<float>::quiet_NaN()});
+    }
+
+    // Run the callbacks of the parameters that changed since the last flush
+    void flush() {
+        for (auto &entry: mEntries) {
+            float value = entry.param->get();
+            if (value != entry.value) {
+                entry.value = value;
+                entry.callback(value);
+            }
+        }
+    }
+
+private:
+    struct Entry {
+        Parameter *param;
+        std::function<void(float)> callback;
+        float value; // Last value passed to the callback
+    };
+
+    std::vector<Entry> mEntries;
+};
+
+
+class MyVoice : public SynthVoice {
+public:
+    MyVoice() {
+        addCone(mesh); // Prepare mesh to draw a cone
+
+        mEnvelope.lengths(0.1f,  0.5f);
+        mEnvelope.levels(0, 1, 0);
+        mEnvelope.sustainPoint(1);
+
+        // Instead of registering the callbacks with the parameters, we
+        // register them with the DeferredCallbacks object.
+        mCallbacks.registerChangeCallback(mFrequency, [this](float value) {mSource.freq(value);});
+        mCallbacks.registerChangeCallback(mAttack, [this](float value) {mEnvelope.lengths()[0] = value;});
+        mCallbacks.registerChangeCallback(mRelease, [this](float value) {mEnvelope.lengths()[2] = value;});
+
+        *this << mX << mY << mSize << mFrequency << mAttack << mRelease;
+    }
+
+    virtual void onProcess(AudioIOData &io) override {
+        // Apply all parameter changes since the last block in one go.
+        // This is cheap when nothing has changed.
+        mCallbacks.flush();
+        if (mStarting) {
+            // Now that the envelope lengths are set
+            mEnvelope.reset();
+            mStarting = false;
+        }
+        while(io()) {
+            io.out(0) += mEnvelope() * mSource() * 0.05; // Output on the first channel scaled by 0.05;
+        }
+        if (mEnvelope.done()) {
+            free();
+        }
+    }
+
+    virtual void onProcess(Graphics &g) {
+        g.pushMatrix();
+        g.translate(mX, mY, 0);
+        g.scale(mSize * mEnvelope.value());
+        g.draw(mesh); // Draw the mesh
+        g.popMatrix();
+    }
+
+    void set(float x, float y, float size, float frequency, float attackTime, float releaseTime) {
+        mX = x;
+        mY = y;
+        mSize = size;
+        mFrequency = frequency;
+        mAttack = attackTime;
+        mRelease = releaseTime;
+    }
+
+    virtual void onTriggerOn() override {
+        // This runs on the thread that triggers. The envelope is reset in
+        // onProcess(), after the callbacks have set its lengths.
+        mStarting = true;
+    }
+
+    virtual void onTriggerOff() override {
+        mEnvelope.release();
+    }
+
+
+private:
+    gam::Sine<> mSource; // Sine wave oscillator source
+    gam::AD<> mEnvelope;
+
+    Mesh mesh; // The mesh now belongs to the voice
+
+    Parameter mX {"X", "", 0};
+    Parameter mY {"Y", "", 0};
+    Parameter mSize {"Size", "", 1.0};
+    Parameter mFrequency {"Frequency", "", 0.0};
+    Parameter mAttack {"Attack", "", 0.0};
+    Parameter mRelease {"Release", "", 0.0};
+
+    DeferredCallbacks mCallbacks;
+    std::atomic<bool> mStarting {false};
+};
+
+
+class MyApp : public App
+{
+public:
+
+    virtual void onCreate() override {
+        nav().pos(Vec3d(0,0,8)); // Set the camera to view the scene
+        Light::globalAmbient({0.2, 1, 0.2});
+
+        gui << X << Y << Size << AttackTime << ReleaseTime; // Register the parameters with the GUI
+        gui << mRecorder;
+        gui << mSequencer;
+        gui.init(); // Initialize GUI. Don't forget this!
+
+        navControl().active(false); // Disable nav control (because we are using the control to drive the synth
+
+        mRecorder << mSequencer.synth();
+    }
+
+    virtual void onDraw(Graphics &g) override
+    {
+        g.clear();
+        g.lighting(true);
+        mSequencer.render(g);
+        gui.draw(g);
+    }
+
+    virtual void onSound(AudioIOData &io) override {
+        mSequencer.render(io);
+    }
+
+    virtual void onKeyDown(const Keyboard& k) override
+    {
+        MyVoice *voice = sequencer().synth().getVoice<MyVoice>();
+        int midiNote = asciiToMIDI(k.key());
+        float freq = 440.0f * powf(2, (midiNote - 69)/12.0f);
+        voice->set(X.get(), Y.get(), Size.get(), freq, AttackTime.get(), ReleaseTime.get());
+        sequencer().synth().triggerOn(voice, 0, midiNote);
+    }
+
+    virtual void onKeyUp(const Keyboard &k) override {
+        int midiNote = asciiToMIDI(k.key());
+        sequencer().synth().triggerOff(midiNote);
+    }
+
+    SynthSequencer &sequencer() {
+        return mSequencer;
+    }
+
+private:
+    Light light;
+
+    Parameter X {"X", "Position", 0.0, "", -1.0f, 1.0f};
+    Parameter Y {"Y", "Position", 0.0, "", -1.0f, 1.0f};
+    Parameter Size {"Scale", "Size", 1.0, "", 0.1f, 3.0f};
+    Parameter AttackTime {"AttackTime", "Sound", 0.1, "", 0.001f, 2.0f};
+    Parameter ReleaseTime {"ReleaseTime", "Sound", 1.0, "", 0.001f, 5.0f};
+
+    ControlGUI gui;
+
+    SynthRecorder mRecorder;
+    SynthSequencer mSequencer;
+};
+
+
+int main(int argc, char *argv[])
+{
+    MyApp app;
+    app.dimensions(800, 600);
+    app.initAudio(44100, 256, 2, 0);
+    gam::sampleRate(44100);
+
+    app.sequencer().synth().registerSynthClass<MyVoice>("MyVoice");
+
+    app.start();
+    return 0;
+}
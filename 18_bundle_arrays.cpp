@@ -0,0 +1,343 @@
+#include <array>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "al/core/app/al_App.hpp"
+#include "al/core/graphics/al_Shapes.hpp"
+#include "al/core/math/al_Random.hpp"
+#include "al/core/protocol/al_OSC.hpp"
+#include "al/util/ui/al_Parameter.hpp"
+#include "al/util/ui/al_ControlGUI.hpp"
+
+using namespace al;
+
+/*
+ * This tutorial shows a way to handle very large static arrays of agents.
+ *
+ * In the bundles tutorial, every voice owns its own Parameter objects and a
+ * ParameterBundle. A Parameter is a fairly large object (it has a name,
+ * group, callbacks and a lock), so with 10,000 agents most of the memory
+ * and time goes into the Parameter machinery instead of the values.
+ * Iterating over the X values of all agents also jumps around in memory.
+ *
+ * The ParameterArrayBundle below stores each field (X, Y, Size) as a
+ * contiguous array of floats across all agents ("struct of arrays"). The
+ * number of agents and fields is known at compile time, so loops over a
+ * field can be vectorized by the compiler.
+ *
+ * Each agent is still exposed individually:
+ *
+ * - GUI: an "Index" parameter chooses the agent, and one proxy Parameter per
+ *   field shows and edits the values of that agent.
+ * - OSC: each value has the address /<bundle name>/<index>/<group>/<field>
+ *   e.g. /myvoice/12/Position/X. Messages arrive on the OSC thread, so the
+ *   values are queued and applied when the app calls applyReceived() from
+ *   the thread that owns the arrays.
+ * - Presets: storePreset() and recallPreset() write and read all values
+ *   using the same text format as PresetHandler.
+ *
+ * With 10,000 agents, one draw call per agent costs much more than updating
+ * the agents. onDraw() writes all agents into a single mesh of lines,
+ * straight from the field arrays, and draws it with one call.
+*/
+
+#define NUM_VOICES 10000
+
+struct FieldSpec {
+    const char *name;
+    const char *group;
+    float defaultValue;
+    float min;
+    float max;
+};
+
+template<size_t NumInstances, size_t NumFields>
+class ParameterArrayBundle : public osc::PacketHandler
+{
+public:
+    ParameterArrayBundle(std::string name, const std::array<FieldSpec, NumFields> &fields) :
+        mName(name), mFields(fields)
+    {
+        for (size_t f = 0; f < NumFields; f++) {
+            mData[f].fill(fields[f].defaultValue);
+            mProxies[f].reset(new Parameter(fields[f].name, fields[f].group,
+                                            fields[f].defaultValue, "",
+                                            fields[f].min, fields[f].max));
+            mProxies[f]->registerChangeCallback([this, f](float value) {
+                if (!mUpdatingProxies) {
+                    mData[f][mIndex.get()] = value;
+                }
+            });
+        }
+        mIndex.registerChangeCallback([this](int32_t index) {
+            updateProxies(index);
+        });
+    }
+
+    // Contiguous values of a field for all instances
+    float *field(size_t f) { return mData[f].data(); }
+
+    float &operator()(size_t f, size_t instance) { return mData[f][instance]; }
+
+    static constexpr size_t size() { return NumInstances; }
+
+    // Parameters to register with a GUI
+    ParameterInt &indexParameter() { return mIndex; }
+    Parameter &proxy(size_t f) { return *mProxies[f]; }
+
+    std::string address(size_t f, size_t instance) {
+        return "/" + mName + "/" + std::to_string(instance) + "/"
+                + mFields[f].group + "/" + mFields[f].name;
+    }
+
+    /*
+     * Receive a value from OSC. You can register this object with
+     * parameterServer().registerOSCListener() to receive its messages.
+     * The value is only queued here, see applyReceived().
+     */
+    virtual void onMessage(osc::Message &m) override {
+        size_t instance, f;
+        if (m.typeTags() != "f" || !parseAddress(m.addressPattern(), instance, f)) {
+            return;
+        }
+        float value;
+        m >> value;
+        std::unique_lock<std::mutex> lk(mReceivedLock);
+        mReceived.push_back({instance, f, value});
+    }
+
+    /*
+     * Write the values received from OSC into the arrays. Call once per
+     * frame (e.g. from onAnimate()) on the thread that reads the arrays
+     * and the GUI proxies.
+     */
+    void applyReceived() {
+        {
+            std::unique_lock<std::mutex> lk(mReceivedLock);
+            mApplying.swap(mReceived);
+        }
+        bool currentChanged = false;
+        for (auto &value: mApplying) {
+            mData[value.field][value.instance] = value.value;
+            currentChanged |= (int) value.instance == mIndex.get();
+        }
+        mApplying.clear();
+        if (currentChanged) {
+            updateProxies(mIndex.get());
+        }
+    }
+
+    void storePreset(std::string name, std::string path = "presets/") {
+        std::ofstream f(path + name + ".preset");
+        f << "::" << name << std::endl;
+        for (size_t field = 0; field < NumFields; field++) {
+            for (size_t i = 0; i < NumInstances; i++) {
+                f << address(field, i) << " f " << mData[field][i] << std::endl;
+            }
+        }
+        f << "::" << std::endl;
+    }
+
+    bool recallPreset(std::string name, std::string path = "presets/") {
+        std::ifstream f(path + name + ".preset");
+        if (!f.is_open()) {
+            return false;
+        }
+        std::string line;
+        while (std::getline(f, line)) {
+            std::stringstream ss(line);
+            std::string address, type;
+            float value;
+            size_t instance, field;
+            if (ss >> address >> type >> value && parseAddress(address, instance, field)) {
+                mData[field][instance] = value;
+            }
+        }
+        updateProxies(mIndex.get());
+        return true;
+    }
+
+private:
+    bool parseAddress(const std::string &address, size_t &instance, size_t &f) {
+        std::string prefix = "/" + mName + "/";
+        if (address.compare(0, prefix.size(), prefix) != 0) {
+            return false;
+        }
+        size_t slash = address.find('/', prefix.size());
+        if (slash == std::string::npos) {
+            return false;
+        }
+        if (slash == prefix.size()) {
+            return false;
+        }
+        instance = 0;
+        for (size_t i = prefix.size(); i < slash; i++) {
+            if (address[i] < '0' || address[i] > '9') {
+                return false;
+            }
+            instance = instance * 10 + (address[i] - '0');
+        }
+        if (instance >= NumInstances) {
+            return false;
+        }
+        std::string rest = address.substr(slash + 1);
+        for (f = 0; f < NumFields; f++) {
+            if (rest == std::string(mFields[f].group) + "/" + mFields[f].name) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void updateProxies(size_t instance) {
+        mUpdatingProxies = true;
+        for (size_t f = 0; f < NumFields; f++) {
+            mProxies[f]->set(mData[f][instance]);
+        }
+        mUpdatingProxies = false;
+    }
+
+    std::string mName;
+    std::array<FieldSpec, NumFields> mFields;
+    std::array<std::array<float, NumInstances>, NumFields> mData;
+
+    ParameterInt mIndex {"Index", "", 0, "", 0, (int32_t) NumInstances - 1};
+    std::array<std::unique_ptr<Parameter>, NumFields> mProxies;
+    bool mUpdatingProxies {false}; // Only used on the thread that owns the arrays
+
+    struct ReceivedValue {
+        size_t instance;
+        size_t field;
+        float value;
+    };
+
+    std::mutex mReceivedLock;
+    std::vector<ReceivedValue> mReceived; // Written by the OSC thread
+    std::vector<ReceivedValue> mApplying; // Keeps its capacity between frames
+};
+
+// Field indeces. The order must match the FieldSpec array below.
+enum VoiceField {
+    FIELD_X = 0,
+    FIELD_Y,
+    FIELD_SIZE,
+    NUM_FIELDS
+};
+
+
+class MyApp : public App
+{
+public:
+
+    virtual void onCreate() override {
+        nav().pos(Vec3d(0,0,8)); // Set the camera to view the scene
+        addCone(mesh); // All agents share the same mesh
+        mesh.primitive(Mesh::LINE_STRIP);
+
+        // The segments of the line strip as pairs of vertex indices, so
+        // all agents can go into one mesh of lines
+        const std::vector<unsigned> &indices = mesh.indices();
+        size_t stripLength = indices.empty() ? mesh.vertices().size() : indices.size();
+        for (size_t k = 0; k + 1 < stripLength; k++) {
+            segments.push_back(indices.empty() ? unsigned(k) : indices[k]);
+            segments.push_back(indices.empty() ? unsigned(k + 1) : indices[k + 1]);
+        }
+
+        // Scatter the agents
+        float *x = voices.field(FIELD_X);
+        float *y = voices.field(FIELD_Y);
+        float *size = voices.field(FIELD_SIZE);
+        for (size_t i = 0; i < voices.size(); i++) {
+            x[i] = randomGenerator.uniformS();
+            y[i] = randomGenerator.uniformS();
+            size[i] = 0.02f + randomGenerator.uniform() * 0.05f;
+        }
+
+        gui << voices.indexParameter();
+        for (int f = 0; f < NUM_FIELDS; f++) {
+            gui << voices.proxy(f);
+        }
+        gui.init(); // Initialize GUI. Don't forget this!
+        navControl().active(false); // Disable nav control (because we are using the control to drive the synth
+
+        // Receive OSC through the app's parameter server
+        parameterServer().registerOSCListener(&voices);
+        std::cout << "Set agent values with OSC at: " << voices.address(FIELD_X, 0) << std::endl;
+    }
+
+    virtual void onAnimate(double dt) override {
+        // Values from OSC are written here, not on the OSC thread
+        voices.applyReceived();
+
+        // Update loops touch one contiguous array at a time
+        float *y = voices.field(FIELD_Y);
+        float drift = float(dt) * 0.05f;
+        for (size_t i = 0; i < NUM_VOICES; i++) {
+            y[i] += drift;
+            y[i] = y[i] > 1.0f ? y[i] - 2.0f : y[i];
+        }
+    }
+
+    virtual void onDraw(Graphics &g) override
+    {
+        g.clear();
+
+        const float *x = voices.field(FIELD_X);
+        const float *y = voices.field(FIELD_Y);
+        const float *size = voices.field(FIELD_SIZE);
+        const std::vector<Vec3f> &vertices = mesh.vertices();
+        agents.reset(); // Keeps the memory of the previous frame
+        agents.primitive(Mesh::LINES);
+        for (size_t i = 0; i < NUM_VOICES; i++) {
+            unsigned first = unsigned(i * vertices.size());
+            for (auto &v: vertices) {
+                agents.vertex(v.x * size[i] + x[i], v.y * size[i] + y[i], v.z * size[i]);
+            }
+            for (auto index: segments) {
+                agents.index(first + index);
+            }
+        }
+        g.draw(agents);
+
+        gui.draw(g);
+    }
+
+    virtual void onKeyDown(const Keyboard& k) override
+    {
+        if (k.alt()) {
+            if (k.isNumber()) { // Use alt + any number key to store preset
+                voices.storePreset(std::to_string(k.keyAsNumber()));
+            }
+        } else if (k.isNumber()) { // Recall preset using the number keys
+            voices.recallPreset(std::to_string(k.keyAsNumber()));
+        }
+    }
+
+private:
+    Mesh mesh;
+    std::vector<unsigned> segments;
+    Mesh agents; // All agents, rebuilt every frame
+
+    ParameterArrayBundle<NUM_VOICES, NUM_FIELDS> voices {"myvoice", {{
+        {"X", "Position", 0.0f, -1.0f, 1.0f},
+        {"Y", "Position", 0.0f, -1.0f, 1.0f},
+        {"Scale", "Size", 1.0f, 0.01f, 3.0f}
+    }}};
+
+    rnd::Random<> randomGenerator; // Random number generator
+
+    ControlGUI gui;
+};
+
+
+int main(int argc, char *argv[])
+{
+    MyApp app;
+    app.dimensions(800, 600);
+    app.start();
+    return 0;
+}
@@ -0,0 +1,530 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "al/core/app/al_App.hpp"
+#include "al/core/graphics/al_Shapes.hpp"
+#include "al/core/math/al_Random.hpp"
+#include "al/util/ui/al_Parameter.hpp"
+#include "al/util/ui/al_Preset.hpp"
+#include "al/util/ui/al_ControlGUI.hpp"
+
+using namespace al;
+
+/*
+ * This tutorial shows how to pack many presets into a single binary "bank"
+ * file so that recalling a preset does not need to touch the disk.
+ *
+ * PresetHandler stores every preset in its own text file and reads and
+ * parses that file when the preset is recalled. With large parameter sets
+ * or slow disks this can cause hitches during a performance.
+ *
+ * A PresetBank is built once from the text presets. All presets are stored
+ * in one indexed binary file with this layout:
+ *
+ *   header       magic "ALPBANK1", number of addresses, number of presets
+ *   addresses    the OSC address of each parameter (the bank's columns)
+ *   presets      the name of each preset (the bank's rows)
+ *   values       numPresets x numAddresses floats. NaN marks a parameter
+ *                that is not part of a preset.
+ *
+ * When the bank is opened the file is memory-mapped and a hash table from
+ * preset name to row is built. Recalling a preset is then a lookup and a
+ * copy of floats into the parameters.
+ *
+ * A bank is written to a temporary file which is then renamed over the
+ * bank file. A bank that is open keeps the old file mapped until it is
+ * opened again, as truncating a mapped file would crash its readers.
+ *
+ * Banks can be exported back to the text format, so you can keep editing
+ * presets with PresetHandler.
+ *
+ * Use alt + number to store a preset, shift + number to recall it from the
+ * bank and 'b' to rebuild the bank from the text presets.
+ * Run with "--benchmark" to compare recall times.
+*/
+
+class PresetBank
+{
+public:
+    ~PresetBank() { close(); }
+
+    PresetBank &operator<< (Parameter &param) {
+        registerParameter(param);
+        return *this;
+    }
+
+    // Parameters are matched to the bank's columns by their OSC address
+    void registerParameter(Parameter &param) {
+        mParameters.push_back(&param);
+        bindParameters();
+    }
+
+    /*
+     * Read text presets (in the PresetHandler format) from directory and
+     * write them to a bank file.
+     */
+    static bool build(std::string directory, const std::vector<std::string> &presetNames,
+                      std::string bankFile) {
+        std::vector<std::string> addresses;
+        std::unordered_map<std::string, uint32_t> columns;
+        std::vector<std::string> names;
+        std::vector<std::vector<float>> rows;
+        for (auto &name: presetNames) {
+            std::map<std::string, float> values;
+            if (!readTextPreset(directory + "/" + name + ".preset", values)) {
+                continue;
+            }
+            names.push_back(name);
+            rows.push_back(std::vector<float>(addresses.size(), std::numeric_limits<float>::quiet_NaN()));
+            for (auto &value: values) {
+                auto column = columns.find(value.first);
+                if (column == columns.end()) {
+                    column = columns.insert({value.first, (uint32_t) addresses.size()}).first;
+                    addresses.push_back(value.first);
+                    for (auto &row: rows) {
+                        row.push_back(std::numeric_limits<float>::quiet_NaN());
+                    }
+                }
+                rows.back()[column->second] = value.second;
+            }
+        }
+        return write(bankFile, addresses, names, rows);
+    }
+
+    // Write all presets in the bank as text presets into directory
+    bool exportText(std::string directory) {
+        for (uint32_t p = 0; p < mNumPresets; p++) {
+            std::ofstream f(directory + "/" + mNames[p] + ".preset");
+            if (!f.is_open()) {
+                return false;
+            }
+            f << "::" << mNames[p] << std::endl;
+            const float *row = mValues + size_t(p) * mAddresses.size();
+            for (size_t a = 0; a < mAddresses.size(); a++) {
+                if (!std::isnan(row[a])) {
+                    f << mAddresses[a] << " f " << row[a] << std::endl;
+                }
+            }
+            f << "::" << std::endl;
+        }
+        return true;
+    }
+
+    bool open(std::string bankFile) {
+        close();
+#ifdef _WIN32
+        std::ifstream f(bankFile, std::ios::binary | std::ios::ate);
+        if (!f.is_open()) {
+            return false;
+        }
+        mSize = (size_t) f.tellg();
+        mBuffer.resize(mSize);
+        f.seekg(0);
+        f.read(mBuffer.data(), mSize);
+        mData = mBuffer.data();
+#else
+        int fd = ::open(bankFile.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            ::close(fd);
+            return false;
+        }
+        mSize = (size_t) st.st_size;
+        void *mapped = mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED) {
+            return false;
+        }
+        mData = (const char *) mapped;
+#endif
+        if (!parse()) {
+            close();
+            return false;
+        }
+        bindParameters();
+        return true;
+    }
+
+    void close() {
+#ifndef _WIN32
+        if (mData) {
+            munmap((void *) mData, mSize);
+        }
+#endif
+        mData = nullptr;
+        mSize = 0;
+        mValues = nullptr;
+        mNumPresets = 0;
+        mAddresses.clear();
+        mNames.clear();
+        mRows.clear();
+        mColumns.clear();
+    }
+
+    // Recall a preset by name. No file access happens here.
+    bool recallPreset(const std::string &name) {
+        auto row = mRows.find(name);
+        if (row == mRows.end()) {
+            return false;
+        }
+        const float *values = mValues + size_t(row->second) * mAddresses.size();
+        for (size_t i = 0; i < mParameters.size(); i++) {
+            int column = mColumns[i];
+            if (column >= 0 && !std::isnan(values[column])) {
+                mParameters[i]->set(values[column]);
+            }
+        }
+        return true;
+    }
+
+    bool recallPreset(int index) { return recallPreset(std::to_string(index)); }
+
+    uint32_t numPresets() const { return mNumPresets; }
+
+    /*
+     * Parse a PresetHandler text preset. Only float values are read.
+     */
+    static bool readTextPreset(std::string fileName, std::map<std::string, float> &values) {
+        std::ifstream f(fileName);
+        if (!f.is_open()) {
+            return false;
+        }
+        std::string line;
+        while (std::getline(f, line)) {
+            if (line.compare(0, 2, "::") == 0) {
+                continue; // Preset name or end marker
+            }
+            std::stringstream ss(line);
+            std::string address, type;
+            float value;
+            if (ss >> address >> type >> value && type == "f") {
+                values[address] = value;
+            }
+        }
+        return true;
+    }
+
+private:
+    struct Header {
+        char magic[8];
+        uint32_t numAddresses;
+        uint32_t numPresets;
+    };
+
+    static void writeString(std::ofstream &f, const std::string &s) {
+        uint32_t length = (uint32_t) s.size();
+        f.write((const char *) &length, sizeof(length));
+        f.write(s.data(), length);
+    }
+
+    static bool write(std::string bankFile, const std::vector<std::string> &addresses,
+                      const std::vector<std::string> &names,
+                      const std::vector<std::vector<float>> &rows) {
+        std::string tempFile = bankFile + ".tmp";
+        if (!writeFile(tempFile, addresses, names, rows)) {
+            std::remove(tempFile.c_str());
+            return false;
+        }
+#ifdef _WIN32
+        std::remove(bankFile.c_str()); // rename() does not replace files on Windows
+#endif
+        if (std::rename(tempFile.c_str(), bankFile.c_str()) != 0) {
+            std::remove(tempFile.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    static bool writeFile(std::string fileName, const std::vector<std::string> &addresses,
+                          const std::vector<std::string> &names,
+                          const std::vector<std::vector<float>> &rows) {
+        std::ofstream f(fileName, std::ios::binary);
+        if (!f.is_open()) {
+            return false;
+        }
+        Header header;
+        std::memcpy(header.magic, "ALPBANK1", 8);
+        header.numAddresses = (uint32_t) addresses.size();
+        header.numPresets = (uint32_t) names.size();
+        f.write((const char *) &header, sizeof(header));
+        for (auto &address: addresses) {
+            writeString(f, address);
+        }
+        for (auto &name: names) {
+            writeString(f, name);
+        }
+        // Align the values so they can be read in place
+        size_t position = (size_t) f.tellp();
+        while (position % sizeof(float) != 0) {
+            f.put(0);
+            position++;
+        }
+        for (auto &row: rows) {
+            f.write((const char *) row.data(), row.size() * sizeof(float));
+        }
+        f.close();
+        return !f.fail();
+    }
+
+    bool readString(size_t &offset, std::string &s) {
+        uint32_t length;
+        if (offset + sizeof(length) > mSize) {
+            return false;
+        }
+        std::memcpy(&length, mData + offset, sizeof(length));
+        offset += sizeof(length);
+        if (offset + length > mSize) {
+            return false;
+        }
+        s.assign(mData + offset, length);
+        offset += length;
+        return true;
+    }
+
+    bool parse() {
+        Header header;
+        if (mSize < sizeof(header)) {
+            return false;
+        }
+        std::memcpy(&header, mData, sizeof(header));
+        if (std::memcmp(header.magic, "ALPBANK1", 8) != 0) {
+            return false;
+        }
+        size_t offset = sizeof(header);
+        mAddresses.resize(header.numAddresses);
+        for (auto &address: mAddresses) {
+            if (!readString(offset, address)) {
+                return false;
+            }
+        }
+        mNames.resize(header.numPresets);
+        for (uint32_t p = 0; p < header.numPresets; p++) {
+            if (!readString(offset, mNames[p])) {
+                return false;
+            }
+            mRows[mNames[p]] = p;
+        }
+        offset = (offset + sizeof(float) - 1) / sizeof(float) * sizeof(float);
+        if (offset + size_t(header.numPresets) * header.numAddresses * sizeof(float) > mSize) {
+            return false;
+        }
+        mValues = (const float *) (mData + offset);
+        mNumPresets = header.numPresets;
+        return true;
+    }
+
+    void bindParameters() {
+        mColumns.assign(mParameters.size(), -1);
+        for (size_t i = 0; i < mParameters.size(); i++) {
+            std::string address = mParameters[i]->getFullAddress();
+            for (size_t a = 0; a < mAddresses.size(); a++) {
+                if (mAddresses[a] == address) {
+                    mColumns[i] = (int) a;
+                    break;
+                }
+            }
+        }
+    }
+
+    std::vector<Parameter *> mParameters;
+    std::vector<int> mColumns; // Bank column for each registered parameter
+
+    const char *mData {nullptr};
+    size_t mSize {0};
+    std::vector<char> mBuffer; // Used when memory mapping is not available
+    const float *mValues {nullptr};
+    uint32_t mNumPresets {0};
+    std::vector<std::string> mAddresses;
+    std::vector<std::string> mNames;
+    std::unordered_map<std::string, uint32_t> mRows;
+};
+
+
+class MyApp : public App
+{
+public:
+
+    virtual void onCreate() override {
+        nav().pos(Vec3d(0,0,8)); // Set the camera to view the scene
+        addCone(mesh); // Prepare mesh to draw a cone
+        mesh.primitive(Mesh::LINE_STRIP);
+
+        gui << X << Y << Size; // Register the parameters with the GUI
+        gui << presetHandler; // Register the preset handler with GUI
+        gui.init(); // Initialize GUI. Don't forget this!
+
+        presetHandler << X << Y << Size;
+        bank << X << Y << Size;
+        buildBank();
+    }
+
+    void buildBank() {
+        std::vector<std::string> names;
+        for (int i = 0; i < 10; i++) {
+            names.push_back(std::to_string(i));
+        }
+        // The presets written by the PresetHandler are in its current path
+        if (!PresetBank::build(presetHandler.getCurrentPath(), names, "presets.bank")) {
+            std::cout << "Could not write presets.bank" << std::endl;
+            return;
+        }
+        if (bank.open("presets.bank")) {
+            std::cout << "Bank loaded with " << bank.numPresets() << " presets" << std::endl;
+        }
+    }
+
+    virtual void onAnimate(double /*dt*/) override {
+        navControl().active(!gui.usingInput());
+    }
+
+    virtual void onDraw(Graphics &g) override
+    {
+        g.clear();
+
+        g.pushMatrix();
+        g.translate(X.get(), Y.get(), 0);
+        g.scale(Size.get());
+        g.draw(mesh); // Draw the mesh
+        g.popMatrix();
+
+        gui.draw(g);
+    }
+
+    virtual void onKeyDown(const Keyboard& k) override
+    {
+        if (k.alt()) {
+            if (k.isNumber()) { // Use alt + any number key to store preset
+                presetHandler.storePreset(k.keyAsNumber(), std::to_string(k.keyAsNumber()));
+            }
+        } else if (k.shift()) {
+            if (k.isNumber()) { // Recall from the bank
+                bank.recallPreset(k.keyAsNumber());
+            }
+        } else if (k.key() == 'b') {
+            buildBank();
+        } else if (k.key() == ' ') { // Randomize parameters
+            X = randomGenerator.uniformS();
+            Y = randomGenerator.uniformS();
+            Size = 0.1 + randomGenerator.uniform() * 2.0;
+        }
+    }
+
+private:
+    Mesh mesh;
+
+    Parameter X {"X", "Position", 0.0, "", -1.0f, 1.0f};
+    Parameter Y {"Y", "Position", 0.0, "", -1.0f, 1.0f};
+    Parameter Size {"Scale", "Size", 1.0, "", 0.1f, 3.0f};
+
+    PresetHandler presetHandler {"sequencerPresets"};
+    PresetBank bank;
+
+    rnd::Random<> randomGenerator; // Random number generator
+
+    ControlGUI gui;
+};
+
+
+/*
+ * Writes text presets for many parameters, then compares reading and
+ * parsing the text file on every recall against recalling from the bank.
+ */
+void runBenchmark()
+{
+    const int numParameters = 500;
+    const int numPresets = 50;
+    const int numRecalls = 2000;
+    const std::string directory = "."; // Use the running directory
+
+    std::vector<std::unique_ptr<Parameter>> params;
+    std::vector<std::string> names;
+    for (int i = 0; i < numParameters; i++) {
+        params.emplace_back(new Parameter("P" + std::to_string(i), "Bench", 0.0));
+    }
+    for (int p = 0; p < numPresets; p++) {
+        names.push_back("bench" + std::to_string(p));
+        std::ofstream f(directory + "/" + names.back() + ".preset");
+        f << "::" << names.back() << std::endl;
+        for (auto &param: params) {
+            f << param->getFullAddress() << " f " << (p * 0.01f) << std::endl;
+        }
+        f << "::" << std::endl;
+    }
+
+    // Text: read and parse the file, then set the parameters
+    std::unordered_map<std::string, Parameter *> byAddress;
+    for (auto &param: params) {
+        byAddress[param->getFullAddress()] = param.get();
+    }
+    double worstText = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < numRecalls; i++) {
+        auto recallStart = std::chrono::high_resolution_clock::now();
+        std::map<std::string, float> values;
+        PresetBank::readTextPreset(directory + "/" + names[i % numPresets] + ".preset", values);
+        for (auto &value: values) {
+            byAddress[value.first]->set(value.second);
+        }
+        std::chrono::duration<double> recall = std::chrono::high_resolution_clock::now() - recallStart;
+        worstText = std::max(worstText, recall.count());
+    }
+    std::chrono::duration<double> text = std::chrono::high_resolution_clock::now() - start;
+
+    PresetBank bank;
+    for (auto &param: params) {
+        bank << *param;
+    }
+    if (!PresetBank::build(directory, names, "bench.bank") || !bank.open("bench.bank")) {
+        std::cout << "Could not build bench.bank" << std::endl;
+        return;
+    }
+    double worstBank = 0;
+    start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < numRecalls; i++) {
+        auto recallStart = std::chrono::high_resolution_clock::now();
+        bank.recallPreset(names[i % numPresets]);
+        std::chrono::duration<double> recall = std::chrono::high_resolution_clock::now() - recallStart;
+        worstBank = std::max(worstBank, recall.count());
+    }
+    std::chrono::duration<double> banked = std::chrono::high_resolution_clock::now() - start;
+
+    std::cout << numParameters << " parameters, " << numPresets << " presets" << std::endl;
+    std::cout << "Text: " << text.count() * 1e6 / numRecalls << " us/recall, worst "
+              << worstText * 1e6 << " us" << std::endl;
+    std::cout << "Bank: " << banked.count() * 1e6 / numRecalls << " us/recall, worst "
+              << worstBank * 1e6 << " us" << std::endl;
+}
+
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1 && std::string(argv[1]) == "--benchmark") {
+        runBenchmark();
+        return 0;
+    }
+    MyApp app;
+    app.dimensions(800, 600);
+    app.start();
+    return 0;
+}
@@ -0,0 +1,458 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "al/core/app/al_App.hpp"
+#include "al/core/graphics/al_Shapes.hpp"
+#include "al/util/ui/al_Parameter.hpp"
+#include "al/util/ui/al_ControlGUI.hpp"
+
+#include "Gamma/Oscillator.h"
+#include "Gamma/Domain.h"
+
+using namespace al;
+
+/*
+ * This tutorial shows how to play a preset sequence with sample accurate
+ * timing, clocked by the audio callback.
+ *
+ * PresetSequencer reads the .sequence file when playback starts and steps
+ * through it from its own thread, sleeping between steps. Sleeping is not
+ * precise: every step can wake up late, and the lateness accumulates over
+ * the length of the sequence. The changes also reach the audio thread at
+ * block boundaries.
+ *
+ * A CompiledTimeline reads the sequence and all the presets it references
+ * once, and turns them into an in-memory table:
+ *
+ *   - one row of target values for each step, ordered like the registered
+ *     parameters
+ *   - the start sample and the end of the morph of each step, computed
+ *     from the accumulated time in seconds so rounding never accumulates
+ *
+ * The audio callback counts samples and asks the timeline for the values at
+ * every sample, so preset changes and morphs land exactly on their sample
+ * even in the middle of a block. Finding the current step is O(1) because
+ * playback only moves forward. As in PresetSequencer, the first step morphs
+ * from the values the parameters have when playback starts.
+ *
+ * The parameters follow the audio through onAnimate(), so they are up to a
+ * frame behind. When the sequence ends, the audio keeps the sequence's last
+ * values until onAnimate() has copied them to the parameters, so a sequence
+ * that ends in the middle of a morph doesn't jump.
+ *
+ * This tutorial uses the "demo.sequence" file and the presets created in
+ * the sequencer tutorial (04_sequencer_system.cpp). Press space to play.
+ * Run with "--benchmark" to measure the sample at which each step actually
+ * takes effect in a simulated audio callback, for a sleeping thread and
+ * for the compiled timeline.
+*/
+
+class CompiledTimeline
+{
+public:
+    CompiledTimeline &operator<< (Parameter &param) {
+        mAddresses.push_back(param.getFullAddress());
+        return *this;
+    }
+
+    size_t numValues() const { return mAddresses.size(); }
+
+    /*
+     * Read a sequence file and the presets it references. Must be called
+     * before starting audio or while the timeline is not playing.
+     */
+    bool compile(std::string sequenceFile, std::string presetDirectory, double sampleRate) {
+        std::ifstream f(sequenceFile);
+        if (!f.is_open()) {
+            std::cout << "Can't open sequence: " << sequenceFile << std::endl;
+            return false;
+        }
+        mSteps.clear();
+        mRows.clear();
+        std::map<std::string, size_t> loadedPresets;
+        double time = 0; // seconds
+        std::string line;
+        while (std::getline(f, line)) {
+            if (line.compare(0, 2, "::") == 0) {
+                break; // End of sequence
+            }
+            std::stringstream ss(line);
+            std::string name, morph, wait;
+            if (!std::getline(ss, name, ':') || !std::getline(ss, morph, ':')
+                    || !std::getline(ss, wait)) {
+                continue;
+            }
+            auto preset = loadedPresets.find(name);
+            if (preset == loadedPresets.end()) {
+                preset = loadedPresets.insert({name, loadPreset(presetDirectory + "/" + name + ".preset")}).first;
+            }
+            double morphTime = std::stod(morph);
+            double waitTime = std::stod(wait);
+            Step step;
+            step.start = uint64_t(std::llround(time * sampleRate));
+            step.morphEnd = uint64_t(std::llround((time + morphTime) * sampleRate));
+            step.row = preset->second;
+            mSteps.push_back(step);
+            time += morphTime + waitTime;
+        }
+        mEnd = uint64_t(std::llround(time * sampleRate));
+        return mSteps.size() > 0;
+    }
+
+    /*
+     * Start playback at sampleTime. currentValues holds numValues() values
+     * that the first step morphs from.
+     */
+    void play(uint64_t sampleTime, const float *currentValues) {
+        mPlayStart = sampleTime;
+        mCurrentStep = 0;
+        mPlaying = mSteps.size() > 0;
+        mFrom.assign(currentValues, currentValues + mAddresses.size());
+    }
+
+    bool playing() const { return mPlaying; }
+
+    /*
+     * Compute the values at sampleTime and write them to values.
+     * sampleTime must not go backwards during playback.
+     * Returns false when the sequence is not playing.
+     */
+    bool valuesAt(uint64_t sampleTime, float *values) {
+        if (!mPlaying || sampleTime < mPlayStart) {
+            return false;
+        }
+        uint64_t t = sampleTime - mPlayStart;
+        // Move to the step that contains t
+        while (mCurrentStep + 1 < mSteps.size() && mSteps[mCurrentStep + 1].start <= t) {
+            mFrom = mRows[mSteps[mCurrentStep].row];
+            mCurrentStep++;
+        }
+        const Step &step = mSteps[mCurrentStep];
+        const std::vector<float> &to = mRows[step.row];
+        float c = 1.0f;
+        if (t < step.morphEnd) {
+            c = float(t - step.start) / float(step.morphEnd - step.start);
+        }
+        for (size_t i = 0; i < mFrom.size(); i++) {
+            values[i] = mFrom[i] + (to[i] - mFrom[i]) * c;
+        }
+        if (t >= mEnd) {
+            mPlaying = false;
+        }
+        return true;
+    }
+
+private:
+    struct Step {
+        uint64_t start;
+        uint64_t morphEnd;
+        size_t row;
+    };
+
+    // Load the registered values of a preset as a new row. Values missing
+    // in the preset are set to 0.
+    size_t loadPreset(std::string fileName) {
+        std::vector<float> row(mAddresses.size(), 0.0f);
+        std::ifstream f(fileName);
+        std::string line;
+        while (std::getline(f, line)) {
+            std::stringstream ss(line);
+            std::string address, type;
+            float value;
+            if (ss >> address >> type >> value) {
+                for (size_t i = 0; i < mAddresses.size(); i++) {
+                    if (mAddresses[i] == address) {
+                        row[i] = value;
+                    }
+                }
+            }
+        }
+        mRows.push_back(row);
+        return mRows.size() - 1;
+    }
+
+    std::vector<std::string> mAddresses;
+    std::vector<std::vector<float>> mRows;
+    std::vector<Step> mSteps;
+    uint64_t mEnd {0};
+
+    bool mPlaying {false};
+    uint64_t mPlayStart {0};
+    size_t mCurrentStep {0};
+    std::vector<float> mFrom;
+};
+
+
+class MyApp : public App
+{
+public:
+
+    virtual void onInit() override {
+        timeline << X << Y << Size;
+        timeline.compile("presets/demo.sequence", "presets", 44100);
+    }
+
+    virtual void onCreate() override {
+        nav().pos(Vec3d(0,0,8)); // Set the camera to view the scene
+        addCone(mesh); // Prepare mesh to draw a cone
+        mesh.primitive(Mesh::LINE_STRIP);
+
+        gui << X << Y << Size; // Register the parameters with the GUI
+        gui.init(); // Initialize GUI. Don't forget this!
+    }
+
+    virtual void onAnimate(double /*dt*/) override {
+        navControl().active(!gui.usingInput());
+        // Reflect the sequence in the parameters, so the GUI and graphics
+        // follow the audio. When the sequence has stopped, its last values
+        // are copied once more.
+        unsigned stops = sequenceStops.load();
+        if (sequencePlaying.load() || stops != stopsCopied.load()) {
+            X = audioValues[0].load();
+            Y = audioValues[1].load();
+            Size = audioValues[2].load();
+            stopsCopied.store(stops);
+        }
+    }
+
+    virtual void onDraw(Graphics &g) override
+    {
+        g.clear();
+
+        g.pushMatrix();
+        g.translate(X.get(), Y.get(), 0);
+        g.scale(Size.get());
+        g.draw(mesh); // Draw the mesh
+        g.popMatrix();
+
+        gui.draw(g);
+    }
+
+    virtual void onSound(AudioIOData &io) override {
+        float values[3] = {X.get(), Y.get(), Size.get()};
+        if (holding) {
+            // The parameters are a frame behind the audio. Until onAnimate()
+            // has copied the end of the sequence to them, keep its values.
+            if (stopsCopied.load() == sequenceStops.load()) {
+                holding = false;
+            } else {
+                for (int i = 0; i < 3; i++) {
+                    values[i] = audioValues[i].load();
+                }
+            }
+        }
+        if (playRequested.exchange(false)) {
+            // Playback starts at the first sample of this block
+            timeline.play(sampleTime, values);
+            holding = false;
+        }
+        bool playing = false;
+        while(io()) {
+            // Values are computed for every sample while the sequence plays
+            playing = timeline.valuesAt(sampleTime, values);
+            float pan = (values[0] + 1.0f) * 0.5f;
+            mSource.freq(220.0f * powf(2.0f, values[1] + 1.0f));
+            float sample = mSource() * values[2] * 0.05f;
+            io.out(0) += sample * (1.0f - pan);
+            io.out(1) += sample * pan;
+            sampleTime++;
+        }
+        for (int i = 0; i < 3; i++) {
+            audioValues[i].store(values[i]);
+        }
+        if (wasPlaying && !playing) {
+            holding = true;
+            sequenceStops++;
+        }
+        wasPlaying = playing;
+        sequencePlaying.store(playing);
+    }
+
+    virtual void onKeyDown(const Keyboard& k) override
+    {
+        if (k.key() == ' ') {
+            playRequested.store(true);
+        }
+    }
+
+private:
+    Mesh mesh;
+
+    Parameter X {"X", "Position", 0.0, "", -1.0f, 1.0f};
+    Parameter Y {"Y", "Position", 0.0, "", -1.0f, 1.0f};
+    Parameter Size {"Scale", "Size", 1.0, "", 0.1f, 3.0f};
+
+    CompiledTimeline timeline;
+    uint64_t sampleTime {0}; // Only used in the audio thread
+    bool wasPlaying {false}; // Only used in the audio thread
+    bool holding {false}; // Only used in the audio thread
+    std::atomic<bool> playRequested {false};
+    std::atomic<bool> sequencePlaying {false};
+    std::atomic<unsigned> sequenceStops {0};
+    std::atomic<unsigned> stopsCopied {0};
+    std::atomic<float> audioValues[3] {{0.0f}, {0.0f}, {1.0f}};
+
+    gam::Sine<> mSource;
+
+    ControlGUI gui;
+};
+
+
+/*
+ * Writes a sequence that alternates between preset benchmark_a (value 0)
+ * and benchmark_b (value 1) with irregular step times, so every step
+ * changes the value. Returns the start time of each step in seconds.
+ */
+std::vector<double> writeBenchmarkSequence(std::string address, double duration)
+{
+    std::ofstream a("benchmark_a.preset");
+    a << "::benchmark_a" << std::endl << address << " f 0" << std::endl << "::" << std::endl;
+    std::ofstream b("benchmark_b.preset");
+    b << "::benchmark_b" << std::endl << address << " f 1" << std::endl << "::" << std::endl;
+
+    std::vector<double> starts;
+    std::ofstream f("benchmark.sequence");
+    double time = 0;
+    while (time < duration) {
+        int i = int(starts.size());
+        double wait = 0.02 + 0.001 * (i % 7); // Exact in the text file
+        f << (i % 2 == 0 ? "benchmark_a" : "benchmark_b") << ":0:" << wait << std::endl;
+        starts.push_back(time);
+        time += wait;
+    }
+    f << "::" << std::endl;
+    return starts;
+}
+
+// Prints how far the actual trigger times are from the ideal times
+void printErrors(std::string name, const std::vector<uint64_t> &triggers,
+                 const std::vector<double> &ideal, double sampleRate)
+{
+    std::vector<double> errors;
+    for (size_t i = 0; i < triggers.size() && i < ideal.size(); i++) {
+        errors.push_back(triggers[i] / sampleRate - ideal[i]);
+    }
+    if (errors.size() == 0) {
+        std::cout << name << ": no steps triggered" << std::endl;
+        return;
+    }
+    double last = errors.back();
+    std::sort(errors.begin(), errors.end());
+    std::cout << name << ", " << errors.size() << " of " << ideal.size() << " steps:" << std::endl;
+    std::cout << "    trigger error ms: min " << errors.front() * 1e3
+              << " median " << errors[errors.size() / 2] * 1e3
+              << " max " << errors.back() * 1e3
+              << " (jitter " << (errors.back() - errors.front()) * 1e3 << ")" << std::endl;
+    std::cout << "    error at last step: " << last * 1e3 << " ms" << std::endl;
+}
+
+/*
+ * Runs an audio callback loop paced in real time, like a sound card would
+ * call onSound(), and records the sample at which each step of the same
+ * sequence takes effect:
+ *
+ *   - with a thread that sleeps between steps and sets the value, which
+ *     the audio loop reads once per block like a Parameter
+ *   - with the compiled timeline, evaluated at every sample
+ *
+ * Then renders an hour of the compiled timeline without pacing, to check
+ * that the trigger samples don't drift over a long sequence.
+ */
+void runBenchmark()
+{
+    const double sampleRate = 44100;
+    const int framesPerBuffer = 256;
+    const double seconds = 5;
+
+    Parameter param {"X", "Position", 0.0};
+    std::vector<double> ideal = writeBenchmarkSequence(param.getFullAddress(), seconds);
+    CompiledTimeline timeline;
+    timeline << param;
+    timeline.compile("benchmark.sequence", ".", sampleRate);
+
+    // The values before the first step, so the first step is a change too
+    float initial = -1.0f;
+    std::atomic<float> sleptValue {initial};
+    auto start = std::chrono::steady_clock::now();
+    std::thread stepper([&]() {
+        for (size_t i = 0; i < ideal.size(); i++) {
+            sleptValue.store(float(i % 2));
+            double wait = i + 1 < ideal.size() ? ideal[i + 1] - ideal[i] : 0;
+            std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+        }
+    });
+
+    std::vector<uint64_t> sleptTriggers, timelineTriggers;
+    float lastSlept = initial, lastTimeline = initial;
+    timeline.play(0, &initial);
+    uint64_t numBlocks = uint64_t((seconds + 0.5) * sampleRate / framesPerBuffer);
+    for (uint64_t block = 0; block < numBlocks; block++) {
+        // Wait for the "sound card" to ask for this block
+        std::this_thread::sleep_until(start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                          std::chrono::duration<double>(block * framesPerBuffer / sampleRate)));
+        float slept = sleptValue.load(); // Read once per block, like a Parameter
+        for (int frame = 0; frame < framesPerBuffer; frame++) {
+            uint64_t sample = block * framesPerBuffer + frame;
+            if (slept != lastSlept) {
+                sleptTriggers.push_back(sample);
+                lastSlept = slept;
+            }
+            float value = lastTimeline;
+            timeline.valuesAt(sample, &value);
+            if (value != lastTimeline) {
+                timelineTriggers.push_back(sample);
+                lastTimeline = value;
+            }
+        }
+    }
+    stepper.join();
+
+    std::cout << "Real time audio loop, " << framesPerBuffer << " frames per block:" << std::endl;
+    printErrors("Sleeping thread", sleptTriggers, ideal, sampleRate);
+    printErrors("Compiled timeline", timelineTriggers, ideal, sampleRate);
+
+    // An hour, as fast as possible
+    ideal = writeBenchmarkSequence(param.getFullAddress(), 3600);
+    timeline.compile("benchmark.sequence", ".", sampleRate);
+    timelineTriggers.clear();
+    lastTimeline = initial;
+    timeline.play(0, &initial);
+    uint64_t numSamples = uint64_t(3600.5 * sampleRate);
+    for (uint64_t sample = 0; sample < numSamples; sample++) {
+        float value = lastTimeline;
+        timeline.valuesAt(sample, &value);
+        if (value != lastTimeline) {
+            timelineTriggers.push_back(sample);
+            lastTimeline = value;
+        }
+    }
+    std::cout << "One hour, rendered offline:" << std::endl;
+    printErrors("Compiled timeline", timelineTriggers, ideal, sampleRate);
+
+    std::remove("benchmark.sequence");
+    std::remove("benchmark_a.preset");
+    std::remove("benchmark_b.preset");
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1 && std::string(argv[1]) == "--benchmark") {
+        runBenchmark();
+        return 0;
+    }
+    MyApp app;
+    app.dimensions(800, 600);
+    app.initAudio(44100, 256, 2, 0);
+    gam::sampleRate(44100);
+    app.start();
+    return 0;
+}
@@ -0,0 +1,442 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "al/core/app/al_App.hpp"
+#include "al/core/graphics/al_Shapes.hpp"
+#include "al/util/ui/al_Parameter.hpp"
+#include "al/util/ui/al_ControlGUI.hpp"
+
+using namespace al;
+
+/*
+ * This tutorial shows how to load all the presets of a sequence before
+ * they are needed, and how to share the loaded presets between several
+ * groups of parameters.
+ *
+ * PresetSequencer loads each preset from disk when its step comes up. On a
+ * slow or network-mounted disk, the first time through a sequence stutters.
+ *
+ * A PresetCache keeps decoded presets in memory, keyed by file name, and
+ * forgets the least recently used ones when it is full. A single loader
+ * thread reads prefetched presets in the background, in the order they
+ * were requested. If a preset is requested while it is still being loaded,
+ * the request waits for that load instead of reading the file again.
+ *
+ * A CachedSequencePlayer plays a .sequence file for a group of parameters.
+ * When the sequence is loaded, it scans it for every preset it uses and
+ * asks the cache to prefetch them all, so they are read before playback
+ * starts. During playback the player never blocks the frame: if a step's
+ * preset is still loading, the step waits for it on the following frames.
+ * Steps start when the previous one ends, not on the next frame, so the
+ * timing of the sequence does not drift with the frame rate.
+ * Two players share one cache here, one for the position and one for the
+ * size of the cone.
+ *
+ * The "demo" sequence from the sequencer tutorial is loaded on both
+ * players when the app starts. Press space to play it. The cache hit and
+ * miss counters are printed when the sequence finishes.
+*/
+
+class PresetCache
+{
+public:
+    typedef std::map<std::string, float> Values;
+    typedef std::shared_ptr<const Values> ValuesPtr;
+
+    PresetCache(size_t capacity = 64) : mCapacity(capacity) {
+        mLoader = std::thread([this]() { loaderLoop(); });
+    }
+
+    ~PresetCache() {
+        {
+            std::unique_lock<std::mutex> lk(mLock);
+            mRunning = false;
+        }
+        mQueueChanged.notify_one();
+        mLoader.join();
+    }
+
+    /*
+     * Get a preset, loading it if it is not in the cache.
+     * Returns an empty pointer if the file can't be read.
+     */
+    ValuesPtr get(const std::string &fileName) {
+        std::unique_lock<std::mutex> lk(mLock);
+        auto entry = mEntries.find(fileName);
+        if (entry != mEntries.end()) {
+            touch(entry->second);
+            std::shared_future<ValuesPtr> future = entry->second.future;
+            if (future.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+                mHits++;
+            } else {
+                countWait(entry->second); // Being prefetched, wait for it
+            }
+            lk.unlock();
+            return future.get();
+        }
+        mMisses++;
+        std::promise<ValuesPtr> promise;
+        insert(fileName, promise.get_future().share());
+        lk.unlock();
+        ValuesPtr values = load(fileName);
+        promise.set_value(values);
+        return values;
+    }
+
+    /*
+     * Returns true if the preset has been loaded, without blocking. If it
+     * is not in the cache, it is queued for loading.
+     */
+    bool ready(const std::string &fileName) {
+        std::unique_lock<std::mutex> lk(mLock);
+        auto entry = mEntries.find(fileName);
+        if (entry == mEntries.end()) {
+            mMisses++;
+            enqueue(fileName);
+            lk.unlock();
+            mQueueChanged.notify_one();
+            return false;
+        }
+        if (entry->second.future.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            countWait(entry->second);
+            return false;
+        }
+        return true;
+    }
+
+    // Queue presets that are not in the cache for the loader thread
+    void prefetch(const std::vector<std::string> &fileNames) {
+        std::unique_lock<std::mutex> lk(mLock);
+        for (auto &fileName: fileNames) {
+            if (mEntries.find(fileName) == mEntries.end()) {
+                enqueue(fileName);
+                mPrefetches++;
+            }
+        }
+        lk.unlock();
+        mQueueChanged.notify_one();
+    }
+
+    uint64_t hits() const { return mHits; }
+    uint64_t misses() const { return mMisses; }
+    // Presets that were needed while still loading, counted once per load
+    uint64_t waits() const { return mWaits; }
+    uint64_t prefetches() const { return mPrefetches; }
+
+    static ValuesPtr load(const std::string &fileName) {
+        std::ifstream f(fileName);
+        if (!f.is_open()) {
+            return ValuesPtr();
+        }
+        std::shared_ptr<Values> values(new Values);
+        std::string line;
+        while (std::getline(f, line)) {
+            std::stringstream ss(line);
+            std::string address, type;
+            float value;
+            if (ss >> address >> type >> value && type == "f") {
+                (*values)[address] = value;
+            }
+        }
+        return values;
+    }
+
+private:
+    struct Entry {
+        std::shared_future<ValuesPtr> future;
+        std::list<std::string>::iterator position; // In the recently used list
+        bool waited;
+    };
+
+    struct Request {
+        std::string fileName;
+        std::promise<ValuesPtr> promise;
+    };
+
+    // Call while holding mLock
+    void enqueue(const std::string &fileName) {
+        mQueue.emplace_back();
+        mQueue.back().fileName = fileName;
+        insert(fileName, mQueue.back().promise.get_future().share());
+    }
+
+    // Loads queued presets until the cache is destroyed. Presets still in
+    // the queue at that point are loaded first, so no request is left
+    // without a value.
+    void loaderLoop() {
+        std::unique_lock<std::mutex> lk(mLock);
+        while (true) {
+            mQueueChanged.wait(lk, [this]() { return !mRunning || mQueue.size() > 0; });
+            if (mQueue.size() == 0) {
+                return; // Stopped
+            }
+            Request request = std::move(mQueue.front());
+            mQueue.pop_front();
+            lk.unlock();
+            request.promise.set_value(load(request.fileName));
+            lk.lock();
+        }
+    }
+
+    // Call while holding mLock. Polling with ready() counts only once.
+    void countWait(Entry &entry) {
+        if (!entry.waited) {
+            entry.waited = true;
+            mWaits++;
+        }
+    }
+
+    void touch(Entry &entry) {
+        mRecentlyUsed.splice(mRecentlyUsed.begin(), mRecentlyUsed, entry.position);
+    }
+
+    void insert(const std::string &fileName, std::shared_future<ValuesPtr> future) {
+        mRecentlyUsed.push_front(fileName);
+        mEntries[fileName] = {future, mRecentlyUsed.begin(), false};
+        // Evict least recently used presets that have finished loading
+        auto it = mRecentlyUsed.end();
+        while (mEntries.size() > mCapacity && it != mRecentlyUsed.begin()) {
+            --it;
+            auto entry = mEntries.find(*it);
+            if (entry->second.future.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+                mEntries.erase(entry);
+                it = mRecentlyUsed.erase(it);
+            }
+        }
+    }
+
+    std::mutex mLock;
+    size_t mCapacity;
+    std::unordered_map<std::string, Entry> mEntries;
+    std::list<std::string> mRecentlyUsed; // Most recent first
+
+    std::deque<Request> mQueue;
+    std::condition_variable mQueueChanged;
+    bool mRunning {true};
+    std::thread mLoader;
+
+    std::atomic<uint64_t> mHits {0};
+    std::atomic<uint64_t> mMisses {0};
+    std::atomic<uint64_t> mWaits {0};
+    std::atomic<uint64_t> mPrefetches {0};
+};
+
+
+class CachedSequencePlayer
+{
+public:
+    CachedSequencePlayer(PresetCache &cache, std::string directory = "presets") :
+        mCache(cache), mDirectory(directory)
+    {}
+
+    CachedSequencePlayer &operator<< (Parameter &param) {
+        mParameters[param.getFullAddress()] = &param;
+        return *this;
+    }
+
+    /*
+     * Read a sequence and prefetch its presets. Call well before play() so
+     * the presets are in the cache when playback starts.
+     */
+    bool loadSequence(std::string name) {
+        std::ifstream f(mDirectory + "/" + name + ".sequence");
+        if (!f.is_open()) {
+            return false;
+        }
+        mSteps.clear();
+        std::vector<std::string> fileNames;
+        std::string line;
+        while (std::getline(f, line) && line.compare(0, 2, "::") != 0) {
+            std::stringstream ss(line);
+            std::string preset, morph, wait;
+            if (std::getline(ss, preset, ':') && std::getline(ss, morph, ':')
+                    && std::getline(ss, wait)) {
+                mSteps.push_back({mDirectory + "/" + preset + ".preset",
+                                  std::stof(morph), std::stof(wait)});
+                fileNames.push_back(mSteps.back().fileName);
+            }
+        }
+        // Load every preset in the sequence before we reach its step
+        mCache.prefetch(fileNames);
+        mPlaying = false;
+        return mSteps.size() > 0;
+    }
+
+    // Play the loaded sequence from the start
+    void play() {
+        mCurrentStep = -1;
+        mStepTime = 0;
+        mStepDuration = 0;
+        mPlaying = mSteps.size() > 0;
+    }
+
+    bool playing() const { return mPlaying; }
+
+    // Call once per frame
+    void update(double dt) {
+        if (!mPlaying) {
+            return;
+        }
+        mStepTime += dt;
+        while (mStepTime >= mStepDuration) {
+            if (mCurrentStep >= 0) {
+                applyMorphs(1.0f); // End the step on its preset
+            }
+            if (mCurrentStep + 1 == (int) mSteps.size()) {
+                mPlaying = false;
+                return;
+            }
+            // Don't block the frame while the next preset loads. The
+            // current step holds its values until then, and the time spent
+            // waiting is not taken from the next step.
+            if (!mCache.ready(mSteps[mCurrentStep + 1].fileName)) {
+                mStepTime = mStepDuration;
+                return;
+            }
+            // Keep the time past the end of the step, so steps don't drift
+            mStepTime -= mStepDuration;
+            startStep(mSteps[++mCurrentStep]);
+        }
+        Step &step = mSteps[mCurrentStep];
+        applyMorphs(step.morphTime > 0 ? std::min(1.0f, float(mStepTime / step.morphTime)) : 1.0f);
+    }
+
+private:
+    struct Step {
+        std::string fileName;
+        float morphTime;
+        float waitTime;
+    };
+
+    struct Morph {
+        Parameter *param;
+        float from;
+        float to;
+    };
+
+    void applyMorphs(float c) {
+        for (auto &morph: mMorphs) {
+            morph.param->set(morph.from + (morph.to - morph.from) * c);
+        }
+    }
+
+    void startStep(Step &step) {
+        mStepDuration = step.morphTime + step.waitTime;
+        mMorphs.clear();
+        PresetCache::ValuesPtr values = mCache.get(step.fileName);
+        if (!values) {
+            return;
+        }
+        for (auto &value: *values) {
+            auto param = mParameters.find(value.first);
+            if (param != mParameters.end()) {
+                mMorphs.push_back({param->second, param->second->get(), value.second});
+            }
+        }
+    }
+
+    PresetCache &mCache;
+    std::string mDirectory;
+    std::map<std::string, Parameter *> mParameters;
+
+    std::vector<Step> mSteps;
+    std::vector<Morph> mMorphs;
+    int mCurrentStep {-1};
+    double mStepTime {0};
+    double mStepDuration {0};
+    bool mPlaying {false};
+};
+
+
+class MyApp : public App
+{
+public:
+
+    virtual void onCreate() override {
+        nav().pos(Vec3d(0,0,8)); // Set the camera to view the scene
+        addCone(mesh); // Prepare mesh to draw a cone
+        mesh.primitive(Mesh::LINE_STRIP);
+
+        gui << X << Y << Size; // Register the parameters with the GUI
+        gui.init(); // Initialize GUI. Don't forget this!
+
+        // Each player controls its own group of parameters
+        positionPlayer << X << Y;
+        sizePlayer << Size;
+
+        // Start reading the presets now, before playback is requested.
+        // The second player finds them already queued in the cache.
+        positionPlayer.loadSequence("demo");
+        sizePlayer.loadSequence("demo");
+    }
+
+    virtual void onAnimate(double dt) override {
+        navControl().active(!gui.usingInput());
+
+        bool wasPlaying = positionPlayer.playing() || sizePlayer.playing();
+        positionPlayer.update(dt);
+        sizePlayer.update(dt);
+        if (wasPlaying && !positionPlayer.playing() && !sizePlayer.playing()) {
+            std::cout << "Cache hits: " << cache.hits() << " misses: " << cache.misses()
+                      << " waits: " << cache.waits() << " prefetched: " << cache.prefetches()
+                      << std::endl;
+        }
+    }
+
+    virtual void onDraw(Graphics &g) override
+    {
+        g.clear();
+
+        g.pushMatrix();
+        g.translate(X.get(), Y.get(), 0);
+        g.scale(Size.get());
+        g.draw(mesh); // Draw the mesh
+        g.popMatrix();
+
+        gui.draw(g);
+    }
+
+    virtual void onKeyDown(const Keyboard& k) override
+    {
+        if (k.key() == ' ') {
+            positionPlayer.play();
+            sizePlayer.play();
+        }
+    }
+
+private:
+    Mesh mesh;
+
+    Parameter X {"X", "Position", 0.0, "", -1.0f, 1.0f};
+    Parameter Y {"Y", "Position", 0.0, "", -1.0f, 1.0f};
+    Parameter Size {"Scale", "Size", 1.0, "", 0.1f, 3.0f};
+
+    PresetCache cache {32};
+    CachedSequencePlayer positionPlayer {cache};
+    CachedSequencePlayer sizePlayer {cache};
+
+    ControlGUI gui;
+};
+
+
+int main(int argc, char *argv[])
+{
+    MyApp app;
+    app.dimensions(800, 600);
+    app.start();
+    return 0;
+}
@@ -0,0 +1,432 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "al/core/app/al_App.hpp"
+#include "al/core/graphics/al_Shapes.hpp"
+#include "al/core/math/al_Random.hpp"
+#include "al/core/protocol/al_OSC.hpp"
+#include "al/util/ui/al_Parameter.hpp"
+#include "al/util/ui/al_Preset.hpp"
+#include "al/util/ui/al_ControlGUI.hpp"
+
+using namespace al;
+
+/*
+ * This tutorial shows how to play many preset sequences at the same time,
+ * each one on its own PresetHandler, with a single sequencing thread and a
+ * single OSC port.
+ *
+ * A PresetSequencer plays one sequence at a time on one PresetHandler, with
+ * its own thread, and a SequenceServer exposes one sequencer on its own
+ * port. An installation with dozens of independent groups of parameters
+ * would need dozens of each.
+ *
+ * Note that every PresetHandler still has its own thread for morphing
+ * between presets. The scheduler replaces the sequencer threads and the
+ * servers, not those.
+ *
+ * The SequenceScheduler below keeps one entry per registered PresetHandler.
+ * All the pending steps of all playing sequences are kept in a single
+ * queue ordered by time, and one timer thread sleeps until the earliest
+ * step is due, recalls that preset and schedules the next step of that
+ * sequence. Adding a step to the queue is O(log n), so hundreds of
+ * sequences can play at once. Step times are computed from the start of
+ * the sequence, so late wake ups do not accumulate. Sequence files are read
+ * and presets are recalled without holding the scheduler's lock, so a slow
+ * disk or preset handler doesn't hold up play() and stop() calls. How late
+ * steps are recalled is kept in a histogram of fixed size, so it doesn't
+ * grow however long the sequences play.
+ *
+ * The scheduler is also an OSC packet handler. Each handler is addressed by
+ * the name it was registered with:
+ *
+ *   /sequence/<name>/play s   plays the sequence with that name
+ *   /sequence/<name>/stop     stops playback
+ *
+ * This tutorial has three cones with their own parameters and preset
+ * handlers. Use alt + number to store a preset for all three, and space to
+ * play a sequence on each (the sequences are written in onCreate()).
+ *
+ * Run with "--benchmark" to play hundreds of sequences at once and measure
+ * how late their steps are recalled.
+*/
+
+class SequenceScheduler : public osc::PacketHandler
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    // How late steps were recalled, in buckets of 0.1 ms up to 100 ms
+    struct Lateness {
+        static const int NUM_BUCKETS = 1000;
+        static constexpr double BUCKET_SIZE = 0.0001; // In seconds
+
+        uint64_t buckets[NUM_BUCKETS] {}; // The last one also counts later steps
+        uint64_t count {0};
+        double worst {0};
+
+        void add(double seconds) {
+            int bucket = std::min(int(std::max(seconds, 0.0) / BUCKET_SIZE), NUM_BUCKETS - 1);
+            buckets[bucket]++;
+            count++;
+            worst = std::max(worst, seconds);
+        }
+
+        // The lateness of p percent of the steps, rounded up to a bucket
+        double percentile(double p) const {
+            uint64_t target = uint64_t(p / 100.0 * count);
+            uint64_t sum = 0;
+            for (int i = 0; i < NUM_BUCKETS; i++) {
+                sum += buckets[i];
+                if (sum > target) {
+                    return (i + 1) * BUCKET_SIZE;
+                }
+            }
+            return worst;
+        }
+    };
+
+    SequenceScheduler() {
+        mThread = std::thread([this]() { run(); });
+    }
+
+    ~SequenceScheduler() {
+        {
+            std::unique_lock<std::mutex> lk(mLock);
+            mRunning = false;
+        }
+        mCondition.notify_one();
+        mThread.join();
+    }
+
+    // Register handlers before playing sequences
+    void registerHandler(std::string name, PresetHandler &handler) {
+        std::unique_lock<std::mutex> lk(mLock);
+        mSlots[name].handler = &handler;
+    }
+
+    /*
+     * Play the sequence sequenceName on the handler registered as
+     * handlerName. The sequence file is read from the handler's directory.
+     */
+    bool play(std::string handlerName, std::string sequenceName) {
+        std::unique_lock<std::mutex> lk(mLock);
+        auto slot = mSlots.find(handlerName);
+        if (slot == mSlots.end()) {
+            return false;
+        }
+        Slot &s = slot->second;
+        std::string path = s.handler->getCurrentPath();
+        lk.unlock();
+        std::vector<Step> steps = readSequence(path + "/" + sequenceName + ".sequence");
+        if (steps.size() == 0) {
+            return false;
+        }
+        lk.lock();
+        s.steps = std::move(steps);
+        s.nextStep = 0;
+        s.start = Clock::now();
+        s.generation++; // Forget steps queued by a previous play()
+        mQueue.push({s.start, &s, s.generation});
+        mCondition.notify_one();
+        return true;
+    }
+
+    void stop(std::string handlerName) {
+        std::unique_lock<std::mutex> lk(mLock);
+        auto slot = mSlots.find(handlerName);
+        if (slot != mSlots.end()) {
+            slot->second.generation++;
+        }
+    }
+
+    size_t queuedSteps() {
+        std::unique_lock<std::mutex> lk(mLock);
+        return mQueue.size();
+    }
+
+    Lateness lateness() {
+        std::unique_lock<std::mutex> lk(mLock);
+        return mLateness;
+    }
+
+    virtual void onMessage(osc::Message &m) override {
+        const std::string &address = m.addressPattern();
+        const std::string prefix = "/sequence/";
+        size_t slash = address.rfind('/');
+        if (address.compare(0, prefix.size(), prefix) != 0 || slash < prefix.size()) {
+            return;
+        }
+        std::string name = address.substr(prefix.size(), slash - prefix.size());
+        std::string command = address.substr(slash + 1);
+        if (command == "play" && m.typeTags() == "s") {
+            std::string sequenceName;
+            m >> sequenceName;
+            play(name, sequenceName);
+        } else if (command == "stop") {
+            stop(name);
+        }
+    }
+
+private:
+    struct Step {
+        std::string preset;
+        float morphTime;
+        double startTime; // Seconds from the start of the sequence
+    };
+
+    struct Slot {
+        PresetHandler *handler {nullptr};
+        std::vector<Step> steps;
+        size_t nextStep {0};
+        Clock::time_point start;
+        uint64_t generation {0};
+    };
+
+    struct QueuedStep {
+        Clock::time_point due;
+        Slot *slot;
+        uint64_t generation;
+
+        bool operator>(const QueuedStep &other) const { return due > other.due; }
+    };
+
+    static std::vector<Step> readSequence(std::string fileName) {
+        std::vector<Step> steps;
+        std::ifstream f(fileName);
+        std::string line;
+        double time = 0;
+        while (std::getline(f, line) && line.compare(0, 2, "::") != 0) {
+            std::stringstream ss(line);
+            std::string preset, morph, wait;
+            if (std::getline(ss, preset, ':') && std::getline(ss, morph, ':')
+                    && std::getline(ss, wait)) {
+                steps.push_back({preset, std::stof(morph), time});
+                time += std::stod(morph) + std::stod(wait);
+            }
+        }
+        return steps;
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lk(mLock);
+        while (mRunning) {
+            if (mQueue.empty()) {
+                mCondition.wait(lk);
+                continue;
+            }
+            QueuedStep next = mQueue.top();
+            if (next.due > Clock::now()) {
+                mCondition.wait_until(lk, next.due);
+                continue; // Something may have been queued in the meantime
+            }
+            mQueue.pop();
+            Slot &slot = *next.slot;
+            if (next.generation != slot.generation || slot.nextStep >= slot.steps.size()) {
+                continue; // Stopped or restarted
+            }
+            // Copy the step, as play() may replace the steps once we unlock
+            Step step = slot.steps[slot.nextStep++];
+            PresetHandler *handler = slot.handler;
+            if (slot.nextStep < slot.steps.size()) {
+                auto offset = std::chrono::duration_cast<Clock::duration>(
+                            std::chrono::duration<double>(slot.steps[slot.nextStep].startTime));
+                mQueue.push({slot.start + offset, &slot, slot.generation});
+            }
+            mLateness.add(std::chrono::duration<double>(Clock::now() - next.due).count());
+            // Recalling can take a while, don't block play() and stop()
+            lk.unlock();
+            handler->setMorphTime(step.morphTime);
+            handler->recallPreset(step.preset);
+            lk.lock();
+        }
+    }
+
+    std::mutex mLock;
+    std::condition_variable mCondition;
+    std::map<std::string, Slot> mSlots; // Elements of a map don't move
+    std::priority_queue<QueuedStep, std::vector<QueuedStep>, std::greater<QueuedStep>> mQueue;
+    Lateness mLateness;
+    bool mRunning {true};
+    std::thread mThread;
+};
+
+#define NUM_CONES 3
+
+class MyApp : public App
+{
+public:
+
+    virtual void onCreate() override {
+        nav().pos(Vec3d(0,0,8)); // Set the camera to view the scene
+        addCone(mesh); // Prepare mesh to draw a cone
+        mesh.primitive(Mesh::LINE_STRIP);
+
+        for (int i = 0; i < NUM_CONES; i++) {
+            Cone &cone = cones[i];
+            gui << cone.X << cone.Y << cone.Size;
+            cone.presets << cone.X << cone.Y << cone.Size;
+            scheduler.registerHandler("cone" + std::to_string(i), cone.presets);
+
+            // Each cone gets a sequence with its own timing
+            std::ofstream f(cone.presets.getCurrentPath() + "/demo.sequence");
+            f << "1:0.0:" << 1 + i << std::endl;
+            f << "2:" << 2 + i << ":1.0" << std::endl;
+            f << "3:1.0:" << 0.5 * i << std::endl;
+            f << "::" << std::endl;
+        }
+        gui.init(); // Initialize GUI. Don't forget this!
+
+        // All sequences are controlled through a single port
+        recv.handler(scheduler);
+        recv.start();
+        std::cout << "Send /sequence/cone0/play demo to port 9013" << std::endl;
+    }
+
+    virtual void onAnimate(double /*dt*/) override {
+        navControl().active(!gui.usingInput());
+    }
+
+    virtual void onDraw(Graphics &g) override
+    {
+        g.clear();
+
+        for (int i = 0; i < NUM_CONES; i++) {
+            g.pushMatrix();
+            g.translate(cones[i].X.get(), cones[i].Y.get(), 0);
+            g.scale(cones[i].Size.get());
+            g.draw(mesh); // Draw the mesh
+            g.popMatrix();
+        }
+
+        gui.draw(g);
+    }
+
+    virtual void onKeyDown(const Keyboard& k) override
+    {
+        if (k.alt()) {
+            if (k.isNumber()) { // Use alt + any number key to store preset
+                for (int i = 0; i < NUM_CONES; i++) {
+                    cones[i].presets.storePreset(k.keyAsNumber(), std::to_string(k.keyAsNumber()));
+                }
+            }
+        } else if (k.key() == ' ') {
+            for (int i = 0; i < NUM_CONES; i++) {
+                scheduler.play("cone" + std::to_string(i), "demo");
+            }
+        } else if (k.key() == 'r') { // Randomize parameters
+            for (int i = 0; i < NUM_CONES; i++) {
+                cones[i].X = randomGenerator.uniformS();
+                cones[i].Y = randomGenerator.uniformS();
+                cones[i].Size = 0.1 + randomGenerator.uniform();
+            }
+        }
+    }
+
+    virtual void onExit() override {
+        recv.stop();
+    }
+
+private:
+    // Each cone has its own parameters and preset handler
+    struct Cone {
+        Cone(int index) :
+            X {"X", "Position", 0.0, "cone" + std::to_string(index), -1.0f, 1.0f},
+            Y {"Y", "Position", 0.0, "cone" + std::to_string(index), -1.0f, 1.0f},
+            Size {"Scale", "Size", 1.0, "cone" + std::to_string(index), 0.1f, 3.0f},
+            presets {"cone" + std::to_string(index) + "Presets"}
+        {}
+
+        Parameter X;
+        Parameter Y;
+        Parameter Size;
+        PresetHandler presets;
+    };
+
+    Mesh mesh;
+    Cone cones[NUM_CONES] {{0}, {1}, {2}};
+
+    SequenceScheduler scheduler;
+    osc::Recv recv {9013, "127.0.0.1", 0.01};
+
+    rnd::Random<> randomGenerator; // Random number generator
+
+    ControlGUI gui;
+};
+
+/*
+ * Play hundreds of sequences with short steps at the same time on one
+ * scheduler, and report how late the steps were recalled.
+ */
+void runBenchmark()
+{
+    const int numSequences = 500;
+    const int numSteps = 40;
+
+    SequenceScheduler scheduler;
+    std::vector<std::unique_ptr<Parameter>> params;
+    std::vector<std::unique_ptr<PresetHandler>> handlers;
+    double longest = 0;
+    for (int i = 0; i < numSequences; i++) {
+        std::string name = "bench" + std::to_string(i);
+        params.emplace_back(new Parameter("Value", "", 0.0, name, 0.0f, 4.0f));
+        handlers.emplace_back(new PresetHandler("benchmarkPresets/" + name));
+        PresetHandler &presets = *handlers.back();
+        presets << *params.back();
+        for (int preset = 0; preset < 4; preset++) {
+            params.back()->set(preset);
+            presets.storePreset(preset, std::to_string(preset));
+        }
+        // Steps from 10 to 55 ms, so the sequences drift apart
+        double wait = 0.01 + (i % 10) * 0.005;
+        std::ofstream f(presets.getCurrentPath() + "/bench.sequence");
+        for (int step = 0; step < numSteps; step++) {
+            f << step % 4 << ":0.0:" << wait << std::endl;
+        }
+        f << "::" << std::endl;
+        longest = std::max(longest, numSteps * wait);
+        scheduler.registerHandler(name, presets);
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < numSequences; i++) {
+        scheduler.play("bench" + std::to_string(i), "bench");
+    }
+    std::chrono::duration<double> playTime = std::chrono::high_resolution_clock::now() - start;
+    std::this_thread::sleep_for(std::chrono::duration<double>(longest + 0.5));
+
+    SequenceScheduler::Lateness lateness = scheduler.lateness();
+    if (lateness.count == 0) {
+        std::cout << "No steps were recalled" << std::endl;
+        return;
+    }
+    std::cout << numSequences << " sequences, " << lateness.count << " steps recalled in "
+              << longest << " s (" << lateness.count / longest << " steps/s)" << std::endl;
+    std::cout << "play() for all sequences: " << playTime.count() * 1e3 << " ms" << std::endl;
+    std::cout << "Lateness ms: p50 " << lateness.percentile(50) * 1e3
+              << " p99 " << lateness.percentile(99) * 1e3
+              << " worst " << lateness.worst * 1e3 << std::endl;
+}
+
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1 && std::string(argv[1]) == "--benchmark") {
+        runBenchmark();
+        return 0;
+    }
+    MyApp app;
+    app.dimensions(800, 600);
+    app.start();
+    return 0;
+}
@@ -0,0 +1,525 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "al/core/app/al_App.hpp"
+#include "al/core/graphics/al_Shapes.hpp"
+#include "al/util/ui/al_Parameter.hpp"
+#include "al/util/ui/al_ControlGUI.hpp"
+
+#include "al/util/scene/al_SynthSequencer.hpp"
+
+#include "Gamma/Oscillator.h"
+#include "Gamma/Envelope.h"
+#include "Gamma/Domain.h"
+
+using namespace al;
+
+/*
+ * This tutorial shows how to trigger voices without ever allocating memory
+ * or taking a lock, using a fixed size pool of voices.
+ *
+ * PolySynth::getVoice() allocates a new voice when no free voice is
+ * available. That allocation happens on the thread that triggers (the
+ * keyboard or OSC thread), and a burst of triggers can cause many
+ * allocations at once.
+ *
+ * The VoicePool below allocates all its voices when it is created. Free
+ * voices are kept in a lock-free stack, so any thread can take a voice
+ * with a single atomic operation. Triggered voices are passed to the audio
+ * thread through a lock-free queue and the audio thread returns finished
+ * voices to the free stack. Like PolySynth::triggerOn(), triggerOn() takes
+ * an offset in frames, and the voice starts rendering at that position in
+ * the block (or in a later block if the offset is larger than a block).
+ *
+ * When the pool runs low, the audio thread steals voices at the end of
+ * each block so that a reserve of free voices is always available. The
+ * voices to steal are chosen by a policy:
+ *
+ *   OLDEST           the voice that was triggered first
+ *   QUIETEST         a released voice, else a sustaining one, with the
+ *                    lowest level(). Voices in their attack or waiting for
+ *                    their offset are only taken when there is no other,
+ *                    as they are quiet only because they are starting.
+ *   LOWEST_PRIORITY  the voice triggered with the lowest priority
+ *
+ * For QUIETEST the voice class must provide level(), released() and
+ * attacking().
+ *
+ * If a burst within a single block uses up the whole reserve, getVoice()
+ * returns nullptr instead of blocking and the trigger is counted as dropped.
+ *
+ * Run with "--benchmark" to trigger 100,000 notes per second from another
+ * thread while rendering audio.
+*/
+
+enum class StealPolicy {
+    OLDEST,
+    QUIETEST,
+    LOWEST_PRIORITY
+};
+
+/*
+ * Lock-free bounded queue of indeces for many producers and one consumer.
+ * Each cell has a sequence number that tells producers and the consumer
+ * whose turn it is to use it.
+*/
+class IndexQueue
+{
+public:
+    IndexQueue(size_t capacity) : mCells(roundUp(capacity)), mMask(mCells.size() - 1) {
+        for (size_t i = 0; i < mCells.size(); i++) {
+            mCells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    bool push(uint32_t value) {
+        size_t position = mTail.load(std::memory_order_relaxed);
+        while (true) {
+            Cell &cell = mCells[position & mMask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t) sequence - (intptr_t) position;
+            if (diff == 0) {
+                if (mTail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    cell.value = value;
+                    cell.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false; // Full
+            } else {
+                position = mTail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Only one thread may pop
+    bool pop(uint32_t &value) {
+        Cell &cell = mCells[mHead & mMask];
+        size_t sequence = cell.sequence.load(std::memory_order_acquire);
+        if ((intptr_t) sequence - (intptr_t) (mHead + 1) < 0) {
+            return false; // Empty
+        }
+        value = cell.value;
+        cell.sequence.store(mHead + mMask + 1, std::memory_order_release);
+        mHead++;
+        return true;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        uint32_t value;
+    };
+
+    static size_t roundUp(size_t n) {
+        size_t size = 1;
+        while (size < n) {
+            size <<= 1;
+        }
+        return size;
+    }
+
+    std::vector<Cell> mCells;
+    size_t mMask;
+    std::atomic<size_t> mTail {0};
+    size_t mHead {0};
+};
+
+
+template<class VoiceType, size_t Capacity>
+class VoicePool
+{
+public:
+    VoicePool(size_t reserve = Capacity / 8, StealPolicy policy = StealPolicy::OLDEST) :
+        mReserve(reserve), mPolicy(policy), mTriggers(Capacity), mReleases(Capacity)
+    {
+        static_assert(Capacity < 0xFFFFFFFF, "Pool too large");
+        for (size_t i = 0; i < Capacity; i++) {
+            mNext[i].store(i + 1 < Capacity ? uint32_t(i + 1) : EMPTY, std::memory_order_relaxed);
+        }
+        mFreeHead.store(0, std::memory_order_relaxed);
+        mFreeCount.store(Capacity);
+        mActive.reserve(Capacity);
+    }
+
+    void setStealPolicy(StealPolicy policy) { mPolicy = policy; }
+
+    /*
+     * Take a free voice. Can be called from any thread. Never allocates or
+     * blocks. Returns nullptr if there are no free voices.
+     */
+    VoiceType *getVoice() {
+        uint64_t head = mFreeHead.load(std::memory_order_acquire);
+        while (true) {
+            uint32_t top = uint32_t(head);
+            if (top == EMPTY) {
+                mDropped++;
+                return nullptr;
+            }
+            uint32_t next = mNext[top].load(std::memory_order_relaxed);
+            // The upper 32 bits count changes, to avoid the ABA problem
+            uint64_t newHead = (((head >> 32) + 1) << 32) | next;
+            if (mFreeHead.compare_exchange_weak(head, newHead,
+                                                std::memory_order_acq_rel,
+                                                std::memory_order_acquire)) {
+                mFreeCount--;
+                return &mVoices[top];
+            }
+        }
+    }
+
+    /*
+     * Pass a voice obtained from getVoice() to the audio thread. The voice
+     * starts offset frames into the next block rendered. The id can be used
+     * to turn the voice off with triggerOff().
+     */
+    void triggerOn(VoiceType *voice, int offset = 0, int id = -1, int priority = 0) {
+        uint32_t index = uint32_t(voice - mVoices);
+        mInfo[index].offset = std::max(offset, 0);
+        mInfo[index].id = id;
+        mInfo[index].priority = priority;
+        mTriggers.push(index); // Can't fail, each voice is queued at most once
+    }
+
+    // Returns false if too many releases are queued
+    bool triggerOff(int id) {
+        return mReleases.push(uint32_t(id));
+    }
+
+    /*
+     * Render all active voices. Must be called from the audio thread only.
+     */
+    void render(AudioIOData &io) {
+        uint32_t index;
+        while (mTriggers.pop(index)) {
+            mInfo[index].age = mTriggerCount++;
+            mVoices[index].triggerOn();
+            mActive.push_back(index);
+        }
+        while (mReleases.pop(index)) {
+            for (auto active: mActive) {
+                if (mInfo[active].id == int(index)) {
+                    mVoices[active].triggerOff();
+                }
+            }
+        }
+        int framesPerBuffer = int(io.framesPerBuffer());
+        for (auto active: mActive) {
+            Info &info = mInfo[active];
+            if (info.offset >= framesPerBuffer) {
+                info.offset -= framesPerBuffer; // Starts in a later block
+                continue;
+            }
+            io.frame(info.offset);
+            info.offset = 0;
+            mVoices[active].onProcess(io);
+        }
+        io.frame(0);
+
+        // Return finished voices to the free stack
+        for (size_t i = 0; i < mActive.size();) {
+            if (!mVoices[mActive[i]].active()) {
+                release(i);
+            } else {
+                i++;
+            }
+        }
+        // Steal voices so that producers always find a free one
+        while (mFreeCount.load() < mReserve && mActive.size() > 0) {
+            size_t victim = chooseVictim();
+            mVoices[mActive[victim]].free();
+            release(victim);
+            mStolen++;
+        }
+        mActiveCount.store(mActive.size());
+    }
+
+    size_t activeCount() const { return mActiveCount.load(); }
+    uint64_t stolen() const { return mStolen.load(); }
+    uint64_t dropped() const { return mDropped.load(); }
+
+private:
+    static const uint32_t EMPTY = 0xFFFFFFFF;
+
+    struct Info {
+        int id {-1};
+        int priority {0};
+        int offset {0}; // Frames left before the voice starts
+        uint64_t age {0};
+    };
+
+    // Remove mActive[i] and push its voice on the free stack
+    void release(size_t i) {
+        uint32_t index = mActive[i];
+        mActive[i] = mActive.back();
+        mActive.pop_back();
+
+        // Count the voice before it can be taken, so that the decrement in
+        // getVoice() can never bring the count below zero
+        mFreeCount++;
+        uint64_t head = mFreeHead.load(std::memory_order_relaxed);
+        uint64_t newHead;
+        do {
+            mNext[index].store(uint32_t(head), std::memory_order_relaxed);
+            newHead = (((head >> 32) + 1) << 32) | index;
+        } while (!mFreeHead.compare_exchange_weak(head, newHead,
+                                                  std::memory_order_release,
+                                                  std::memory_order_relaxed));
+    }
+
+    // Released voices first, then sustaining ones, then starting ones
+    int quietRank(uint32_t index) {
+        VoiceType &voice = mVoices[index];
+        if (mInfo[index].offset > 0 || voice.attacking()) {
+            return 2;
+        }
+        return voice.released() ? 0 : 1;
+    }
+
+    size_t chooseVictim() {
+        size_t victim = 0;
+        for (size_t i = 1; i < mActive.size(); i++) {
+            const Info &a = mInfo[mActive[i]];
+            const Info &b = mInfo[mActive[victim]];
+            bool better = false;
+            switch (mPolicy) {
+            case StealPolicy::OLDEST:
+                better = a.age < b.age;
+                break;
+            case StealPolicy::QUIETEST: {
+                int rankA = quietRank(mActive[i]);
+                int rankB = quietRank(mActive[victim]);
+                better = rankA < rankB
+                        || (rankA == rankB && mVoices[mActive[i]].level() < mVoices[mActive[victim]].level());
+                break;
+            }
+            case StealPolicy::LOWEST_PRIORITY:
+                better = a.priority < b.priority || (a.priority == b.priority && a.age < b.age);
+                break;
+            }
+            if (better) {
+                victim = i;
+            }
+        }
+        return victim;
+    }
+
+    VoiceType mVoices[Capacity];
+    Info mInfo[Capacity];
+    std::atomic<uint32_t> mNext[Capacity];
+    std::atomic<uint64_t> mFreeHead;
+    std::atomic<size_t> mFreeCount;
+    size_t mReserve;
+    StealPolicy mPolicy;
+
+    IndexQueue mTriggers;
+    IndexQueue mReleases;
+
+    // Owned by the audio thread
+    std::vector<uint32_t> mActive;
+    uint64_t mTriggerCount {0};
+
+    std::atomic<size_t> mActiveCount {0};
+    std::atomic<uint64_t> mStolen {0};
+    std::atomic<uint64_t> mDropped {0};
+};
+
+
+class MyVoice : public SynthVoice {
+public:
+    MyVoice() {
+        mEnvelope.lengths(0.1f, 0.5f);
+        mEnvelope.levels(0, 1, 0);
+        mEnvelope.sustainPoint(1);
+    }
+
+    virtual void onProcess(AudioIOData &io) override {
+        mFramesPlayed += int(io.framesPerBuffer()) - (io.frame() + 1);
+        while(io()) {
+            io.out(0) += mEnvelope() * mSource() * 0.05;
+        }
+        if (mEnvelope.done()) {
+            free();
+        }
+    }
+
+    void set(float frequency, float attackTime, float releaseTime) {
+        mSource.freq(frequency);
+        mEnvelope.lengths()[0] = attackTime;
+        mEnvelope.lengths()[1] = releaseTime;
+        mAttackFrames = int(attackTime * gam::sampleRate());
+    }
+
+    // Used by the QUIETEST steal policy
+    float level() { return mEnvelope.value(); }
+    bool released() const { return mReleased; }
+    bool attacking() const { return !mReleased && mFramesPlayed < mAttackFrames; }
+
+    virtual void onTriggerOn() override {
+        mEnvelope.reset();
+        mFramesPlayed = 0;
+        mReleased = false;
+    }
+
+    virtual void onTriggerOff() override {
+        mEnvelope.release();
+        mReleased = true;
+    }
+
+private:
+    gam::Sine<> mSource;
+    gam::AD<> mEnvelope;
+    int mAttackFrames {0};
+    int mFramesPlayed {0};
+    bool mReleased {false};
+};
+
+#define POOL_SIZE 64
+
+class MyApp : public App
+{
+public:
+
+    virtual void onCreate() override {
+        nav().pos(Vec3d(0,0,8)); // Set the camera to view the scene
+        addCone(mesh); // Prepare mesh to draw a cone
+        mesh.primitive(Mesh::LINE_STRIP);
+
+        gui << AttackTime << ReleaseTime; // Register the parameters with the GUI
+        gui.init(); // Initialize GUI. Don't forget this!
+        navControl().active(false);
+
+        // Steal the quietest voices, so the ones fading out go first
+        pool.setStealPolicy(StealPolicy::QUIETEST);
+    }
+
+    virtual void onDraw(Graphics &g) override
+    {
+        g.clear();
+
+        // The size of the cone shows how full the pool is
+        g.pushMatrix();
+        g.scale(0.2 + 2.0 * pool.activeCount() / float(POOL_SIZE));
+        g.draw(mesh);
+        g.popMatrix();
+
+        gui.draw(g);
+    }
+
+    virtual void onSound(AudioIOData &io) override {
+        pool.render(io);
+    }
+
+    virtual void onKeyDown(const Keyboard& k) override
+    {
+        MyVoice *voice = pool.getVoice();
+        if (!voice) {
+            return; // The pool is exhausted in this block
+        }
+        int midiNote = asciiToMIDI(k.key());
+        float freq = 440.0f * powf(2, (midiNote - 69)/12.0f);
+        voice->set(freq, AttackTime.get(), ReleaseTime.get());
+        pool.triggerOn(voice, 0, midiNote);
+    }
+
+    virtual void onKeyUp(const Keyboard &k) override {
+        pool.triggerOff(asciiToMIDI(k.key()));
+    }
+
+private:
+    Mesh mesh;
+
+    Parameter AttackTime {"AttackTime", "Sound", 0.1, "", 0.001f, 2.0f};
+    Parameter ReleaseTime {"ReleaseTime", "Sound", 1.0, "", 0.001f, 5.0f};
+
+    VoicePool<MyVoice, POOL_SIZE> pool {8};
+
+    ControlGUI gui;
+};
+
+
+void runBenchmark()
+{
+    const double notesPerSecond = 100000;
+    const double seconds = 2.0;
+
+    // Large pools are better allocated on the heap, but only once
+    std::unique_ptr<VoicePool<MyVoice, 1024>> pool(new VoicePool<MyVoice, 1024>(128));
+
+    AudioIOData io;
+    io.framesPerSecond(44100);
+    io.framesPerBuffer(256);
+    io.channelsOut(2);
+
+    std::atomic<bool> done {false};
+    uint64_t triggered = 0;
+    double worstTrigger = 0;
+    std::thread producer([&]() {
+        auto start = std::chrono::steady_clock::now();
+        uint64_t count = 0;
+        while (true) {
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            if (elapsed.count() >= seconds) {
+                break;
+            }
+            // Trigger as many notes as are due at this time
+            while (count < elapsed.count() * notesPerSecond) {
+                auto triggerStart = std::chrono::steady_clock::now();
+                MyVoice *voice = pool->getVoice();
+                if (voice) {
+                    voice->set(220 + (count % 64) * 10, 0.005f, 0.02f);
+                    // Spread the notes over the block, as a sequencer would
+                    int offset = int(count * 44100 / notesPerSecond) % 256;
+                    pool->triggerOn(voice, offset, int(count % 128), int(count % 4));
+                    triggered++;
+                }
+                std::chrono::duration<double> triggerTime = std::chrono::steady_clock::now() - triggerStart;
+                worstTrigger = std::max(worstTrigger, triggerTime.count());
+                count++;
+            }
+        }
+        done = true;
+    });
+
+    // Render audio in realtime, block by block
+    auto start = std::chrono::steady_clock::now();
+    uint64_t blocks = 0;
+    double worstBlock = 0;
+    while (!done) {
+        auto blockStart = std::chrono::steady_clock::now();
+        io.zeroOut();
+        io.frame(0);
+        pool->render(io);
+        std::chrono::duration<double> blockTime = std::chrono::steady_clock::now() - blockStart;
+        worstBlock = std::max(worstBlock, blockTime.count());
+        blocks++;
+        std::this_thread::sleep_until(start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                          std::chrono::duration<double>(blocks * 256 / 44100.0)));
+    }
+    producer.join();
+
+    std::cout << "Triggered " << triggered << " notes in " << seconds << " s, "
+              << pool->dropped() << " dropped, " << pool->stolen() << " stolen" << std::endl;
+    std::cout << "Worst getVoice() + triggerOn(): " << worstTrigger * 1e6 << " us" << std::endl;
+    std::cout << blocks << " blocks, worst block: " << worstBlock * 1e6 << " us" << std::endl;
+}
+
+
+int main(int argc, char *argv[])
+{
+    gam::sampleRate(44100);
+    if (argc > 1 && std::string(argv[1]) == "--benchmark") {
+        runBenchmark();
+        return 0;
+    }
+    MyApp app;
+    app.dimensions(800, 600);
+    app.initAudio(44100, 256, 2, 0);
+    app.start();
+    return 0;
+}
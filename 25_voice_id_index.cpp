@@ -0,0 +1,353 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "al/core/app/al_App.hpp"
+#include "al/core/graphics/al_Shapes.hpp"
+#include "al/util/ui/al_Parameter.hpp"
+#include "al/util/ui/al_ControlGUI.hpp"
+
+#include "al/util/scene/al_SynthSequencer.hpp"
+
+#include "Gamma/Oscillator.h"
+#include "Gamma/Envelope.h"
+#include "Gamma/Domain.h"
+
+using namespace al;
+
+/*
+ * This tutorial shows how to turn off voices by id in constant time.
+ *
+ * PolySynth::triggerOff(id) walks the list of active voices to find the ones
+ * with a matching id. With thousands of sustained voices, every note off
+ * walks thousands of voices.
+ *
+ * A VoiceIdIndex maps each id to a FIFO of the voices triggered with it,
+ * oldest first, so that repeated ids are turned off in the order they were
+ * turned on (the same order SynthRecorder assumes). Voices that free
+ * themselves (for example when their envelope ends) are not removed right
+ * away. They are skipped when their id is looked up, and removed by prune()
+ * once the index has grown.
+ *
+ * The index belongs to the audio thread. The keyboard thread triggers the
+ * voice on the PolySynth as usual, and then queues the voice and its id.
+ * Note offs go through the same queue. In onSound(), queued voices are added
+ * to the index before rendering, and note offs are applied after rendering,
+ * when PolySynth has activated every voice that was triggered before it.
+ *
+ * Run with "--benchmark" to compare the cost of a note off with a linear
+ * search and with the index, for 10 to 10,000 active voices.
+*/
+
+class VoiceIdIndex
+{
+public:
+    void add(int id, SynthVoice *voice) {
+        uint64_t serial = ++mSerial;
+        mSerials[voice] = serial; // A voice is only current for its latest trigger
+        mVoices[id].push_back({voice, serial});
+        mSize++;
+    }
+
+    /*
+     * Remove and return the oldest active voice triggered with id.
+     * Returns nullptr if there is none.
+     */
+    SynthVoice *takeOldest(int id) {
+        auto fifo = mVoices.find(id);
+        if (fifo == mVoices.end()) {
+            return nullptr;
+        }
+        SynthVoice *voice = nullptr;
+        while (!voice && !fifo->second.empty()) {
+            Entry entry = fifo->second.front();
+            fifo->second.pop_front();
+            mSize--;
+            if (isCurrent(entry)) {
+                voice = entry.voice;
+            }
+        }
+        if (fifo->second.empty()) {
+            mVoices.erase(fifo);
+        }
+        return voice;
+    }
+
+    // Remove the entries of voices that have been freed or retriggered
+    void prune() {
+        for (auto fifo = mVoices.begin(); fifo != mVoices.end();) {
+            auto &entries = fifo->second;
+            auto end = std::remove_if(entries.begin(), entries.end(),
+                                      [this](const Entry &e) { return !isCurrent(e); });
+            mSize -= entries.end() - end;
+            entries.erase(end, entries.end());
+            if (entries.empty()) {
+                fifo = mVoices.erase(fifo);
+            } else {
+                fifo++;
+            }
+        }
+        mPrunedSize = mSize;
+    }
+
+    // Prune when the index has doubled since the last prune, so the cost of
+    // pruning is spread over the calls to add()
+    void pruneIfNeeded() {
+        if (mSize > 2 * mPrunedSize + 64) {
+            prune();
+        }
+    }
+
+    size_t size() const { return mSize; }
+
+private:
+    struct Entry {
+        SynthVoice *voice;
+        uint64_t serial;
+    };
+
+    bool isCurrent(const Entry &entry) {
+        return entry.voice->active() && mSerials[entry.voice] == entry.serial;
+    }
+
+    std::unordered_map<int, std::deque<Entry>> mVoices;
+    std::unordered_map<SynthVoice *, uint64_t> mSerials;
+    uint64_t mSerial {0};
+    size_t mSize {0};
+    size_t mPrunedSize {0};
+};
+
+
+/*
+ * Single producer, single consumer queue of trigger commands.
+ */
+class TriggerQueue
+{
+public:
+    enum Type {
+        TRIGGER_ON,
+        TRIGGER_OFF
+    };
+
+    struct Command {
+        Type type;
+        int id;
+        SynthVoice *voice;
+    };
+
+    bool push(Command command) {
+        size_t tail = mTail.load(std::memory_order_relaxed);
+        if (tail - mHead.load(std::memory_order_acquire) == SIZE) {
+            return false; // Full
+        }
+        mCommands[tail % SIZE] = command;
+        mTail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(Command &command) {
+        size_t head = mHead.load(std::memory_order_relaxed);
+        if (head == mTail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        command = mCommands[head % SIZE];
+        mHead.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    static const size_t SIZE = 1024;
+    Command mCommands[SIZE];
+    std::atomic<size_t> mHead {0};
+    std::atomic<size_t> mTail {0};
+};
+
+
+class MyVoice : public SynthVoice {
+public:
+    MyVoice() {
+        mEnvelope.lengths(0.1f, 0.5f);
+        mEnvelope.levels(0, 1, 0);
+        mEnvelope.sustainPoint(1);
+    }
+
+    virtual void onProcess(AudioIOData &io) override {
+        while(io()) {
+            io.out(0) += mEnvelope() * mSource() * 0.05;
+        }
+        if (mEnvelope.done()) {
+            free();
+        }
+    }
+
+    void set(float frequency, float attackTime, float releaseTime) {
+        mSource.freq(frequency);
+        mEnvelope.lengths()[0] = attackTime;
+        mEnvelope.lengths()[1] = releaseTime;
+    }
+
+    virtual void onTriggerOn() override {
+        mEnvelope.reset();
+    }
+
+    virtual void onTriggerOff() override {
+        mEnvelope.release();
+    }
+
+private:
+    gam::Sine<> mSource;
+    gam::AD<> mEnvelope;
+};
+
+
+class MyApp : public App
+{
+public:
+
+    virtual void onCreate() override {
+        nav().pos(Vec3d(0,0,8)); // Set the camera to view the scene
+        addCone(mesh); // Prepare mesh to draw a cone
+        mesh.primitive(Mesh::LINE_STRIP);
+
+        gui << AttackTime << ReleaseTime; // Register the parameters with the GUI
+        gui.init(); // Initialize GUI. Don't forget this!
+        navControl().active(false);
+
+        pendingOffs.reserve(1024);
+    }
+
+    virtual void onDraw(Graphics &g) override
+    {
+        g.clear();
+        g.draw(mesh);
+        gui.draw(g);
+    }
+
+    virtual void onSound(AudioIOData &io) override {
+        TriggerQueue::Command command;
+        while (queue.pop(command)) {
+            if (command.type == TriggerQueue::TRIGGER_ON) {
+                index.add(command.id, command.voice);
+            } else {
+                pendingOffs.push_back(command.id);
+            }
+        }
+        mPolySynth.render(io);
+
+        // Every voice added above is active now, unless it has freed itself
+        for (int id: pendingOffs) {
+            SynthVoice *voice = index.takeOldest(id);
+            if (voice) {
+                voice->triggerOff();
+            }
+        }
+        pendingOffs.clear();
+        index.pruneIfNeeded();
+    }
+
+    virtual void onKeyDown(const Keyboard& k) override
+    {
+        MyVoice *voice = mPolySynth.getVoice<MyVoice>();
+        int midiNote = asciiToMIDI(k.key());
+        float freq = 440.0f * powf(2, (midiNote - 69)/12.0f);
+        voice->set(freq, AttackTime.get(), ReleaseTime.get());
+        mPolySynth.triggerOn(voice, 0, midiNote);
+        queue.push({TriggerQueue::TRIGGER_ON, midiNote, voice});
+    }
+
+    virtual void onKeyUp(const Keyboard &k) override {
+        // Instead of mPolySynth.triggerOff(), which searches the active voices
+        queue.push({TriggerQueue::TRIGGER_OFF, asciiToMIDI(k.key()), nullptr});
+    }
+
+private:
+    Mesh mesh;
+
+    Parameter AttackTime {"AttackTime", "Sound", 0.1, "", 0.001f, 2.0f};
+    Parameter ReleaseTime {"ReleaseTime", "Sound", 1.0, "", 0.001f, 5.0f};
+
+    PolySynth mPolySynth;
+    TriggerQueue queue;
+    VoiceIdIndex index; // Only used in the audio thread
+    std::vector<int> pendingOffs;
+
+    ControlGUI gui;
+};
+
+
+/*
+ * Measures the time to find the voice for a note off among polyphony active
+ * voices. The linear search walks a linked list of voices, as PolySynth
+ * does. Each voice that is turned off is triggered again with the same id so
+ * polyphony stays constant.
+ */
+void runBenchmark()
+{
+    const int numNoteOffs = 100000;
+    std::mt19937 random(1);
+
+    std::cout << "polyphony  linear (ns/off)  index (ns/off)" << std::endl;
+    for (int polyphony: {10, 100, 1000, 10000}) {
+        std::vector<std::unique_ptr<MyVoice>> voices;
+        SynthVoice *activeVoices = nullptr;
+        VoiceIdIndex index;
+        for (int i = 0; i < polyphony; i++) {
+            voices.emplace_back(new MyVoice);
+            voices.back()->id(i);
+            voices.back()->triggerOn();
+            voices.back()->next = activeVoices;
+            activeVoices = voices.back().get();
+            index.add(i, voices.back().get());
+        }
+        std::vector<int> ids(numNoteOffs);
+        for (auto &id: ids) {
+            id = random() % polyphony;
+        }
+
+        auto start = std::chrono::high_resolution_clock::now();
+        size_t found = 0;
+        for (int id: ids) {
+            SynthVoice *voice = activeVoices;
+            while (voice && voice->id() != id) {
+                voice = voice->next;
+            }
+            found += voice != nullptr;
+        }
+        std::chrono::duration<double> linear = std::chrono::high_resolution_clock::now() - start;
+
+        start = std::chrono::high_resolution_clock::now();
+        for (int id: ids) {
+            SynthVoice *voice = index.takeOldest(id);
+            found += voice != nullptr;
+            index.add(id, voice);
+        }
+        std::chrono::duration<double> indexed = std::chrono::high_resolution_clock::now() - start;
+
+        if (found != 2 * ids.size()) {
+            std::cout << "Missing voices!" << std::endl;
+        }
+        std::cout << polyphony << "\t\t" << linear.count() * 1e9 / numNoteOffs
+                  << "\t\t" << indexed.count() * 1e9 / numNoteOffs << std::endl;
+    }
+}
+
+
+int main(int argc, char *argv[])
+{
+    gam::sampleRate(44100);
+    if (argc > 1 && std::string(argv[1]) == "--benchmark") {
+        runBenchmark();
+        return 0;
+    }
+    MyApp app;
+    app.dimensions(800, 600);
+    app.initAudio(44100, 256, 2, 0);
+    app.start();
+    return 0;
+}
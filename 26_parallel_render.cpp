@@ -0,0 +1,478 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <iomanip>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__APPLE__)
+#include <dispatch/dispatch.h>
+#include <pthread.h>
+#else
+#include <pthread.h>
+#include <semaphore.h>
+#endif
+
+#include "al/core/app/al_App.hpp"
+#include "al/core/graphics/al_Shapes.hpp"
+#include "al/util/ui/al_Parameter.hpp"
+#include "al/util/ui/al_ControlGUI.hpp"
+
+#include "al/util/scene/al_SynthSequencer.hpp"
+
+#include "Gamma/Oscillator.h"
+#include "Gamma/Envelope.h"
+#include "Gamma/Domain.h"
+
+using namespace al;
+
+/*
+ * This tutorial shows how to render voices on several cores.
+ *
+ * PolySynth::render(io) calls onProcess() for every active voice, one after
+ * the other, in the audio callback. The number of voices you can play is
+ * limited by what a single core can compute in one block.
+ *
+ * The ParallelRenderer splits the voices into a fixed number of chunks.
+ * Each chunk is a PolySynth with its own scratch AudioIOData. When a block
+ * is rendered, the audio thread and a set of worker threads take chunks one
+ * by one from a shared counter until all chunks are rendered. A thread that
+ * gets cheap chunks simply takes more of them, so voices of uneven cost are
+ * balanced without any scheduling. Finally the audio thread adds the
+ * chunks' buffers to the output, always in chunk order.
+ *
+ * Because every chunk is rendered by a single thread and the chunks are
+ * summed in a fixed order, the output is exactly the same for any number of
+ * threads.
+ *
+ * The audio callback must never wait for another thread that may not run:
+ *
+ *  - Workers get realtime priority (SCHED_FIFO, or time critical on
+ *    Windows) so they are not preempted by normal threads. This usually
+ *    needs privileges, check realtime().
+ *  - Between blocks the workers sleep on a semaphore. The audio thread
+ *    wakes them up with a post, which never blocks or takes a lock.
+ *  - The audio thread renders chunks too, so a chunk is never left waiting
+ *    for a worker to start it. It only waits for chunks that workers are
+ *    in the middle of rendering, and only until half of the block's
+ *    duration has passed. Chunks that are still not ready are left out of
+ *    this block and counted in lateChunks(). Their voices miss a block, but
+ *    the callback returns in time.
+ *
+ * Run with "--benchmark" to measure rendering speed from 1 thread to the
+ * number of cores of the machine.
+*/
+
+/*
+ * A counting semaphore from the platform. Posting never blocks or takes a
+ * lock, so the audio thread can use it to wake up the workers.
+ */
+class Semaphore
+{
+public:
+#if defined(_WIN32)
+    Semaphore() { mHandle = CreateSemaphore(nullptr, 0, LONG_MAX, nullptr); }
+    ~Semaphore() { CloseHandle(mHandle); }
+    void post() { ReleaseSemaphore(mHandle, 1, nullptr); }
+    void wait() { WaitForSingleObject(mHandle, INFINITE); }
+private:
+    HANDLE mHandle;
+#elif defined(__APPLE__)
+    Semaphore() { mSemaphore = dispatch_semaphore_create(0); }
+    ~Semaphore() { dispatch_release(mSemaphore); }
+    void post() { dispatch_semaphore_signal(mSemaphore); }
+    void wait() { dispatch_semaphore_wait(mSemaphore, DISPATCH_TIME_FOREVER); }
+private:
+    dispatch_semaphore_t mSemaphore;
+#else
+    Semaphore() { sem_init(&mSemaphore, 0, 0); }
+    ~Semaphore() { sem_destroy(&mSemaphore); }
+    void post() { sem_post(&mSemaphore); }
+    void wait() {
+        while (sem_wait(&mSemaphore) != 0 && errno == EINTR) {}
+    }
+private:
+    sem_t mSemaphore;
+#endif
+};
+
+// Returns false if the system doesn't allow it, usually for lack of privileges
+bool setRealtimePriority(std::thread &thread)
+{
+#ifdef _WIN32
+    return SetThreadPriority(thread.native_handle(), THREAD_PRIORITY_TIME_CRITICAL) != 0;
+#else
+    sched_param param;
+    int minimum = sched_get_priority_min(SCHED_FIFO);
+    int maximum = sched_get_priority_max(SCHED_FIFO);
+    param.sched_priority = minimum + (maximum - minimum) / 2;
+    return pthread_setschedparam(thread.native_handle(), SCHED_FIFO, &param) == 0;
+#endif
+}
+
+
+class ParallelRenderer
+{
+public:
+    ParallelRenderer(int numThreads, int numChunks = 32) {
+        for (int i = 0; i < numChunks; i++) {
+            mChunks.emplace_back(new Chunk);
+        }
+        // The audio thread works too, so start one less worker
+        for (int i = 1; i < numThreads; i++) {
+            mWorkers.emplace_back([this]() { workerLoop(); });
+            if (!setRealtimePriority(mWorkers.back())) {
+                mRealtime = false;
+            }
+        }
+    }
+
+    ~ParallelRenderer() {
+        mRunning = false;
+        for (size_t i = 0; i < mWorkers.size(); i++) {
+            mWakeUp.post();
+        }
+        for (auto &worker: mWorkers) {
+            worker.join();
+        }
+    }
+
+    /*
+     * Allocate the scratch buffers to match the io that will be passed to
+     * render(). Call before audio starts.
+     */
+    void prepare(const AudioIOData &io) {
+        for (auto &chunk: mChunks) {
+            chunk->io.framesPerSecond(io.framesPerSecond());
+            chunk->io.framesPerBuffer(io.framesPerBuffer());
+            chunk->io.channelsOut(io.channelsOut());
+        }
+    }
+
+    /*
+     * Returns the PolySynth that should get the next voice, the chunk with
+     * the fewest active voices. Get the voice from it and trigger it there.
+     */
+    PolySynth &nextSynth() {
+        size_t best = 0;
+        for (size_t i = 1; i < mChunks.size(); i++) {
+            if (mChunks[i]->activeVoices.load() < mChunks[best]->activeVoices.load()) {
+                best = i;
+            }
+        }
+        mChunks[best]->activeVoices++; // Until the next render counts them
+        return mChunks[best]->synth;
+    }
+
+    // A voice with this id may be in any chunk
+    void triggerOff(int id) {
+        for (auto &chunk: mChunks) {
+            chunk->synth.triggerOff(id);
+        }
+    }
+
+    void render(AudioIOData &io) {
+        auto start = std::chrono::steady_clock::now();
+        uint64_t block = ++mBlock;
+        // Publish the block and its first chunk in one store, so a worker
+        // that is late for the previous block can't take a chunk of this one
+        mNextChunk.store(block << 32);
+        for (size_t i = 0; i < mWorkers.size(); i++) {
+            mWakeUp.post();
+        }
+        // Render chunks until none is left to start. The audio thread never
+        // waits for a worker to start a chunk.
+        renderChunks(block);
+
+        // Chunks still being rendered by workers are waited for until half
+        // of the block's duration has passed, then skipped for this block
+        auto deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    std::chrono::duration<double>(0.5 * io.framesPerBuffer() / io.framesPerSecond()));
+        // Sum in chunk order, so the result doesn't depend on the threads
+        for (auto &chunk: mChunks) {
+            while (chunk->doneBlock.load(std::memory_order_acquire) != block
+                   && chunk->skippedBlock.load() != block
+                   && std::chrono::steady_clock::now() < deadline) {
+                std::this_thread::yield();
+            }
+            if (chunk->doneBlock.load(std::memory_order_acquire) != block) {
+                mLateChunks++;
+                continue;
+            }
+            for (int channel = 0; channel < io.channelsOut(); channel++) {
+                float *out = io.outBuffer(channel);
+                const float *in = chunk->io.outBuffer(channel);
+                for (unsigned i = 0; i < io.framesPerBuffer(); i++) {
+                    out[i] += in[i];
+                }
+            }
+        }
+    }
+
+    int numThreads() const { return int(mWorkers.size()) + 1; }
+
+    // Whether the workers got realtime priority
+    bool realtime() const { return mRealtime; }
+
+    // Chunks that were not ready in time and left out of a block
+    uint64_t lateChunks() const { return mLateChunks.load(); }
+
+    int activeVoices() const {
+        int count = 0;
+        for (auto &chunk: mChunks) {
+            count += chunk->activeVoices.load();
+        }
+        return count;
+    }
+
+private:
+    struct Chunk {
+        PolySynth synth;
+        AudioIOData io;
+        std::atomic<int> activeVoices {0};
+        std::atomic<bool> busy {false};
+        std::atomic<uint64_t> doneBlock {0};
+        std::atomic<uint64_t> skippedBlock {0};
+    };
+
+    // Take the next chunk of block. Returns -1 when there is none left.
+    int takeChunk(uint64_t block) {
+        uint64_t next = mNextChunk.load();
+        while (true) {
+            uint64_t index = next & 0xFFFFFFFF;
+            if (next >> 32 != block || index >= mChunks.size()) {
+                return -1;
+            }
+            if (mNextChunk.compare_exchange_weak(next, next + 1)) {
+                return int(index);
+            }
+        }
+    }
+
+    void renderChunks(uint64_t block) {
+        int index;
+        while ((index = takeChunk(block)) >= 0) {
+            Chunk &chunk = *mChunks[index];
+            if (chunk.busy.exchange(true, std::memory_order_acquire)) {
+                // Still being rendered for an earlier block
+                chunk.skippedBlock = block;
+                continue;
+            }
+            chunk.io.zeroOut();
+            chunk.io.frame(0);
+            chunk.synth.render(chunk.io);
+            int count = 0;
+            for (SynthVoice *voice = chunk.synth.getActiveVoices(); voice; voice = voice->next) {
+                count++;
+            }
+            chunk.activeVoices = count;
+            chunk.doneBlock.store(block, std::memory_order_release);
+            chunk.busy.store(false, std::memory_order_release);
+        }
+    }
+
+    void workerLoop() {
+        while (true) {
+            mWakeUp.wait();
+            if (!mRunning) {
+                return;
+            }
+            renderChunks(mNextChunk.load() >> 32);
+        }
+    }
+
+    std::vector<std::unique_ptr<Chunk>> mChunks;
+    std::vector<std::thread> mWorkers;
+    Semaphore mWakeUp;
+    std::atomic<bool> mRunning {true};
+    bool mRealtime {true};
+    uint64_t mBlock {0}; // Only used in the audio thread
+    std::atomic<uint64_t> mNextChunk {0}; // The block in the upper 32 bits
+    std::atomic<uint64_t> mLateChunks {0};
+};
+
+
+/*
+ * An additive voice with a number of partials, to make voices expensive
+ * enough to be worth spreading over cores.
+ */
+class MyVoice : public SynthVoice {
+public:
+    MyVoice() {
+        mEnvelope.lengths(0.1f, 0.5f);
+        mEnvelope.levels(0, 1, 0);
+        mEnvelope.sustainPoint(1);
+    }
+
+    virtual void onProcess(AudioIOData &io) override {
+        while(io()) {
+            float sample = 0;
+            for (int i = 0; i < NUM_PARTIALS; i++) {
+                sample += mPartials[i]() / (i + 1);
+            }
+            io.out(0) += mEnvelope() * sample * 0.01;
+        }
+        if (mEnvelope.done()) {
+            free();
+        }
+    }
+
+    void set(float frequency, float attackTime, float releaseTime) {
+        for (int i = 0; i < NUM_PARTIALS; i++) {
+            mPartials[i].freq(frequency * (i + 1));
+        }
+        mEnvelope.lengths()[0] = attackTime;
+        mEnvelope.lengths()[1] = releaseTime;
+    }
+
+    virtual void onTriggerOn() override {
+        mEnvelope.reset();
+    }
+
+    virtual void onTriggerOff() override {
+        mEnvelope.release();
+    }
+
+private:
+    static const int NUM_PARTIALS = 16;
+    gam::Sine<> mPartials[NUM_PARTIALS];
+    gam::AD<> mEnvelope;
+};
+
+
+class MyApp : public App
+{
+public:
+
+    virtual void onCreate() override {
+        nav().pos(Vec3d(0,0,8)); // Set the camera to view the scene
+        addCone(mesh); // Prepare mesh to draw a cone
+        mesh.primitive(Mesh::LINE_STRIP);
+
+        gui << AttackTime << ReleaseTime; // Register the parameters with the GUI
+        gui.init(); // Initialize GUI. Don't forget this!
+        navControl().active(false);
+
+        renderer.prepare(audioIO());
+    }
+
+    virtual void onDraw(Graphics &g) override
+    {
+        g.clear();
+        g.pushMatrix();
+        g.scale(0.2 + renderer.activeVoices() * 0.1);
+        g.draw(mesh);
+        g.popMatrix();
+        gui.draw(g);
+    }
+
+    virtual void onSound(AudioIOData &io) override {
+        renderer.render(io);
+    }
+
+    virtual void onKeyDown(const Keyboard& k) override
+    {
+        PolySynth &synth = renderer.nextSynth();
+        MyVoice *voice = synth.getVoice<MyVoice>();
+        int midiNote = asciiToMIDI(k.key());
+        float freq = 440.0f * powf(2, (midiNote - 69)/12.0f);
+        voice->set(freq, AttackTime.get(), ReleaseTime.get());
+        synth.triggerOn(voice, 0, midiNote);
+    }
+
+    virtual void onKeyUp(const Keyboard &k) override {
+        renderer.triggerOff(asciiToMIDI(k.key()));
+    }
+
+private:
+    Mesh mesh;
+
+    Parameter AttackTime {"AttackTime", "Sound", 0.1, "", 0.001f, 2.0f};
+    Parameter ReleaseTime {"ReleaseTime", "Sound", 1.0, "", 0.001f, 5.0f};
+
+    ParallelRenderer renderer {int(std::thread::hardware_concurrency())};
+
+    ControlGUI gui;
+};
+
+
+/*
+ * Renders the same voices headless with 1 to N threads. Voices have
+ * different lengths so their cost is uneven. The sum of the output is
+ * printed to show that it is identical for every thread count.
+ */
+void runBenchmark()
+{
+    const int numVoices = 2000;
+    const double seconds = 5.0;
+    const int framesPerBuffer = 256;
+    int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+
+    AudioIOData io;
+    io.framesPerSecond(44100);
+    io.framesPerBuffer(framesPerBuffer);
+    io.channelsOut(2);
+
+    double singleThread = 0;
+    std::cout << "threads  x realtime  speedup  late chunks  output sum" << std::endl;
+    for (int numThreads = 1; numThreads <= maxThreads; numThreads++) {
+        ParallelRenderer renderer(numThreads);
+        renderer.prepare(io);
+        for (int i = 0; i < numVoices; i++) {
+            PolySynth &synth = renderer.nextSynth();
+            MyVoice *voice = synth.getVoice<MyVoice>();
+            voice->set(100.0f + (i % 50) * 10.0f, 0.01f, 0.1f + (i % 7) * 0.2f);
+            synth.triggerOn(voice, 0, i);
+        }
+
+        int numBlocks = int(seconds * 44100 / framesPerBuffer);
+        double sum = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int block = 0; block < numBlocks; block++) {
+            if (block == numBlocks / 2) {
+                for (int i = 0; i < numVoices; i++) {
+                    renderer.triggerOff(i);
+                }
+            }
+            io.zeroOut();
+            io.frame(0);
+            renderer.render(io);
+            for (int i = 0; i < framesPerBuffer; i++) {
+                sum += io.outBuffer(0)[i];
+            }
+        }
+        std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+        if (numThreads == 1) {
+            singleThread = elapsed.count();
+        }
+        std::cout << numThreads << "\t " << seconds / elapsed.count()
+                  << "\t     " << singleThread / elapsed.count()
+                  << "\t  " << renderer.lateChunks()
+                  << "\t       " << std::setprecision(17) << sum << std::setprecision(6) << std::endl;
+        if (!renderer.realtime()) {
+            std::cout << "\t (workers without realtime priority)" << std::endl;
+        }
+    }
+}
+
+
+int main(int argc, char *argv[])
+{
+    gam::sampleRate(44100);
+    if (argc > 1 && std::string(argv[1]) == "--benchmark") {
+        runBenchmark();
+        return 0;
+    }
+    MyApp app;
+    app.dimensions(800, 600);
+    app.initAudio(44100, 256, 2, 0);
+    app.start();
+    return 0;
+}
@@ -0,0 +1,306 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "al/core/app/al_App.hpp"
+#include "al/core/graphics/al_Shapes.hpp"
+#include "al/util/ui/al_Parameter.hpp"
+#include "al/util/ui/al_ControlGUI.hpp"
+
+#include "al/util/scene/al_SynthSequencer.hpp"
+
+#include "Gamma/Oscillator.h"
+#include "Gamma/Envelope.h"
+#include "Gamma/Domain.h"
+
+using namespace al;
+
+/*
+ * This tutorial shows how to stop processing voices that have become
+ * silent.
+ *
+ * A voice stays in the PolySynth until it calls free(). A voice that never
+ * calls it, or that sustains silence for a long time, is processed on every
+ * block forever.
+ *
+ * A MonitoredVoice measures the peak level of what it adds to the output
+ * on every block. When the level has stayed below a threshold for a tail
+ * time, the voice is culled, in one of two ways:
+ *
+ *   SKIP  the voice stays active but is not processed anymore. It is freed
+ *         when it is triggered off. Use this for voices that must keep
+ *         their id, for example sustained notes that will get a note off.
+ *         A voice that has already been triggered off won't get another
+ *         note off, so it is freed instead of skipped.
+ *   FREE  the voice is freed right away.
+ *
+ * The monitor's scratch buffer is sized for the app's audio io. If a block
+ * doesn't fit in it, voices are processed without being monitored, so they
+ * are never culled while they may still be audible.
+ *
+ * The threshold, the tail time and the policy are set on a VoiceMonitor,
+ * that is given to the voices as the PolySynth's default user data. The
+ * monitor also counts culled voices, so the app can report them once per
+ * block.
+ *
+ * The voice in this tutorial never calls free(). Play a few notes and
+ * watch the culled voices being reported after the release. Press space to
+ * switch the policy.
+*/
+
+class VoiceMonitor
+{
+public:
+    enum Policy {
+        SKIP,
+        FREE
+    };
+
+    /*
+     * Allocate the scratch buffer for the io the voices will render to.
+     * Call before audio starts.
+     */
+    void prepare(const AudioIOData &io) {
+        mScratch.resize(io.framesPerBuffer() * io.channelsOut());
+    }
+
+    void setThreshold(float decibels) { mThreshold = std::pow(10.0f, decibels / 20.0f); }
+    void setTailTime(float seconds) { mTailTime = seconds; }
+    void setPolicy(Policy policy) { mPolicy = policy; }
+
+    float threshold() const { return mThreshold; }
+    float tailTime() const { return mTailTime; }
+    Policy policy() const { return mPolicy; }
+
+    // Call from the audio thread after rendering the PolySynth
+    void endBlock() {
+        mCulledLastBlock.store(mCulled);
+        mTotalCulled.fetch_add(mCulled);
+        mCulled = 0;
+    }
+
+    uint64_t culledLastBlock() const { return mCulledLastBlock.load(); }
+    uint64_t totalCulled() const { return mTotalCulled.load(); }
+
+private:
+    friend class MonitoredVoice;
+
+    std::atomic<float> mThreshold {0.0001f}; // -80 dB
+    std::atomic<float> mTailTime {0.5f};
+    std::atomic<Policy> mPolicy {SKIP};
+
+    // Only used in the audio thread
+    std::vector<float> mScratch;
+    uint64_t mCulled {0};
+
+    std::atomic<uint64_t> mCulledLastBlock {0};
+    std::atomic<uint64_t> mTotalCulled {0};
+};
+
+
+/*
+ * Override onProcessMonitored(), onStart() and onRelease() instead of
+ * onProcess(), onTriggerOn() and onTriggerOff().
+ */
+class MonitoredVoice : public SynthVoice {
+public:
+    virtual void onProcessMonitored(AudioIOData &io) = 0;
+    virtual void onStart() {}
+    virtual void onRelease() {}
+
+    virtual void onProcess(AudioIOData &io) override final {
+        VoiceMonitor *monitor = static_cast<VoiceMonitor *>(userData());
+        // Without a scratch buffer large enough for the whole block, the
+        // voice is not monitored, rather than measured as silent
+        if (!monitor || monitor->mScratch.size() < io.framesPerBuffer() * io.channelsOut()) {
+            onProcessMonitored(io);
+            return;
+        }
+        if (mSkipped) {
+            return;
+        }
+        // Keep a copy of the output to find out what this voice adds
+        int offset = io.frame() + 1;
+        int numFrames = int(io.framesPerBuffer()) - offset;
+        int numChannels = io.channelsOut();
+        for (int channel = 0; channel < numChannels; channel++) {
+            std::copy(io.outBuffer(channel) + offset, io.outBuffer(channel) + offset + numFrames,
+                      monitor->mScratch.data() + channel * numFrames);
+        }
+        onProcessMonitored(io);
+
+        float peak = 0;
+        for (int channel = 0; channel < numChannels; channel++) {
+            const float *before = monitor->mScratch.data() + channel * numFrames;
+            const float *after = io.outBuffer(channel) + offset;
+            for (int i = 0; i < numFrames; i++) {
+                peak = std::max(peak, std::abs(after[i] - before[i]));
+            }
+        }
+        if (peak >= monitor->threshold()) {
+            mSilentTime = 0;
+            return;
+        }
+        mSilentTime += numFrames / io.framesPerSecond();
+        if (mSilentTime >= monitor->tailTime() && active()) {
+            monitor->mCulled++;
+            if (monitor->policy() == VoiceMonitor::FREE || mReleased) {
+                free();
+            } else {
+                mSkipped = true;
+            }
+        }
+    }
+
+    virtual void onTriggerOn() override final {
+        mSilentTime = 0;
+        mSkipped = false;
+        mReleased = false;
+        onStart();
+    }
+
+    virtual void onTriggerOff() override final {
+        mReleased = true;
+        if (mSkipped) {
+            free(); // Releasing silence produces silence
+            return;
+        }
+        onRelease();
+    }
+
+    bool skipped() const { return mSkipped; }
+
+private:
+    double mSilentTime {0};
+    bool mSkipped {false};
+    bool mReleased {false};
+};
+
+
+/*
+ * This voice never frees itself.
+ */
+class MyVoice : public MonitoredVoice {
+public:
+    MyVoice() {
+        mEnvelope.lengths(0.1f, 0.5f);
+        mEnvelope.levels(0, 1, 0);
+        mEnvelope.sustainPoint(1);
+    }
+
+    virtual void onProcessMonitored(AudioIOData &io) override {
+        while(io()) {
+            float sample = mEnvelope() * mSource() * 0.05;
+            io.out(0) += sample;
+            io.out(1) += sample;
+        }
+    }
+
+    void set(float frequency, float attackTime, float releaseTime) {
+        mSource.freq(frequency);
+        mEnvelope.lengths()[0] = attackTime;
+        mEnvelope.lengths()[1] = releaseTime;
+    }
+
+    virtual void onStart() override {
+        mEnvelope.reset();
+    }
+
+    virtual void onRelease() override {
+        mEnvelope.release();
+    }
+
+private:
+    gam::Sine<> mSource;
+    gam::AD<> mEnvelope;
+};
+
+
+class MyApp : public App
+{
+public:
+
+    virtual void onCreate() override {
+        nav().pos(Vec3d(0,0,8)); // Set the camera to view the scene
+        addCone(mesh); // Prepare mesh to draw a cone
+        mesh.primitive(Mesh::LINE_STRIP);
+
+        gui << AttackTime << ReleaseTime << Threshold << TailTime; // Register the parameters with the GUI
+        gui.init(); // Initialize GUI. Don't forget this!
+        navControl().active(false);
+
+        monitor.prepare(audioIO());
+        // All voices get the monitor unless they are triggered with
+        // their own user data
+        mPolySynth.setDefaultUserData(&monitor);
+    }
+
+    virtual void onAnimate(double /*dt*/) override {
+        uint64_t total = monitor.totalCulled();
+        if (total != lastTotalCulled) {
+            std::cout << "Culled " << total - lastTotalCulled << " voices ("
+                      << total << " total)" << std::endl;
+            lastTotalCulled = total;
+        }
+    }
+
+    virtual void onDraw(Graphics &g) override
+    {
+        g.clear();
+        g.draw(mesh);
+        gui.draw(g);
+    }
+
+    virtual void onSound(AudioIOData &io) override {
+        monitor.setThreshold(Threshold.get());
+        monitor.setTailTime(TailTime.get());
+        mPolySynth.render(io);
+        monitor.endBlock();
+    }
+
+    virtual void onKeyDown(const Keyboard& k) override
+    {
+        if (k.key() == ' ') {
+            bool skip = monitor.policy() == VoiceMonitor::SKIP;
+            monitor.setPolicy(skip ? VoiceMonitor::FREE : VoiceMonitor::SKIP);
+            std::cout << "Policy: " << (skip ? "FREE" : "SKIP") << std::endl;
+            return;
+        }
+        MyVoice *voice = mPolySynth.getVoice<MyVoice>();
+        int midiNote = asciiToMIDI(k.key());
+        float freq = 440.0f * powf(2, (midiNote - 69)/12.0f);
+        voice->set(freq, AttackTime.get(), ReleaseTime.get());
+        mPolySynth.triggerOn(voice, 0, midiNote);
+    }
+
+    virtual void onKeyUp(const Keyboard &k) override {
+        mPolySynth.triggerOff(asciiToMIDI(k.key()));
+    }
+
+private:
+    Mesh mesh;
+
+    Parameter AttackTime {"AttackTime", "Sound", 0.1, "", 0.001f, 2.0f};
+    Parameter ReleaseTime {"ReleaseTime", "Sound", 1.0, "", 0.001f, 5.0f};
+    Parameter Threshold {"Threshold", "Culling", -80.0, "", -120.0f, 0.0f}; // dB
+    Parameter TailTime {"TailTime", "Culling", 0.5, "", 0.0f, 5.0f}; // seconds
+
+    PolySynth mPolySynth;
+    VoiceMonitor monitor;
+    uint64_t lastTotalCulled {0};
+
+    ControlGUI gui;
+};
+
+
+int main(int argc, char *argv[])
+{
+    MyApp app;
+    app.dimensions(800, 600);
+    app.initAudio(44100, 256, 2, 0);
+    gam::sampleRate(44100);
+    app.start();
+    return 0;
+}
@@ -0,0 +1,427 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "al/core/app/al_App.hpp"
+#include "al/core/graphics/al_Shapes.hpp"
+#include "al/util/ui/al_Parameter.hpp"
+#include "al/util/ui/al_ControlGUI.hpp"
+
+#include "al/util/scene/al_SynthSequencer.hpp"
+
+#include "Gamma/Oscillator.h"
+#include "Gamma/Envelope.h"
+#include "Gamma/Domain.h"
+
+using namespace al;
+
+/*
+ * This tutorial shows how to measure how much of the audio callback each
+ * kind of voice uses.
+ *
+ * Voices derive from ProfiledVoice, which times every call to onProcess().
+ * The cost is added to the profile of the voice's class, and each voice
+ * remembers its own worst block since it was triggered. Every block, the
+ * profile keeps the active voice with the highest worst block, so a single
+ * misbehaving voice can be found by its id.
+ *
+ * At the end of every block, the cost of each class in that block goes into
+ * a histogram. Each octave is split into four buckets, so percentiles
+ * are accurate to about 25%. Every window (one second by default) the
+ * histograms are summarized and cleared, and the summary is published as
+ * parameters:
+ *
+ *   /cpu/<class>/mean    mean cost per block in microseconds
+ *   /cpu/<class>/p99     99th percentile of the cost per block
+ *   /cpu/<class>/max     worst block
+ *   /cpu/<class>/voice   worst single voice in one block
+ *   /cpu/<class>/voices  mean number of voices
+ *   /cpu/<class>/worstActive    worst block of the worst voice active at
+ *                               the end of the window
+ *   /cpu/<class>/worstActiveId  id of that voice, as given to triggerOn()
+ *
+ * plus /cpu/total/... for the whole callback. The parameters are registered
+ * with the parameter server, so they can be watched over OSC while the
+ * application runs. They are only written by the profiler.
+ *
+ * The audio thread never touches the parameters: it leaves the summary in
+ * atomics and publish() copies them to the parameters from onAnimate().
+ *
+ * Keys on the upper row play a light voice, keys on the lower rows play a
+ * heavy one.
+*/
+
+class VoiceProfiler
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    static const int NUM_BUCKETS = 256;
+
+    struct ClassProfile {
+        ClassProfile(std::string name, float maxMicroseconds) :
+            mean {"mean", name, 0.0, "cpu", 0.0f, maxMicroseconds},
+            p99 {"p99", name, 0.0, "cpu", 0.0f, maxMicroseconds},
+            max {"max", name, 0.0, "cpu", 0.0f, maxMicroseconds},
+            voice {"voice", name, 0.0, "cpu", 0.0f, maxMicroseconds},
+            voices {"voices", name, 0.0, "cpu", 0.0f, 1000.0f},
+            worstActive {"worstActive", name, 0.0, "cpu", 0.0f, maxMicroseconds},
+            worstActiveId {"worstActiveId", name, -1.0, "cpu", -1.0f, 1e6f}
+        {}
+
+        Parameter mean;
+        Parameter p99;
+        Parameter max;
+        Parameter voice;
+        Parameter voices;
+        Parameter worstActive;
+        Parameter worstActiveId;
+
+        // Only used in the audio thread
+        uint64_t blockCost {0}; // ns
+        uint64_t blockVoices {0};
+        uint64_t blockWorstActive {0};
+        int blockWorstActiveId {-1};
+        uint64_t voiceMax {0};
+        uint32_t histogram[NUM_BUCKETS] {0};
+        uint64_t count {0};
+        uint64_t sum {0};
+        uint64_t maxCost {0};
+        uint64_t voiceCount {0};
+        uint64_t lastWorstActive {0}; // Of the last block
+        int lastWorstActiveId {-1};
+
+        // Summary of the last window, in microseconds
+        std::atomic<float> summary[7] {{0.0f}, {0.0f}, {0.0f}, {0.0f}, {0.0f}, {0.0f}, {-1.0f}};
+    };
+
+    VoiceProfiler(double windowSeconds = 1.0, float maxMicroseconds = 10000.0f) :
+        mWindow(windowSeconds), mMaxMicroseconds(maxMicroseconds)
+    {
+        mTotal.reset(new ClassProfile("total", maxMicroseconds));
+    }
+
+    // Register a voice class before triggering any voice of that class
+    template<class VoiceType>
+    void registerClass(std::string name) {
+        std::unique_ptr<ClassProfile> &profile = mClasses[name];
+        profile.reset(new ClassProfile(name, mMaxMicroseconds));
+        VoiceType::sProfile = profile.get();
+    }
+
+    // Make the parameters available over OSC
+    void registerParameters(ParameterServer &server) {
+        server << mTotal->mean << mTotal->p99 << mTotal->max;
+        for (auto &entry: mClasses) {
+            ClassProfile &profile = *entry.second;
+            server << profile.mean << profile.p99 << profile.max << profile.voice << profile.voices
+                   << profile.worstActive << profile.worstActiveId;
+        }
+    }
+
+    void addToGUI(ControlGUI &gui) {
+        gui << mTotal->mean << mTotal->p99 << mTotal->max;
+        for (auto &entry: mClasses) {
+            gui << entry.second->mean << entry.second->p99 << entry.second->voice
+                << entry.second->worstActiveId;
+        }
+    }
+
+    // Call at the start and end of onSound()
+    void beginBlock() { mBlockStart = Clock::now(); }
+
+    void endBlock(AudioIOData &io) {
+        mTotal->blockCost = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    Clock::now() - mBlockStart).count();
+        accumulate(*mTotal);
+        for (auto &entry: mClasses) {
+            accumulate(*entry.second);
+        }
+        mWindowTime += io.framesPerBuffer() / io.framesPerSecond();
+        if (mWindowTime >= mWindow) {
+            summarize(*mTotal);
+            for (auto &entry: mClasses) {
+                summarize(*entry.second);
+            }
+            mWindowTime = 0;
+        }
+    }
+
+    // Copy the last summary to the parameters. Call from onAnimate().
+    void publish() {
+        publish(*mTotal);
+        for (auto &entry: mClasses) {
+            publish(*entry.second);
+        }
+    }
+
+private:
+    // Four buckets per octave of nanoseconds
+    static int bucket(uint64_t ns) {
+        if (ns < 4) {
+            return int(ns);
+        }
+        int octave = 2;
+        while (ns >> (octave + 1)) {
+            octave++;
+        }
+        int quarter = int(ns >> (octave - 2)) & 3;
+        return std::min(NUM_BUCKETS - 1, octave * 4 + quarter);
+    }
+
+    static uint64_t bucketStart(int index) {
+        if (index < 8) {
+            return std::min(index, 4); // Buckets 4 to 7 are not used
+        }
+        return uint64_t(4 + (index & 3)) << (index / 4 - 2);
+    }
+
+    void accumulate(ClassProfile &profile) {
+        profile.histogram[bucket(profile.blockCost)]++;
+        profile.count++;
+        profile.sum += profile.blockCost;
+        profile.maxCost = std::max(profile.maxCost, profile.blockCost);
+        profile.voiceCount += profile.blockVoices;
+        profile.lastWorstActive = profile.blockWorstActive;
+        profile.lastWorstActiveId = profile.blockWorstActiveId;
+        profile.blockCost = 0;
+        profile.blockVoices = 0;
+        profile.blockWorstActive = 0;
+        profile.blockWorstActiveId = -1;
+    }
+
+    void summarize(ClassProfile &profile) {
+        if (profile.count == 0) {
+            return;
+        }
+        uint64_t target = profile.count - profile.count / 100;
+        uint64_t cumulative = 0;
+        int p99 = 0;
+        while (p99 < NUM_BUCKETS - 1 && cumulative + profile.histogram[p99] < target) {
+            cumulative += profile.histogram[p99];
+            p99++;
+        }
+        profile.summary[0] = profile.sum / 1000.0f / profile.count;
+        profile.summary[1] = bucketStart(p99 + 1) / 1000.0f; // Upper bound of the bucket
+        profile.summary[2] = profile.maxCost / 1000.0f;
+        profile.summary[3] = profile.voiceMax / 1000.0f;
+        profile.summary[4] = float(profile.voiceCount) / profile.count;
+        profile.summary[5] = profile.lastWorstActive / 1000.0f;
+        profile.summary[6] = float(profile.lastWorstActiveId);
+
+        std::fill(profile.histogram, profile.histogram + NUM_BUCKETS, 0);
+        profile.count = profile.sum = profile.maxCost = profile.voiceMax = profile.voiceCount = 0;
+    }
+
+    void publish(ClassProfile &profile) {
+        profile.mean = profile.summary[0].load();
+        profile.p99 = profile.summary[1].load();
+        profile.max = profile.summary[2].load();
+        profile.voice = profile.summary[3].load();
+        profile.voices = profile.summary[4].load();
+        profile.worstActive = profile.summary[5].load();
+        profile.worstActiveId = profile.summary[6].load();
+    }
+
+    double mWindow;
+    double mWindowTime {0};
+    float mMaxMicroseconds;
+    Clock::time_point mBlockStart;
+    std::unique_ptr<ClassProfile> mTotal;
+    std::map<std::string, std::unique_ptr<ClassProfile>> mClasses;
+};
+
+
+/*
+ * Derive from ProfiledVoice<YourVoice> and override onProcessProfiled()
+ * and onTriggerOnProfiled() instead of onProcess(AudioIOData &io) and
+ * onTriggerOn(). Register YourVoice with the profiler before it is used.
+ */
+template<class VoiceType>
+class ProfiledVoice : public SynthVoice {
+public:
+    virtual void onProcessProfiled(AudioIOData &io) = 0;
+
+    virtual void onTriggerOnProfiled() {}
+
+    // A reused voice starts a new profile
+    virtual void onTriggerOn() override final {
+        mLastCost = 0;
+        mWorstCost = 0;
+        onTriggerOnProfiled();
+    }
+
+    virtual void onProcess(AudioIOData &io) override final {
+        auto start = VoiceProfiler::Clock::now();
+        onProcessProfiled(io);
+        uint64_t cost = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    VoiceProfiler::Clock::now() - start).count();
+        mLastCost = cost;
+        mWorstCost = std::max(mWorstCost, cost);
+        if (sProfile) {
+            sProfile->blockCost += cost;
+            sProfile->blockVoices++;
+            sProfile->voiceMax = std::max(sProfile->voiceMax, cost);
+            if (mWorstCost > sProfile->blockWorstActive) {
+                sProfile->blockWorstActive = mWorstCost;
+                sProfile->blockWorstActiveId = id();
+            }
+        }
+    }
+
+    // Cost of this voice in nanoseconds, only to be read in the audio thread
+    uint64_t lastCost() const { return mLastCost; }
+    uint64_t worstCost() const { return mWorstCost; }
+
+    static VoiceProfiler::ClassProfile *sProfile;
+
+private:
+    uint64_t mLastCost {0};
+    uint64_t mWorstCost {0};
+};
+
+template<class VoiceType>
+VoiceProfiler::ClassProfile *ProfiledVoice<VoiceType>::sProfile = nullptr;
+
+
+class LightVoice : public ProfiledVoice<LightVoice> {
+public:
+    LightVoice() {
+        mEnvelope.lengths(0.1f, 0.5f);
+        mEnvelope.levels(0, 1, 0);
+        mEnvelope.sustainPoint(1);
+    }
+
+    virtual void onProcessProfiled(AudioIOData &io) override {
+        while(io()) {
+            io.out(0) += mEnvelope() * mSource() * 0.05;
+        }
+        if (mEnvelope.done()) {
+            free();
+        }
+    }
+
+    void set(float frequency) { mSource.freq(frequency); }
+
+    virtual void onTriggerOnProfiled() override { mEnvelope.reset(); }
+    virtual void onTriggerOff() override { mEnvelope.release(); }
+
+private:
+    gam::Sine<> mSource;
+    gam::AD<> mEnvelope;
+};
+
+
+class HeavyVoice : public ProfiledVoice<HeavyVoice> {
+public:
+    HeavyVoice() {
+        mEnvelope.lengths(0.1f, 0.5f);
+        mEnvelope.levels(0, 1, 0);
+        mEnvelope.sustainPoint(1);
+    }
+
+    virtual void onProcessProfiled(AudioIOData &io) override {
+        while(io()) {
+            float sample = 0;
+            for (int i = 0; i < NUM_PARTIALS; i++) {
+                sample += mPartials[i]() / (i + 1);
+            }
+            io.out(0) += mEnvelope() * sample * 0.01;
+        }
+        if (mEnvelope.done()) {
+            free();
+        }
+    }
+
+    void set(float frequency) {
+        for (int i = 0; i < NUM_PARTIALS; i++) {
+            mPartials[i].freq(frequency * (i + 1));
+        }
+    }
+
+    virtual void onTriggerOnProfiled() override { mEnvelope.reset(); }
+    virtual void onTriggerOff() override { mEnvelope.release(); }
+
+private:
+    static const int NUM_PARTIALS = 64;
+    gam::Sine<> mPartials[NUM_PARTIALS];
+    gam::AD<> mEnvelope;
+};
+
+
+class MyApp : public App
+{
+public:
+
+    virtual void onCreate() override {
+        nav().pos(Vec3d(0,0,8)); // Set the camera to view the scene
+        addCone(mesh); // Prepare mesh to draw a cone
+        mesh.primitive(Mesh::LINE_STRIP);
+
+        profiler.registerClass<LightVoice>("LightVoice");
+        profiler.registerClass<HeavyVoice>("HeavyVoice");
+        profiler.registerParameters(parameterServer());
+
+        profiler.addToGUI(gui); // Register the parameters with the GUI
+        gui.init(); // Initialize GUI. Don't forget this!
+        navControl().active(false);
+    }
+
+    virtual void onAnimate(double /*dt*/) override {
+        profiler.publish();
+    }
+
+    virtual void onDraw(Graphics &g) override
+    {
+        g.clear();
+        g.draw(mesh);
+        gui.draw(g);
+    }
+
+    virtual void onSound(AudioIOData &io) override {
+        profiler.beginBlock();
+        mPolySynth.render(io);
+        profiler.endBlock(io);
+    }
+
+    virtual void onKeyDown(const Keyboard& k) override
+    {
+        int midiNote = asciiToMIDI(k.key());
+        float freq = 440.0f * powf(2, (midiNote - 69)/12.0f);
+        if (std::string("1234567890").find(char(k.key())) != std::string::npos) {
+            LightVoice *voice = mPolySynth.getVoice<LightVoice>();
+            voice->set(freq);
+            mPolySynth.triggerOn(voice, 0, midiNote);
+        } else {
+            HeavyVoice *voice = mPolySynth.getVoice<HeavyVoice>();
+            voice->set(freq);
+            mPolySynth.triggerOn(voice, 0, midiNote);
+        }
+    }
+
+    virtual void onKeyUp(const Keyboard &k) override {
+        mPolySynth.triggerOff(asciiToMIDI(k.key()));
+    }
+
+private:
+    Mesh mesh;
+
+    PolySynth mPolySynth;
+    VoiceProfiler profiler;
+
+    ControlGUI gui;
+};
+
+
+int main(int argc, char *argv[])
+{
+    MyApp app;
+    app.dimensions(800, 600);
+    app.initAudio(44100, 256, 2, 0);
+    gam::sampleRate(44100);
+    app.start();
+    return 0;
+}
@@ -0,0 +1,348 @@
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "al/core/app/al_App.hpp"
+#include "al/core/graphics/al_Shapes.hpp"
+#include "al/core/math/al_Random.hpp"
+#include "al/util/ui/al_Parameter.hpp"
+#include "al/util/ui/al_ControlGUI.hpp"
+
+#include "al/util/scene/al_SynthSequencer.hpp"
+
+#include "Gamma/Oscillator.h"
+#include "Gamma/Envelope.h"
+#include "Gamma/Domain.h"
+
+using namespace al;
+
+/*
+ * This tutorial shows how voices can share their geometry.
+ *
+ * In the previous tutorials every voice calls addCone(mesh) in its
+ * constructor to fill its own Mesh. Every voice holds a copy of the same
+ * vertices, and every new voice generates them again.
+ *
+ * A MeshCache builds each mesh once and hands out shared pointers to a
+ * const Mesh. Meshes are identified by a key made from the shape and its
+ * parameters, so a cone of a different size is a different mesh. Voices
+ * keep the pointer and draw through it, and the mesh lives as long as the
+ * cache or any voice uses it. purgeUnused() forgets the meshes that no voice
+ * uses anymore.
+ *
+ * The cache counts how many meshes it has built and how many requests it
+ * served from memory.
+ *
+ * Press keys to trigger voices, and 'p' to print the counters.
+ * Run with "--benchmark" to time the construction of thousands of voices
+ * with and without the cache. Build with -DCOUNT_ALLOCATIONS to also count
+ * their allocations.
+*/
+
+class MeshCache
+{
+public:
+    typedef std::shared_ptr<const Mesh> MeshPtr;
+
+    /*
+     * Get the mesh for key, calling build to create it if it is not in the
+     * cache. The key must identify everything build does.
+     */
+    MeshPtr get(const std::string &key, std::function<void(Mesh &)> build) {
+        std::unique_lock<std::mutex> lk(mLock);
+        auto entry = mMeshes.find(key);
+        if (entry != mMeshes.end()) {
+            mHits++;
+            return entry->second;
+        }
+        std::shared_ptr<Mesh> mesh = std::make_shared<Mesh>();
+        build(*mesh);
+        mMeshes[key] = mesh;
+        mBuilt++;
+        return mesh;
+    }
+
+    MeshPtr cone(float radius = 1, float height = 2, int slices = 16,
+                 Mesh::Primitive primitive = Mesh::TRIANGLES) {
+        std::stringstream key;
+        key << "cone " << radius << " " << height << " " << slices << " " << primitive;
+        return get(key.str(), [=](Mesh &mesh) {
+            addCone(mesh, radius, Vec3f(0, 0, height), slices);
+            mesh.primitive(primitive);
+        });
+    }
+
+    MeshPtr dodecahedron(float radius = 1, Mesh::Primitive primitive = Mesh::TRIANGLES) {
+        std::stringstream key;
+        key << "dodecahedron " << radius << " " << primitive;
+        return get(key.str(), [=](Mesh &mesh) {
+            addDodecahedron(mesh, radius);
+            mesh.primitive(primitive);
+        });
+    }
+
+    // Forget meshes that are only held by the cache
+    void purgeUnused() {
+        std::unique_lock<std::mutex> lk(mLock);
+        for (auto entry = mMeshes.begin(); entry != mMeshes.end();) {
+            if (entry->second.use_count() == 1) {
+                entry = mMeshes.erase(entry);
+            } else {
+                entry++;
+            }
+        }
+    }
+
+    size_t size() {
+        std::unique_lock<std::mutex> lk(mLock);
+        return mMeshes.size();
+    }
+
+    uint64_t built() const { return mBuilt; }
+    uint64_t hits() const { return mHits; }
+
+private:
+    std::mutex mLock;
+    std::map<std::string, MeshPtr> mMeshes;
+    std::atomic<uint64_t> mBuilt {0};
+    std::atomic<uint64_t> mHits {0};
+};
+
+// One cache for the whole application. Voices are constructed by the
+// PolySynth, so they can't be given the cache in their constructor.
+MeshCache &meshCache() {
+    static MeshCache cache;
+    return cache;
+}
+
+
+class MyVoice : public SynthVoice {
+public:
+    MyVoice() {
+        mMesh = meshCache().cone(1, 2, 16, Mesh::LINE_STRIP); // Shared by all voices
+
+        mEnvelope.lengths(0.1f, 0.5f);
+        mEnvelope.levels(0, 1, 0);
+        mEnvelope.sustainPoint(1);
+    }
+
+    virtual void onProcess(AudioIOData &io) override {
+        while(io()) {
+            io.out(0) += mEnvelope() * mSource() * 0.05;
+        }
+        if (mEnvelope.done()) {
+            free();
+        }
+    }
+
+    virtual void onProcess(Graphics &g) override {
+        g.pushMatrix();
+        g.translate(mX, mY, 0);
+        g.scale(mSize * mEnvelope.value());
+        g.draw(*mMesh);
+        g.popMatrix();
+    }
+
+    void set(float x, float y, float size, float frequency, float attackTime, float releaseTime) {
+        mX = x;
+        mY = y;
+        mSize = size;
+        mSource.freq(frequency);
+        mEnvelope.lengths()[0] = attackTime;
+        mEnvelope.lengths()[1] = releaseTime;
+    }
+
+    virtual void onTriggerOn() override {
+        mEnvelope.reset();
+    }
+
+    virtual void onTriggerOff() override {
+        mEnvelope.release();
+    }
+
+private:
+    gam::Sine<> mSource;
+    gam::AD<> mEnvelope;
+
+    MeshCache::MeshPtr mMesh;
+
+    float mX {0}, mY {0}, mSize {1.0};
+};
+
+
+// The voice as written in the trigger tutorial, for the benchmark
+class OwnMeshVoice : public SynthVoice {
+public:
+    OwnMeshVoice() {
+        addCone(mesh);
+        mesh.primitive(Mesh::LINE_STRIP);
+    }
+
+private:
+    Mesh mesh;
+};
+
+class CachedMeshVoice : public SynthVoice {
+public:
+    CachedMeshVoice() {
+        mMesh = meshCache().cone(1, 2, 16, Mesh::LINE_STRIP);
+    }
+
+private:
+    MeshCache::MeshPtr mMesh;
+};
+
+
+class MyApp : public App
+{
+public:
+
+    virtual void onCreate() override {
+        nav().pos(Vec3d(0,0,8)); // Set the camera to view the scene
+
+        gui << AttackTime << ReleaseTime; // Register the parameters with the GUI
+        gui.init(); // Initialize GUI. Don't forget this!
+        navControl().active(false);
+    }
+
+    virtual void onDraw(Graphics &g) override
+    {
+        g.clear();
+        mPolySynth.render(g);
+        gui.draw(g);
+    }
+
+    virtual void onSound(AudioIOData &io) override {
+        mPolySynth.render(io);
+    }
+
+    virtual void onKeyDown(const Keyboard& k) override
+    {
+        if (k.key() == 'p') {
+            std::cout << "Meshes built: " << meshCache().built()
+                      << " shared: " << meshCache().hits()
+                      << " in cache: " << meshCache().size() << std::endl;
+            return;
+        }
+        MyVoice *voice = mPolySynth.getVoice<MyVoice>();
+        int midiNote = asciiToMIDI(k.key());
+        float freq = 440.0f * powf(2, (midiNote - 69)/12.0f);
+        voice->set(randomGenerator.uniformS(), randomGenerator.uniformS(),
+                   0.2 + randomGenerator.uniform() * 0.5,
+                   freq, AttackTime.get(), ReleaseTime.get());
+        mPolySynth.triggerOn(voice, 0, midiNote);
+    }
+
+    virtual void onKeyUp(const Keyboard &k) override {
+        mPolySynth.triggerOff(asciiToMIDI(k.key()));
+    }
+
+private:
+    Parameter AttackTime {"AttackTime", "Sound", 0.1, "", 0.001f, 2.0f};
+    Parameter ReleaseTime {"ReleaseTime", "Sound", 1.0, "", 0.001f, 5.0f};
+
+    PolySynth mPolySynth;
+    rnd::Random<> randomGenerator;
+
+    ControlGUI gui;
+};
+
+
+/*
+ * To count the allocations made inside Mesh, the global operator new has to
+ * be replaced, which affects the whole program. So it is only compiled in
+ * when building the benchmark with -DCOUNT_ALLOCATIONS. The replacement
+ * only counts on a thread while that thread has set countAllocations. The
+ * array forms of new and delete call these.
+ */
+#ifdef COUNT_ALLOCATIONS
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+// When operator delete is inlined, GCC sees free() called on memory from
+// operator new, and can't tell that it came from malloc()
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+static thread_local bool countAllocations {false};
+static thread_local uint64_t allocationCount {0};
+static thread_local uint64_t allocatedBytes {0};
+
+void *operator new(size_t size) {
+    if (countAllocations) {
+        allocationCount++;
+        allocatedBytes += size;
+    }
+    void *p = std::malloc(size);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    std::free(p);
+}
+#endif
+
+template<class VoiceType>
+void constructVoices(std::string name, int numVoices)
+{
+    std::vector<std::unique_ptr<VoiceType>> voices;
+    voices.reserve(numVoices);
+#ifdef COUNT_ALLOCATIONS
+    uint64_t allocations = allocationCount;
+    uint64_t bytes = allocatedBytes;
+    countAllocations = true;
+#endif
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < numVoices; i++) {
+        voices.emplace_back(new VoiceType);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+    std::cout << name << ": " << numVoices << " voices, "
+              << elapsed.count() * 1e6 / numVoices << " us per voice";
+#ifdef COUNT_ALLOCATIONS
+    countAllocations = false;
+    std::cout << ", " << double(allocationCount - allocations) / numVoices << " allocations per voice, "
+              << (allocatedBytes - bytes) / 1024 << " kB total";
+#endif
+    std::cout << std::endl;
+}
+
+void runBenchmark()
+{
+#ifndef COUNT_ALLOCATIONS
+    std::cout << "Build with -DCOUNT_ALLOCATIONS to count allocations" << std::endl;
+#endif
+    for (int numVoices: {100, 1000, 10000}) {
+        constructVoices<OwnMeshVoice>("Own mesh   ", numVoices);
+        constructVoices<CachedMeshVoice>("Cached mesh", numVoices);
+    }
+    std::cout << "Meshes built by the cache: " << meshCache().built() << std::endl;
+}
+
+
+int main(int argc, char *argv[])
+{
+    gam::sampleRate(44100);
+    if (argc > 1 && std::string(argv[1]) == "--benchmark") {
+        runBenchmark();
+        return 0;
+    }
+    MyApp app;
+    app.dimensions(800, 600);
+    app.initAudio(44100, 256, 2, 0);
+    app.start();
+    return 0;
+}
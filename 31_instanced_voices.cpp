@@ -0,0 +1,388 @@
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "al/core/app/al_App.hpp"
+#include "al/core/graphics/al_Shapes.hpp"
+#include "al/core/math/al_Random.hpp"
+#include "al/util/ui/al_Parameter.hpp"
+#include "al/util/ui/al_ControlGUI.hpp"
+
+#include "al/util/scene/al_SynthSequencer.hpp"
+
+#include "Gamma/Oscillator.h"
+#include "Gamma/Envelope.h"
+#include "Gamma/Domain.h"
+
+using namespace al;
+
+/*
+ * This tutorial shows how to draw thousands of voices that share a mesh
+ * with a few draw calls.
+ *
+ * When PolySynth::render(g) is called, every voice pushes a matrix,
+ * translates, scales, draws its mesh and pops the matrix. With thousands of
+ * voices, the time goes into the matrix stack and the draw calls rather
+ * than into drawing.
+ *
+ * An InstancedVoice doesn't draw. It writes its position, scale and color
+ * into an Instance, and the InstanceBatch collects the instances of all
+ * voices in one contiguous array per mesh. After PolySynth::render(g), the
+ * batch gives each array to a DrawSubmitter:
+ *
+ *   MergedMeshSubmitter  copies the mesh once for each instance into a
+ *                        single mesh, already moved, scaled and colored, and
+ *                        draws it with one call to g.draw()
+ *   CountingSubmitter    only counts the calls and instances. It can be used
+ *                        to test the batching without a window.
+ *
+ * Merging is not GPU instancing. The vertices of every instance are copied
+ * on the CPU every frame, so the cost grows with the number of instances
+ * times the number of vertices of the mesh, and the merged mesh is uploaded
+ * again every frame. It replaces the matrix stack and the draw call of
+ * every voice with a tight copy loop, which pays off for small meshes. A
+ * submitter that uses real instancing (a buffer of per instance attributes
+ * and glDrawElementsInstanced) would remove the copy, and can be added
+ * behind the same DrawSubmitter interface.
+ *
+ * Meshes can only be merged if their primitive is POINTS, LINES or
+ * TRIANGLES, as strips and fans would join the copies together. Other
+ * meshes are drawn once per instance.
+ *
+ * The batch is given to the voices as the PolySynth's default user data.
+ *
+ * Press and hold keys to trigger many voices. Run with "--benchmark" to
+ * time the batching without a window.
+*/
+
+struct Instance {
+    float x, y, z;
+    float scale;
+    Color color;
+};
+
+
+class DrawSubmitter
+{
+public:
+    virtual ~DrawSubmitter() {}
+    virtual void drawInstances(const Mesh &mesh, const Instance *instances, size_t count) = 0;
+};
+
+
+class InstancedVoice : public SynthVoice {
+public:
+    // The mesh must live longer than the voice, and not change
+    virtual const Mesh &instanceMesh() = 0;
+    virtual void writeInstance(Instance &instance) = 0;
+
+    virtual void onProcess(Graphics &g) override final;
+};
+
+
+class InstanceBatch
+{
+public:
+    void add(InstancedVoice &voice) {
+        const Mesh *mesh = &voice.instanceMesh();
+        // There are usually few meshes, and consecutive voices tend to
+        // share them, so a linear search is fast
+        if (mLast >= mBatches.size() || mBatches[mLast].mesh != mesh) {
+            mLast = 0;
+            while (mLast < mBatches.size() && mBatches[mLast].mesh != mesh) {
+                mLast++;
+            }
+            if (mLast == mBatches.size()) {
+                mBatches.push_back({mesh, {}});
+            }
+        }
+        mBatches[mLast].instances.emplace_back();
+        voice.writeInstance(mBatches[mLast].instances.back());
+    }
+
+    // Draw and clear the instances. The arrays keep their memory.
+    void submit(DrawSubmitter &submitter) {
+        for (auto &batch: mBatches) {
+            if (batch.instances.size() > 0) {
+                submitter.drawInstances(*batch.mesh, batch.instances.data(), batch.instances.size());
+                batch.instances.clear();
+            }
+        }
+    }
+
+private:
+    struct Batch {
+        const Mesh *mesh;
+        std::vector<Instance> instances;
+    };
+
+    std::vector<Batch> mBatches;
+    size_t mLast {0};
+};
+
+
+void InstancedVoice::onProcess(Graphics & /*g*/) {
+    InstanceBatch *batch = static_cast<InstanceBatch *>(userData());
+    if (batch) {
+        batch->add(*this);
+    }
+}
+
+
+class MergedMeshSubmitter : public DrawSubmitter
+{
+public:
+    /*
+     * Set the Graphics to draw with, every frame before submitting. With
+     * nullptr meshes are merged but not drawn, to time merging without a
+     * window.
+     */
+    void graphics(Graphics *g) { mGraphics = g; }
+
+    virtual void drawInstances(const Mesh &mesh, const Instance *instances, size_t count) override {
+        Mesh::Primitive primitive = mesh.primitive();
+        if (primitive != Mesh::POINTS && primitive != Mesh::LINES && primitive != Mesh::TRIANGLES) {
+            drawEach(mesh, instances, count);
+            return;
+        }
+        mMerged.reset(); // Keeps the memory of the previous frame
+        mMerged.primitive(primitive);
+        const std::vector<Vec3f> &vertices = mesh.vertices();
+        const std::vector<unsigned> &indices = mesh.indices();
+        for (size_t i = 0; i < count; i++) {
+            const Instance &instance = instances[i];
+            unsigned first = unsigned(i * vertices.size());
+            for (auto &v: vertices) {
+                mMerged.vertex(v.x * instance.scale + instance.x,
+                               v.y * instance.scale + instance.y,
+                               v.z * instance.scale + instance.z);
+                mMerged.color(instance.color);
+            }
+            for (auto index: indices) {
+                mMerged.index(first + index);
+            }
+        }
+        mVerticesMerged += count * vertices.size();
+        if (mGraphics) {
+            mGraphics->meshColor(); // Use the colors of the vertices
+            mGraphics->draw(mMerged);
+        }
+    }
+
+    uint64_t verticesMerged() const { return mVerticesMerged; }
+
+private:
+    void drawEach(const Mesh &mesh, const Instance *instances, size_t count) {
+        if (!mGraphics) {
+            return;
+        }
+        for (size_t i = 0; i < count; i++) {
+            mGraphics->pushMatrix();
+            mGraphics->translate(instances[i].x, instances[i].y, instances[i].z);
+            mGraphics->scale(instances[i].scale);
+            mGraphics->color(instances[i].color);
+            mGraphics->draw(mesh);
+            mGraphics->popMatrix();
+        }
+    }
+
+    Graphics *mGraphics {nullptr};
+    Mesh mMerged; // Reused every frame, as the submitter is kept by the app
+    uint64_t mVerticesMerged {0};
+};
+
+
+class CountingSubmitter : public DrawSubmitter
+{
+public:
+    virtual void drawInstances(const Mesh & /*mesh*/, const Instance *instances, size_t count) override {
+        drawCalls++;
+        instancesDrawn += count;
+        for (size_t i = 0; i < count; i++) {
+            checksum += instances[i].x + instances[i].scale;
+        }
+    }
+
+    uint64_t drawCalls {0};
+    uint64_t instancesDrawn {0};
+    double checksum {0};
+};
+
+
+// Every voice uses this mesh
+const Mesh &coneMesh() {
+    static Mesh mesh;
+    if (mesh.vertices().size() == 0) {
+        addCone(mesh);
+        mesh.primitive(Mesh::TRIANGLES);
+    }
+    return mesh;
+}
+
+
+class MyVoice : public InstancedVoice {
+public:
+    MyVoice() {
+        mEnvelope.lengths(0.1f, 0.5f);
+        mEnvelope.levels(0, 1, 0);
+        mEnvelope.sustainPoint(1);
+    }
+
+    virtual void onProcess(AudioIOData &io) override {
+        while(io()) {
+            io.out(0) += mEnvelope() * mSource() * 0.01;
+        }
+        if (mEnvelope.done()) {
+            free();
+        }
+    }
+
+    virtual const Mesh &instanceMesh() override { return coneMesh(); }
+
+    virtual void writeInstance(Instance &instance) override {
+        instance.x = mX;
+        instance.y = mY;
+        instance.z = 0;
+        instance.scale = mSize * mEnvelope.value();
+        instance.color = Color(mHue, 1.0f - mHue, 0.5f);
+    }
+
+    void set(float x, float y, float size, float hue, float frequency) {
+        mX = x;
+        mY = y;
+        mSize = size;
+        mHue = hue;
+        mSource.freq(frequency);
+    }
+
+    virtual void onTriggerOn() override {
+        mEnvelope.reset();
+    }
+
+    virtual void onTriggerOff() override {
+        mEnvelope.release();
+    }
+
+private:
+    gam::Sine<> mSource;
+    gam::AD<> mEnvelope;
+
+    float mX {0}, mY {0}, mSize {1.0}, mHue {0};
+};
+
+
+class MyApp : public App
+{
+public:
+
+    virtual void onCreate() override {
+        nav().pos(Vec3d(0,0,8)); // Set the camera to view the scene
+
+        gui << VoicesPerKey; // Register the parameters with the GUI
+        gui.init(); // Initialize GUI. Don't forget this!
+        navControl().active(false);
+
+        mPolySynth.setDefaultUserData(&batch);
+    }
+
+    virtual void onDraw(Graphics &g) override
+    {
+        g.clear();
+        g.polygonLine();
+        mPolySynth.render(g); // Voices only add their instances to the batch
+        submitter.graphics(&g);
+        batch.submit(submitter);
+        gui.draw(g);
+    }
+
+    virtual void onSound(AudioIOData &io) override {
+        mPolySynth.render(io);
+    }
+
+    virtual void onKeyDown(const Keyboard& k) override
+    {
+        int midiNote = asciiToMIDI(k.key());
+        for (int i = 0; i < VoicesPerKey.get(); i++) {
+            MyVoice *voice = mPolySynth.getVoice<MyVoice>();
+            float freq = 440.0f * powf(2, (midiNote - 69)/12.0f) * (1.0f + i * 0.001f);
+            voice->set(randomGenerator.uniformS() * 3, randomGenerator.uniformS() * 2,
+                       0.05f, randomGenerator.uniform(), freq);
+            mPolySynth.triggerOn(voice, 0, midiNote);
+        }
+    }
+
+    virtual void onKeyUp(const Keyboard &k) override {
+        mPolySynth.triggerOff(asciiToMIDI(k.key()));
+    }
+
+private:
+    ParameterInt VoicesPerKey {"VoicesPerKey", "", 100, "", 1, 1000};
+
+    PolySynth mPolySynth;
+    InstanceBatch batch;
+    MergedMeshSubmitter submitter;
+    rnd::Random<> randomGenerator;
+
+    ControlGUI gui;
+};
+
+
+/*
+ * Collects the instances of numVoices voices and submits them many times,
+ * to a CountingSubmitter to time the batching alone, and to the
+ * MergedMeshSubmitter used by the app, without drawing, to time the
+ * batching and the merging. Uploading and drawing the merged mesh is not
+ * included. The voices are not in a PolySynth here, as that needs a window
+ * to render graphics.
+ */
+void runBenchmark()
+{
+    const int numFrames = 600;
+    rnd::Random<> randomGenerator;
+
+    for (int numVoices: {1000, 10000, 100000}) {
+        std::vector<std::unique_ptr<MyVoice>> voices;
+        for (int i = 0; i < numVoices; i++) {
+            voices.emplace_back(new MyVoice);
+            voices.back()->set(randomGenerator.uniformS(), randomGenerator.uniformS(),
+                               0.05f, randomGenerator.uniform(), 440.0f);
+            voices.back()->triggerOn();
+        }
+        InstanceBatch batch;
+        CountingSubmitter counter;
+        MergedMeshSubmitter merger;
+        auto timeFrames = [&](DrawSubmitter &submitter) {
+            auto start = std::chrono::high_resolution_clock::now();
+            for (int frame = 0; frame < numFrames; frame++) {
+                for (auto &voice: voices) {
+                    batch.add(*voice);
+                }
+                batch.submit(submitter);
+            }
+            std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+            return elapsed.count() * 1e6 / numFrames;
+        };
+        double batching = timeFrames(counter);
+        double merging = timeFrames(merger);
+        std::cout << numVoices << " voices: " << counter.drawCalls / numFrames << " draw call per frame"
+                  << " instead of " << numVoices << ", batching " << batching << " us per frame, "
+                  << "batching and merging " << merging << " us per frame ("
+                  << merger.verticesMerged() / numFrames << " vertices copied)" << std::endl;
+    }
+}
+
+
+int main(int argc, char *argv[])
+{
+    gam::sampleRate(44100);
+    if (argc > 1 && std::string(argv[1]) == "--benchmark") {
+        runBenchmark();
+        return 0;
+    }
+    MyApp app;
+    app.dimensions(800, 600);
+    app.initAudio(44100, 256, 2, 0);
+    app.start();
+    return 0;
+}
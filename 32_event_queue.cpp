@@ -0,0 +1,367 @@
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <initializer_list>
+#include <queue>
+#include <random>
+#include <string>
+#include <typeindex>
+#include <unordered_map>
+#include <vector>
+
+#include "al/core/app/al_App.hpp"
+#include "al/core/graphics/al_Shapes.hpp"
+#include "al/util/ui/al_Parameter.hpp"
+
+#include "al/util/scene/al_SynthSequencer.hpp"
+
+#include "Gamma/Oscillator.h"
+#include "Gamma/Envelope.h"
+#include "Gamma/Domain.h"
+
+using namespace al;
+
+/*
+ * This tutorial shows how to schedule millions of events and start each
+ * one on its exact sample.
+ *
+ * SynthSequencer allocates a voice for every event when it is added, and
+ * starts events at the beginning of the block that contains their start
+ * time. Generative scores can have millions of events.
+ *
+ * The WheelSequencer stores an event as a small record (the voice class
+ * and its parameter fields), and only gets a voice from the PolySynth when
+ * the event starts. Voices are configured through setParamFields(), as in
+ * the event recorder tutorial. Events are kept in an EventWheel, a timing
+ * wheel with one slot per audio block:
+ *
+ *   - an event within the next numSlots blocks goes straight into its slot,
+ *     which costs O(1)
+ *   - events further in the future wait in a heap, and are taken from it in
+ *     the block where they start, which costs O(log n) once per event
+ *
+ * Every block, the slot of that block is emptied, and merged in order with
+ * the events from the heap that start in the block. Nothing is copied into
+ * the slots while blocks are emptied, because growing a slot would
+ * allocate memory in the audio thread. Each event is triggered
+ * with PolySynth::triggerOn(voice, offset), where offset is the position of
+ * its start time inside the block, so it starts on its exact sample. Note
+ * offs are applied at the start of the block that contains them, and a note
+ * lasts at least one block.
+ *
+ * Voices are taken from the PolySynth in the audio thread, so allocate
+ * enough polyphony before starting audio. Add events before starting
+ * audio, as the wheel is not thread safe.
+ *
+ * Run with "--benchmark" to schedule 10 million events and measure the
+ * cost of emptying each block.
+*/
+
+template<class Payload>
+class EventWheel
+{
+public:
+    EventWheel(unsigned blockSize, unsigned numSlots = 1024) :
+        mBlockSize(blockSize)
+    {
+        unsigned size = 1;
+        while (size < numSlots) {
+            size <<= 1;
+        }
+        mSlots.resize(size);
+        mMask = size - 1;
+    }
+
+    // Events scheduled in the past start at the beginning of the next block
+    void schedule(uint64_t sampleTime, Payload payload) {
+        uint64_t block = sampleTime / mBlockSize;
+        if (block < mCurrentBlock) {
+            block = mCurrentBlock;
+            sampleTime = block * mBlockSize;
+        }
+        if (block < mCurrentBlock + mSlots.size()) {
+            mSlots[block & mMask].push_back({uint32_t(sampleTime - block * mBlockSize), payload});
+        } else {
+            mFuture.push({sampleTime, payload});
+        }
+        mSize++;
+    }
+
+    /*
+     * Call function(payload, offset) for every event in the current block,
+     * in the order of their offset, and move to the next block. Doesn't
+     * allocate memory.
+     */
+    template<class Function>
+    void popBlock(Function function) {
+        std::vector<SlotEntry> &slot = mSlots[mCurrentBlock & mMask];
+        std::sort(slot.begin(), slot.end(),
+                  [](const SlotEntry &a, const SlotEntry &b) { return a.offset < b.offset; });
+        // The heap gives its events in time order, merge them with the slot
+        uint64_t blockStart = mCurrentBlock * mBlockSize;
+        auto next = slot.begin();
+        while (!mFuture.empty() && mFuture.top().sampleTime < blockStart + mBlockSize) {
+            FutureEntry entry = mFuture.top();
+            mFuture.pop();
+            uint32_t offset = uint32_t(entry.sampleTime - blockStart);
+            for (; next != slot.end() && next->offset <= offset; ++next) {
+                function(next->payload, next->offset);
+            }
+            function(entry.payload, offset);
+            mSize--;
+        }
+        for (; next != slot.end(); ++next) {
+            function(next->payload, next->offset);
+        }
+        mSize -= slot.size();
+        slot.clear(); // Keeps its memory for the next turn of the wheel
+        mCurrentBlock++;
+    }
+
+    uint64_t currentBlock() const { return mCurrentBlock; }
+    size_t size() const { return mSize; }
+
+private:
+    struct SlotEntry {
+        uint32_t offset;
+        Payload payload;
+    };
+
+    struct FutureEntry {
+        uint64_t sampleTime;
+        Payload payload;
+
+        bool operator>(const FutureEntry &other) const { return sampleTime > other.sampleTime; }
+    };
+
+    unsigned mBlockSize;
+    uint64_t mMask;
+    std::vector<std::vector<SlotEntry>> mSlots;
+    std::priority_queue<FutureEntry, std::vector<FutureEntry>, std::greater<FutureEntry>> mFuture;
+    uint64_t mCurrentBlock {0};
+    size_t mSize {0};
+};
+
+
+class WheelSequencer
+{
+public:
+    WheelSequencer(double sampleRate, unsigned blockSize) :
+        mSampleRate(sampleRate), mBlockSize(blockSize), mWheel(blockSize)
+    {}
+
+    PolySynth &synth() { return mSynth; }
+
+    // Register each voice class before adding events for it
+    template<class VoiceType>
+    void registerVoice(std::string name) {
+        mSynth.registerSynthClass<VoiceType>(name);
+        mClassIndex[std::type_index(typeid(VoiceType))] = uint32_t(mFactories.size());
+        mFactories.push_back([this]() -> SynthVoice * { return mSynth.getVoice<VoiceType>(); });
+    }
+
+    // Times are in seconds from the start of audio
+    template<class VoiceType>
+    void add(double startTime, double duration, std::initializer_list<float> fields) {
+        uint32_t index = uint32_t(mEvents.size());
+        mEvents.push_back({mClassIndex.at(std::type_index(typeid(VoiceType))),
+                           uint32_t(mFields.size()), uint32_t(fields.size())});
+        mFields.insert(mFields.end(), fields);
+        uint64_t start = uint64_t(startTime * mSampleRate);
+        uint64_t end = std::max(uint64_t((startTime + duration) * mSampleRate), start + mBlockSize);
+        mWheel.schedule(start, index);
+        mWheel.schedule(end, index | NOTE_OFF);
+    }
+
+    void render(AudioIOData &io) {
+        mWheel.popBlock([this](uint32_t payload, uint32_t offset) {
+            if (payload & NOTE_OFF) {
+                mSynth.triggerOff(int(payload & ~NOTE_OFF));
+                return;
+            }
+            Event &event = mEvents[payload];
+            SynthVoice *voice = mFactories[event.classIndex]();
+            voice->setParamFields(mFields.data() + event.firstField, int(event.numFields));
+            mSynth.triggerOn(voice, int(offset), int(payload));
+        });
+        mSynth.render(io);
+    }
+
+    void render(Graphics &g) { mSynth.render(g); }
+
+private:
+    static const uint32_t NOTE_OFF = 0x80000000;
+
+    struct Event {
+        uint32_t classIndex;
+        uint32_t firstField;
+        uint32_t numFields;
+    };
+
+    double mSampleRate;
+    unsigned mBlockSize;
+    PolySynth mSynth;
+    EventWheel<uint32_t> mWheel;
+    std::vector<Event> mEvents;
+    std::vector<float> mFields;
+    std::vector<std::function<SynthVoice *()>> mFactories;
+    std::unordered_map<std::type_index, uint32_t> mClassIndex;
+};
+
+
+class MyVoice : public SynthVoice {
+public:
+    MyVoice() {
+        addCone(mesh); // Prepare mesh to draw a cone
+        mesh.primitive(Mesh::LINE_STRIP);
+
+        mEnvelope.lengths(0.01f, 0.1f);
+        mEnvelope.levels(0, 1, 0);
+        mEnvelope.sustainPoint(1);
+    }
+
+    virtual void onProcess(AudioIOData &io) override {
+        while(io()) {
+            io.out(0) += mEnvelope() * mSource() * 0.05;
+        }
+        if (mEnvelope.done()) {
+            free();
+        }
+    }
+
+    virtual void onProcess(Graphics &g) {
+        g.pushMatrix();
+        g.translate(mX, mY, 0);
+        g.scale(0.2 * mEnvelope.value());
+        g.draw(mesh);
+        g.popMatrix();
+    }
+
+    // Fields: x, y, frequency
+    virtual bool setParamFields(float *pFields, int numFields) override {
+        if (numFields < 3) {
+            return false;
+        }
+        mX = pFields[0];
+        mY = pFields[1];
+        mSource.freq(pFields[2]);
+        return true;
+    }
+
+    virtual void onTriggerOn() override {
+        mEnvelope.reset();
+    }
+
+    virtual void onTriggerOff() override {
+        mEnvelope.release();
+    }
+
+private:
+    gam::Sine<> mSource;
+    gam::AD<> mEnvelope;
+    Mesh mesh;
+    float mX {0}, mY {0};
+};
+
+
+class MyApp : public App
+{
+public:
+
+    virtual void onCreate() override {
+        nav().pos(Vec3d(0,0,8)); // Set the camera to view the scene
+    }
+
+    virtual void onDraw(Graphics &g) override
+    {
+        g.clear();
+        sequencer.render(g);
+    }
+
+    virtual void onSound(AudioIOData &io) override {
+        sequencer.render(io);
+    }
+
+    WheelSequencer sequencer {44100, 256};
+};
+
+
+/*
+ * Schedules 10 million events at random times over ten minutes, in random
+ * order, and then empties the wheel block by block.
+ */
+void runBenchmark()
+{
+    const size_t numEvents = 10000000;
+    const double sampleRate = 44100;
+    const unsigned blockSize = 256;
+    const double seconds = 600;
+
+    std::mt19937_64 random(1);
+    std::uniform_int_distribution<uint64_t> time(0, uint64_t(seconds * sampleRate));
+
+    EventWheel<uint32_t> wheel(blockSize);
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < numEvents; i++) {
+        wheel.schedule(time(random), uint32_t(i));
+    }
+    std::chrono::duration<double> scheduling = std::chrono::high_resolution_clock::now() - start;
+    std::cout << "Scheduled " << numEvents << " events in " << scheduling.count() << " s ("
+              << scheduling.count() * 1e9 / numEvents << " ns per event)" << std::endl;
+
+    uint64_t numBlocks = uint64_t(seconds * sampleRate / blockSize) + 1;
+    std::vector<double> blockTimes;
+    blockTimes.reserve(numBlocks);
+    uint64_t popped = 0;
+    uint64_t misplaced = 0;
+    uint64_t outOfOrder = 0;
+    for (uint64_t block = 0; block < numBlocks; block++) {
+        uint32_t lastOffset = 0;
+        auto blockStart = std::chrono::high_resolution_clock::now();
+        wheel.popBlock([&](uint32_t /*payload*/, uint32_t offset) {
+            popped++;
+            misplaced += offset >= blockSize;
+            outOfOrder += offset < lastOffset;
+            lastOffset = offset;
+        });
+        std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - blockStart;
+        blockTimes.push_back(elapsed.count());
+    }
+    std::sort(blockTimes.begin(), blockTimes.end());
+    double total = 0;
+    for (double t: blockTimes) {
+        total += t;
+    }
+    std::cout << "Popped " << popped << " events (" << misplaced << " misplaced, "
+              << outOfOrder << " out of order) in "
+              << numBlocks << " blocks, " << double(popped) / numBlocks << " per block" << std::endl;
+    std::cout << "Block time us: mean " << total / numBlocks * 1e6
+              << " p99 " << blockTimes[size_t(blockTimes.size() * 0.99)] * 1e6
+              << " worst " << blockTimes.back() * 1e6
+              << " (budget " << blockSize / sampleRate * 1e6 << ")" << std::endl;
+}
+
+
+int main(int argc, char *argv[])
+{
+    gam::sampleRate(44100);
+    if (argc > 1 && std::string(argv[1]) == "--benchmark") {
+        runBenchmark();
+        return 0;
+    }
+    MyApp app;
+    app.sequencer.registerVoice<MyVoice>("MyVoice");
+    app.sequencer.synth().allocatePolyphony<MyVoice>(256);
+
+    // A generative score: an arpeggio of 100,000 notes, 20 per second
+    for (int i = 0; i < 100000; i++) {
+        float step = float(i % 16);
+        app.sequencer.add<MyVoice>(i * 0.05, 0.04,
+                                   {step / 8.0f - 1.0f, float(i % 5) / 5.0f - 0.5f,
+                                    220.0f * powf(2.0f, (i * 7 % 24) / 12.0f)});
+    }
+    app.dimensions(800, 600);
+    app.initAudio(44100, 256, 2, 0);
+    app.start();
+    return 0;
+}
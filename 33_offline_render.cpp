@@ -0,0 +1,560 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "al/util/scene/al_SynthSequencer.hpp"
+
+#include "Gamma/Oscillator.h"
+#include "Gamma/Envelope.h"
+#include "Gamma/Domain.h"
+
+using namespace al;
+
+/*
+ * This tutorial shows how to render a SynthSequencer score to a file,
+ * faster than realtime, without an audio device.
+ *
+ * The renderer calls SynthSequencer::render(io) on an AudioIOData object
+ * that is not connected to a device, one block after the other, as fast as
+ * the CPU allows. Rendered blocks go into a ring of preallocated blocks,
+ * and a writer thread takes them from the ring and writes them to a 32 bit
+ * float WAV file, so rendering doesn't wait for the disk.
+ *
+ * With a single thread, the sequencer runs exactly as it does in the audio
+ * callback, with the same block size, so the file holds the same samples
+ * the audio callback would produce, on every render. Run with --check to
+ * render the same score twice and compare the files sample by sample.
+ *
+ * The score can also be split across threads by voices: each thread has
+ * its own SynthSequencer with a share of the events, and renders a chunk of
+ * blocks into its own buffer. The chunks are then added in the order of the
+ * threads, so the result is the same on every run, but it is not
+ * bit-identical to the single thread render, as floating point sums in a
+ * different order round differently. Splitting by time ranges is not done,
+ * because a voice that starts before the end of one range keeps sounding
+ * in the next.
+ *
+ * The sizes in a WAV header are 32 bit, so a file can hold at most 4 GB of
+ * samples (about 3.3 hours of stereo at 44.1 kHz). Longer renders are
+ * refused before they start, and write errors, such as a full disk, make
+ * the render fail instead of producing a truncated file silently.
+ *
+ * The score is either generated, or read from a .synthSequence file with
+ * SynthSequencer::playSequence(), such as the ones written by the event
+ * recorder tutorial. A file can't be split by voices, so it is always
+ * rendered with a single thread.
+ *
+ * Usage:
+ *
+ *   33_offline_render [file.wav] [threads] [score.synthSequence]
+ *   33_offline_render --check [threads]
+*/
+
+class WavWriter
+{
+public:
+    // The RIFF size (36 + data size) must fit in 32 bits
+    static const uint64_t MAX_DATA_BYTES = 0xFFFFFFFFull - 36;
+    static const long HEADER_BYTES = 44;
+
+    ~WavWriter() { close(); }
+
+    bool open(std::string fileName, int sampleRate, int channels) {
+        mFile = std::fopen(fileName.c_str(), "wb");
+        if (!mFile) {
+            return false;
+        }
+        mSampleRate = sampleRate;
+        mChannels = channels;
+        mDataBytes = 0;
+        mFailed = false;
+        writeHeader(); // The sizes are filled in by close()
+        return !mFailed;
+    }
+
+    /*
+     * Write interleaved samples. Returns false if they could not be
+     * written, or if they would make the file larger than a WAV file can
+     * be. Nothing else is written after a failure.
+     */
+    bool write(const float *samples, size_t numSamples) {
+        if (mFailed) {
+            return false;
+        }
+        uint64_t bytes = uint64_t(numSamples) * sizeof(float);
+        if (mDataBytes + bytes > MAX_DATA_BYTES) {
+            mFailed = true;
+            return false;
+        }
+        if (std::fwrite(samples, sizeof(float), numSamples, mFile) != numSamples) {
+            mFailed = true;
+            return false;
+        }
+        mDataBytes += bytes;
+        return true;
+    }
+
+    // Returns false if anything failed since open()
+    bool close() {
+        if (mFile) {
+            if (std::fseek(mFile, 0, SEEK_SET) != 0) {
+                mFailed = true;
+            } else {
+                writeHeader();
+            }
+            if (std::fclose(mFile) != 0) {
+                mFailed = true;
+            }
+            mFile = nullptr;
+        }
+        return !mFailed;
+    }
+
+private:
+    void writeBytes(const void *data, size_t size) {
+        if (std::fwrite(data, 1, size, mFile) != size) {
+            mFailed = true;
+        }
+    }
+
+    void write32(uint32_t value) {
+        uint8_t bytes[4] = {uint8_t(value), uint8_t(value >> 8), uint8_t(value >> 16), uint8_t(value >> 24)};
+        writeBytes(bytes, 4);
+    }
+
+    void write16(uint16_t value) {
+        uint8_t bytes[2] = {uint8_t(value), uint8_t(value >> 8)};
+        writeBytes(bytes, 2);
+    }
+
+    void writeHeader() {
+        writeBytes("RIFF", 4);
+        write32(uint32_t(36 + mDataBytes));
+        writeBytes("WAVEfmt ", 8);
+        write32(16);
+        write16(3); // IEEE float
+        write16(uint16_t(mChannels));
+        write32(uint32_t(mSampleRate));
+        write32(uint32_t(mSampleRate * mChannels * sizeof(float)));
+        write16(uint16_t(mChannels * sizeof(float)));
+        write16(32);
+        writeBytes("data", 4);
+        write32(uint32_t(mDataBytes));
+    }
+
+    std::FILE *mFile {nullptr};
+    int mSampleRate {44100};
+    int mChannels {2};
+    uint64_t mDataBytes {0};
+    bool mFailed {false};
+};
+
+
+// Reads back the samples of a file written by WavWriter
+bool readWavSamples(std::string fileName, std::vector<float> &samples)
+{
+    std::FILE *file = std::fopen(fileName.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+    bool ok = std::fseek(file, 0, SEEK_END) == 0;
+    long size = ok ? std::ftell(file) : -1;
+    ok = size >= WavWriter::HEADER_BYTES && std::fseek(file, WavWriter::HEADER_BYTES, SEEK_SET) == 0;
+    if (ok) {
+        samples.resize((size - WavWriter::HEADER_BYTES) / sizeof(float));
+        ok = std::fread(samples.data(), sizeof(float), samples.size(), file) == samples.size();
+    }
+    std::fclose(file);
+    return ok;
+}
+
+
+/*
+ * A ring of preallocated blocks between one producer and one consumer.
+ * Rendering is not realtime here, so it can wait on a lock.
+ */
+class BlockRing
+{
+public:
+    BlockRing(size_t numBlocks, size_t blockSize) :
+        mData(numBlocks * blockSize), mNumBlocks(numBlocks), mBlockSize(blockSize)
+    {}
+
+    size_t blockSize() const { return mBlockSize; }
+
+    float *beginWrite() {
+        std::unique_lock<std::mutex> lk(mLock);
+        mCondition.wait(lk, [this]() { return mWritten - mRead < mNumBlocks; });
+        return &mData[(mWritten % mNumBlocks) * mBlockSize];
+    }
+
+    void endWrite() {
+        std::unique_lock<std::mutex> lk(mLock);
+        mWritten++;
+        mCondition.notify_all();
+    }
+
+    // Returns nullptr when the ring is closed and empty
+    const float *beginRead() {
+        std::unique_lock<std::mutex> lk(mLock);
+        mCondition.wait(lk, [this]() { return mRead < mWritten || mClosed; });
+        if (mRead == mWritten) {
+            return nullptr;
+        }
+        return &mData[(mRead % mNumBlocks) * mBlockSize];
+    }
+
+    void endRead() {
+        std::unique_lock<std::mutex> lk(mLock);
+        mRead++;
+        mCondition.notify_all();
+    }
+
+    void close() {
+        std::unique_lock<std::mutex> lk(mLock);
+        mClosed = true;
+        mCondition.notify_all();
+    }
+
+private:
+    std::vector<float> mData;
+    size_t mNumBlocks;
+    size_t mBlockSize;
+    size_t mWritten {0};
+    size_t mRead {0};
+    bool mClosed {false};
+    std::mutex mLock;
+    std::condition_variable mCondition;
+};
+
+
+class OfflineRenderer
+{
+public:
+    // A function that adds the events of part "part" of "numParts" to a sequencer
+    typedef std::function<void(SynthSequencer &sequencer, int part, int numParts)> ScoreFunction;
+
+    OfflineRenderer(double sampleRate = 44100, int framesPerBuffer = 256, int channels = 2) :
+        mSampleRate(sampleRate), mFramesPerBuffer(framesPerBuffer), mChannels(channels)
+    {}
+
+    /*
+     * Render seconds of audio to fileName. With numThreads > 1 the score is
+     * split by voices. Returns the time it took in seconds, or a negative
+     * value if the file can't be written or would be too large.
+     */
+    double render(ScoreFunction score, std::string fileName, double seconds, int numThreads = 1) {
+        int numBlocks = int(seconds * mSampleRate / mFramesPerBuffer);
+        uint64_t dataBytes = uint64_t(numBlocks) * mFramesPerBuffer * mChannels * sizeof(float);
+        if (dataBytes > WavWriter::MAX_DATA_BYTES) {
+            std::cout << seconds << " s is too long for a WAV file" << std::endl;
+            return -1;
+        }
+        WavWriter wav;
+        if (!wav.open(fileName, int(mSampleRate), mChannels)) {
+            return -1;
+        }
+        BlockRing ring(64, mFramesPerBuffer * mChannels);
+        std::thread writer([&]() {
+            const float *block;
+            while ((block = ring.beginRead()) != nullptr) {
+                // After a failure, keep emptying the ring so rendering
+                // doesn't wait forever
+                wav.write(block, ring.blockSize());
+                ring.endRead();
+            }
+        });
+
+        auto start = std::chrono::high_resolution_clock::now();
+        if (numThreads <= 1) {
+            renderSingle(score, ring, numBlocks);
+        } else {
+            renderParallel(score, ring, numBlocks, numThreads);
+        }
+        ring.close();
+        writer.join();
+        if (!wav.close()) {
+            return -1;
+        }
+        std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+        return elapsed.count();
+    }
+
+private:
+    void setup(AudioIOData &io) {
+        io.framesPerSecond(mSampleRate);
+        io.framesPerBuffer(mFramesPerBuffer);
+        io.channelsOut(mChannels);
+    }
+
+    void interleave(AudioIOData &io, float *out) {
+        for (int channel = 0; channel < mChannels; channel++) {
+            const float *in = io.outBuffer(channel);
+            for (int i = 0; i < mFramesPerBuffer; i++) {
+                out[i * mChannels + channel] = in[i];
+            }
+        }
+    }
+
+    // Exactly what the audio callback does
+    void renderSingle(ScoreFunction score, BlockRing &ring, int numBlocks) {
+        SynthSequencer sequencer;
+        score(sequencer, 0, 1);
+        AudioIOData io;
+        setup(io);
+        for (int block = 0; block < numBlocks; block++) {
+            io.zeroOut();
+            io.frame(0);
+            sequencer.render(io);
+            interleave(io, ring.beginWrite());
+            ring.endWrite();
+        }
+    }
+
+    void renderParallel(ScoreFunction score, BlockRing &ring, int numBlocks, int numParts) {
+        const int chunkBlocks = 256;
+        const size_t blockSize = mFramesPerBuffer * mChannels;
+        struct Part {
+            SynthSequencer sequencer;
+            AudioIOData io;
+            std::vector<float> buffer;
+        };
+        std::vector<std::unique_ptr<Part>> parts;
+        for (int i = 0; i < numParts; i++) {
+            parts.emplace_back(new Part);
+            score(parts.back()->sequencer, i, numParts);
+            setup(parts.back()->io);
+            parts.back()->buffer.resize(chunkBlocks * blockSize);
+        }
+
+        for (int chunkStart = 0; chunkStart < numBlocks; chunkStart += chunkBlocks) {
+            int chunkSize = std::min(chunkBlocks, numBlocks - chunkStart);
+            std::vector<std::thread> threads;
+            for (auto &part: parts) {
+                Part *p = part.get();
+                threads.emplace_back([this, p, chunkSize, blockSize]() {
+                    for (int block = 0; block < chunkSize; block++) {
+                        p->io.zeroOut();
+                        p->io.frame(0);
+                        p->sequencer.render(p->io);
+                        interleave(p->io, p->buffer.data() + block * blockSize);
+                    }
+                });
+            }
+            for (auto &thread: threads) {
+                thread.join();
+            }
+            // Always add the parts in the same order
+            for (int block = 0; block < chunkSize; block++) {
+                float *out = ring.beginWrite();
+                std::copy(parts[0]->buffer.data() + block * blockSize,
+                          parts[0]->buffer.data() + (block + 1) * blockSize, out);
+                for (int i = 1; i < numParts; i++) {
+                    const float *in = parts[i]->buffer.data() + block * blockSize;
+                    for (size_t j = 0; j < blockSize; j++) {
+                        out[j] += in[j];
+                    }
+                }
+                ring.endWrite();
+            }
+        }
+    }
+
+    double mSampleRate;
+    int mFramesPerBuffer;
+    int mChannels;
+};
+
+
+// The voice from the event sequencer tutorial, without graphics
+class MyVoice : public SynthVoice {
+public:
+    MyVoice() {
+        mEnvelope.lengths(0.1f, 0.5f);
+        mEnvelope.levels(0, 1, 0);
+        mEnvelope.sustainPoint(1);
+    }
+
+    virtual void onProcess(AudioIOData &io) override {
+        while(io()) {
+            float sample = mEnvelope() * mSource() * 0.05;
+            io.out(0) += sample * (1.0f - mPan);
+            io.out(1) += sample * mPan;
+        }
+        if (mEnvelope.done()) {
+            free();
+        }
+    }
+
+    // Takes the same arguments as the tutorial's voice. y and size are
+    // only used for graphics there, but are kept so sequence files recorded
+    // with that voice can be played here.
+    void set(float x, float y, float size, float frequency, float attackTime, float releaseTime) {
+        mX = x;
+        mY = y;
+        mSize = size;
+        mPan = (x + 1.0f) * 0.5f;
+        mSource.freq(frequency);
+        mEnvelope.lengths()[0] = attackTime;
+        mEnvelope.lengths()[1] = releaseTime;
+    }
+
+    virtual bool setParamFields(float *pFields, int numFields) override {
+        if (numFields != 6) {
+            return false;
+        }
+        set(pFields[0], pFields[1], pFields[2], pFields[3], pFields[4], pFields[5]);
+        return true;
+    }
+
+    virtual int getParamFields(float *pFields, int maxParams = -1) override {
+        if (maxParams < 6) { return 0; }
+        pFields[0] = mX;
+        pFields[1] = mY;
+        pFields[2] = mSize;
+        pFields[3] = mSource.freq();
+        pFields[4] = mEnvelope.lengths()[0];
+        pFields[5] = mEnvelope.lengths()[1];
+        return 6;
+    }
+
+    virtual void onTriggerOn() override {
+        mEnvelope.reset();
+    }
+
+    virtual void onTriggerOff() override {
+        mEnvelope.release();
+    }
+
+private:
+    gam::Sine<> mSource;
+    gam::AD<> mEnvelope;
+    float mX {0};
+    float mY {0};
+    float mSize {0};
+    float mPan {0.5f};
+};
+
+
+/*
+ * The score from the event sequencer tutorial, repeated every two seconds
+ * with a different transposition. Event i goes to part i % numParts.
+ */
+void addScore(SynthSequencer &sequencer, int part, int numParts, double seconds)
+{
+    int event = 0;
+    auto add = [&](double time, double duration, float x, float y, float size,
+                   float frequency, float attack, float release) {
+        if (event++ % numParts == part) {
+            sequencer.add<MyVoice>(time, duration).set(x, y, size, frequency, attack, release);
+        }
+    };
+    for (double t = 0; t < seconds - 4.0; t += 2.0) {
+        float transpose = powf(2.0f, (int(t / 2) % 12) / 12.0f);
+        add(t + 0, 1, 0, 0, 0.5, 440 * transpose, 0.1, 0.5);
+        add(t + 0.5, 1, 0, 0.5, 0.5, 880 * transpose, 0.1, 0.5);
+        add(t + 1, 2, 0.5, 0.5, 0.7, 660 * transpose, 1.0, 0.05);
+        for (int i = 0; i < 6; i++) {
+            add(t + 1.1 + i * 0.1, 2, 0.6 - i * 0.1, 0.5 - i * 0.05, 0.7, (650 - i * 10) * transpose, 1.0, 2.0);
+        }
+    }
+}
+
+
+/*
+ * Renders the same score twice with the same number of threads and
+ * compares the two files sample by sample. Returns true if they match.
+ */
+bool checkRepeatable(OfflineRenderer &renderer, OfflineRenderer::ScoreFunction score,
+                     double seconds, int numThreads)
+{
+    std::vector<float> first, second;
+    bool ok = renderer.render(score, "offline_check_1.wav", seconds, numThreads) >= 0
+            && readWavSamples("offline_check_1.wav", first)
+            && renderer.render(score, "offline_check_2.wav", seconds, numThreads) >= 0
+            && readWavSamples("offline_check_2.wav", second);
+    std::remove("offline_check_1.wav");
+    std::remove("offline_check_2.wav");
+    if (!ok) {
+        std::cout << "Can't write the check files" << std::endl;
+        return false;
+    }
+    size_t differences = 0;
+    for (size_t i = 0; i < first.size() && i < second.size(); i++) {
+        // Compare the bits, so -0 and 0 or two NaNs are not taken as equal
+        if (std::memcmp(&first[i], &second[i], sizeof(float)) != 0) {
+            differences++;
+        }
+    }
+    bool identical = first.size() == second.size() && differences == 0;
+    std::cout << numThreads << " thread(s): " << first.size() << " samples, "
+              << (identical ? "identical" : "DIFFERENT") << " (" << differences
+              << " samples differ)" << std::endl;
+    return identical;
+}
+
+
+int main(int argc, char *argv[])
+{
+    gam::sampleRate(44100);
+    OfflineRenderer renderer(44100, 256, 2);
+
+    if (argc > 1 && std::string(argv[1]) == "--check") {
+        int numThreads = argc > 2 ? std::stoi(argv[2]) : 4;
+        const double seconds = 60;
+        auto score = [&](SynthSequencer &sequencer, int part, int numParts) {
+            addScore(sequencer, part, numParts, seconds);
+        };
+        bool single = checkRepeatable(renderer, score, seconds, 1);
+        bool parallel = checkRepeatable(renderer, score, seconds, numThreads);
+        return single && parallel ? 0 : 1;
+    }
+
+    std::string fileName = argc > 1 ? argv[1] : "offline.wav";
+    int numThreads = argc > 2 ? std::stoi(argv[2]) : 1;
+    std::string sequenceName = argc > 3 ? argv[3] : "";
+    const double seconds = 600;
+
+    OfflineRenderer::ScoreFunction score;
+    if (sequenceName.empty()) {
+        score = [&](SynthSequencer &sequencer, int part, int numParts) {
+            addScore(sequencer, part, numParts, seconds);
+        };
+    } else {
+        // playSequence() takes the name without the extension
+        const std::string extension = ".synthSequence";
+        if (sequenceName.size() > extension.size()
+                && sequenceName.compare(sequenceName.size() - extension.size(), extension.size(), extension) == 0) {
+            sequenceName.resize(sequenceName.size() - extension.size());
+        }
+        score = [&](SynthSequencer &sequencer, int /*part*/, int /*numParts*/) {
+            sequencer.synth().registerSynthClass<MyVoice>("MyVoice");
+            sequencer.playSequence(sequenceName);
+        };
+        if (numThreads > 1) {
+            std::cout << "A sequence file is rendered with a single thread" << std::endl;
+            numThreads = 1;
+        }
+    }
+
+    double elapsed = renderer.render(score, fileName, seconds, numThreads);
+
+    if (elapsed < 0) {
+        std::cout << "Can't write " << fileName << std::endl;
+        return 1;
+    }
+    std::cout << "Rendered " << seconds << " s to " << fileName << " with " << numThreads
+              << " thread(s) in " << elapsed << " s (" << seconds / elapsed << "x realtime)"
+              << std::endl;
+    return 0;
+}
@@ -0,0 +1,639 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <initializer_list>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <typeindex>
+#include <unordered_map>
+#include <vector>
+
+#include "al/core/app/al_App.hpp"
+#include "al/core/graphics/al_Shapes.hpp"
+#include "al/util/ui/al_Parameter.hpp"
+#include "al/util/ui/al_ControlGUI.hpp"
+
+#include "al/util/scene/al_SynthSequencer.hpp"
+
+#include "Gamma/Oscillator.h"
+#include "Gamma/Envelope.h"
+#include "Gamma/Domain.h"
+
+using namespace al;
+
+/*
+ * This tutorial shows how to send events to a PolySynth from any number of
+ * threads without locks.
+ *
+ * In the previous tutorials onKeyDown() gets a voice and triggers it from
+ * the graphics thread, while the audio thread renders the same PolySynth.
+ * OSC and network threads do the same. With an EventSubmitter, other threads
+ * only describe what they want as a Command and push it into a lock-free
+ * queue. The audio thread takes the commands out at the start of each block
+ * and is the only thread that touches the PolySynth.
+ *
+ * There are three commands:
+ *
+ *   triggerOn   gets a voice of a registered class, sets its parameter
+ *               fields and triggers it with an id
+ *   triggerOff  turns off the voices with an id
+ *   setField    changes one parameter field of the voices with an id that
+ *               are already sounding
+ *
+ * Commands carry a time in samples, counted from the start of audio. now()
+ * gives the time of the block being rendered, so threads can schedule
+ * ahead, e.g. now() + 4410 is a tenth of a second later. A time of 0, or a
+ * time that has passed, means as soon as possible. Trigger ons start on
+ * their exact sample, other commands are applied at the start of their
+ * block. Commands with the same time are applied in the order they were
+ * received.
+ *
+ * The queue is bounded, as described by Dmitry Vyukov: each cell has a
+ * sequence number that tells producers when it is free, and tells the
+ * consumer when it has been written. Producers claim cells with a
+ * compare-and-swap, and never wait for each other. If the queue is full
+ * the command is dropped and counted, so producers never block.
+ *
+ * The audio thread sorts the commands it takes in a list of the same size
+ * as the queue, and keeps those that are not due yet. When the list fills
+ * up with commands for later blocks, trigger ons and field changes are
+ * dropped and counted, but a quarter of the list is kept for turnoffs. A
+ * turnoff that still doesn't fit waits, with the commands behind it in the
+ * queue, until the next block. A turnoff is never dropped in the audio
+ * thread, so a note can't be left sounding.
+ *
+ * Voices are taken from the PolySynth in the audio thread, so allocate
+ * enough polyphony before starting audio.
+ *
+ * Run with "--benchmark" to stress the submitter with several producer
+ * threads and check the order the commands are applied in.
+*/
+
+template<class T>
+class MPSCQueue
+{
+public:
+    MPSCQueue(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        mCells = std::vector<Cell>(size);
+        mMask = size - 1;
+        for (size_t i = 0; i < size; i++) {
+            mCells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // Any thread may push. Returns false if the queue is full.
+    bool push(const T &value) {
+        size_t position = mTail.load(std::memory_order_relaxed);
+        while (true) {
+            Cell &cell = mCells[position & mMask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t) sequence - (intptr_t) position;
+            if (diff == 0) {
+                if (mTail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    cell.value = value;
+                    cell.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false; // Full
+            } else {
+                position = mTail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Only one thread may pop
+    bool pop(T &value) {
+        Cell &cell = mCells[mHead & mMask];
+        size_t sequence = cell.sequence.load(std::memory_order_acquire);
+        if ((intptr_t) sequence - (intptr_t) (mHead + 1) < 0) {
+            return false; // Empty
+        }
+        value = cell.value;
+        cell.sequence.store(mHead + mMask + 1, std::memory_order_release);
+        mHead++;
+        return true;
+    }
+
+    size_t capacity() const { return mCells.size(); }
+
+private:
+    struct Cell {
+        Cell() {}
+        Cell(const Cell &) {} // Only needed to build the vector
+        std::atomic<size_t> sequence {0};
+        T value;
+    };
+
+    std::vector<Cell> mCells;
+    size_t mMask;
+    // Producers and the consumer write to different cache lines
+    alignas(64) std::atomic<size_t> mTail {0};
+    alignas(64) size_t mHead {0};
+};
+
+
+struct Command {
+    static const int MAX_FIELDS = 8;
+    enum Type : uint8_t { TRIGGER_ON, TRIGGER_OFF, SET_FIELD };
+
+    Type type;
+    uint8_t numFields; // For TRIGGER_ON
+    uint16_t index; // Voice class for TRIGGER_ON, field for SET_FIELD
+    int32_t id;
+    uint32_t order; // Set by the audio thread
+    uint64_t time; // In samples
+    float fields[MAX_FIELDS];
+};
+
+
+class EventSubmitter
+{
+public:
+    EventSubmitter(PolySynth &synth, size_t capacity = 4096) :
+        mSynth(synth), mQueue(capacity), mOffReserve(capacity / 4)
+    {
+        mPending.reserve(capacity);
+    }
+
+    // Register each voice class before audio starts
+    template<class VoiceType>
+    void registerVoice() {
+        mClassIndex[std::type_index(typeid(VoiceType))] = uint16_t(mFactories.size());
+        mFactories.push_back([this]() -> SynthVoice * { return mSynth.getVoice<VoiceType>(); });
+    }
+
+    // The time of the block being rendered, in samples
+    uint64_t now() const { return mTime.load(std::memory_order_acquire); }
+
+    /*
+     * These can be called from any thread. They return false if the command
+     * was dropped because the queue is full.
+     */
+    template<class VoiceType>
+    bool triggerOn(int id, std::initializer_list<float> fields, uint64_t time = 0) {
+        Command command;
+        command.type = Command::TRIGGER_ON;
+        command.index = mClassIndex.at(std::type_index(typeid(VoiceType)));
+        command.numFields = uint8_t(std::min(int(fields.size()), int(Command::MAX_FIELDS)));
+        std::copy(fields.begin(), fields.begin() + command.numFields, command.fields);
+        command.id = id;
+        command.time = time;
+        return submit(command);
+    }
+
+    bool triggerOff(int id, uint64_t time = 0) {
+        Command command;
+        command.type = Command::TRIGGER_OFF;
+        command.id = id;
+        command.time = time;
+        return submit(command);
+    }
+
+    bool setField(int id, int fieldIndex, float value, uint64_t time = 0) {
+        Command command;
+        command.type = Command::SET_FIELD;
+        command.index = uint16_t(fieldIndex);
+        command.fields[0] = value;
+        command.id = id;
+        command.time = time;
+        return submit(command);
+    }
+
+    // Call from onSound() before rendering the PolySynth
+    void process(AudioIOData &io) {
+        uint64_t blockStart = mTime.load(std::memory_order_relaxed);
+        uint64_t blockEnd = blockStart + io.framesPerBuffer();
+
+        // When the list fills up, apply what is due and take more, up to
+        // the size of the queue. Commands only get dropped when commands
+        // for later blocks fill the list.
+        size_t popped = 0;
+        bool clogged = false;
+        while (true) {
+            bool waiting = take(popped, clogged);
+            applyDue(blockStart, blockEnd);
+            if (!waiting || popped >= mQueue.capacity()) {
+                break;
+            }
+            clogged = mPending.size() + mOffReserve >= mPending.capacity();
+            if (mPending.size() == mPending.capacity()) {
+                break; // Only turnoffs wait, until the next block
+            }
+        }
+        mTime.store(blockEnd, std::memory_order_release);
+    }
+
+    uint64_t dropped() const { return mDropped; }
+
+private:
+    /*
+     * Move commands from the queue to mPending until the queue is empty or
+     * a command doesn't fit. That command waits, and true is returned. Only
+     * turnoffs may use the last mOffReserve places. If clogged, the other
+     * commands that don't fit are dropped instead of waiting.
+     */
+    bool take(size_t &popped, bool clogged) {
+        // Never grow the vector in the audio thread
+        Command command;
+        while (popped < mQueue.capacity()) {
+            if (mHasWaiting) {
+                command = mWaiting;
+                mHasWaiting = false;
+            } else if (mQueue.pop(command)) {
+                popped++;
+            } else {
+                return false;
+            }
+            size_t room = mPending.capacity() - mPending.size();
+            if (room == 0 || (command.type != Command::TRIGGER_OFF && room <= mOffReserve)) {
+                if (clogged && command.type != Command::TRIGGER_OFF) {
+                    mDropped++;
+                    continue;
+                }
+                mWaiting = command;
+                mHasWaiting = true;
+                return true;
+            }
+            command.order = mOrder++;
+            mPending.push_back(command);
+        }
+        return true;
+    }
+
+    void applyDue(uint64_t blockStart, uint64_t blockEnd) {
+        // std::sort doesn't allocate. Pending lists are short.
+        std::sort(mPending.begin(), mPending.end(), [](const Command &a, const Command &b) {
+            return a.time < b.time || (a.time == b.time && int32_t(a.order - b.order) < 0);
+        });
+        size_t due = 0;
+        while (due < mPending.size() && mPending[due].time < blockEnd) {
+            const Command &c = mPending[due];
+            apply(c, c.time > blockStart ? int(c.time - blockStart) : 0);
+            due++;
+        }
+        mPending.erase(mPending.begin(), mPending.begin() + due);
+    }
+
+    bool submit(const Command &command) {
+        if (!mQueue.push(command)) {
+            mDropped++;
+            return false;
+        }
+        return true;
+    }
+
+    void apply(const Command &c, int offset) {
+        switch (c.type) {
+        case Command::TRIGGER_ON: {
+            SynthVoice *voice = mFactories[c.index]();
+            voice->setParamFields(const_cast<float *>(c.fields), c.numFields);
+            mSynth.triggerOn(voice, offset, c.id);
+            break;
+        }
+        case Command::TRIGGER_OFF:
+            mSynth.triggerOff(c.id);
+            break;
+        case Command::SET_FIELD: {
+            // Voices triggered in this block are not in the active list yet
+            float fields[Command::MAX_FIELDS];
+            for (SynthVoice *voice = mSynth.getActiveVoices(); voice; voice = voice->next) {
+                if (voice->id() == c.id) {
+                    int numFields = voice->getParamFields(fields, Command::MAX_FIELDS);
+                    if (c.index < numFields) {
+                        fields[c.index] = c.fields[0];
+                        voice->setParamFields(fields, numFields);
+                    }
+                }
+            }
+            break;
+        }
+        }
+    }
+
+    PolySynth &mSynth;
+    MPSCQueue<Command> mQueue;
+    // Only used by the audio thread
+    std::vector<Command> mPending;
+    size_t mOffReserve;
+    Command mWaiting; // Taken from the queue, but didn't fit in mPending
+    bool mHasWaiting {false};
+    uint32_t mOrder {0};
+    std::atomic<uint64_t> mTime {0};
+    std::atomic<uint64_t> mDropped {0};
+    // Written before audio starts, read only afterwards
+    std::vector<std::function<SynthVoice *()>> mFactories;
+    std::unordered_map<std::type_index, uint16_t> mClassIndex;
+};
+
+
+class MyVoice : public SynthVoice {
+public:
+    MyVoice() {
+        addCone(mesh); // Prepare mesh to draw a cone
+
+        mEnvelope.lengths(0.1f,  0.5f);
+        mEnvelope.levels(0, 1, 0);
+        mEnvelope.sustainPoint(1);
+
+        mFrequency.registerChangeCallback([this](float value) {mSource.freq(value);});
+        mAttack.registerChangeCallback([this](float value) {mEnvelope.lengths()[0] = value;});
+        mRelease.registerChangeCallback([this](float value) {mEnvelope.lengths()[2] = value;});
+
+        // The fields used by triggerOn() and setField(), in this order
+        *this << mX << mY << mSize << mFrequency << mAttack << mRelease;
+    }
+
+    virtual void onProcess(AudioIOData &io) override {
+        while(io()) {
+            io.out(0) += mEnvelope() * mSource() * 0.05;
+        }
+        if (mEnvelope.done()) {
+            free();
+        }
+    }
+
+    virtual void onProcess(Graphics &g) {
+        g.pushMatrix();
+        g.translate(mX, mY, 0);
+        g.scale(mSize * mEnvelope.value());
+        g.draw(mesh);
+        g.popMatrix();
+    }
+
+    virtual void onTriggerOn() override {
+        mEnvelope.reset();
+    }
+
+    virtual void onTriggerOff() override {
+        mEnvelope.release();
+    }
+
+private:
+    gam::Sine<> mSource;
+    gam::AD<> mEnvelope;
+
+    Mesh mesh;
+
+    Parameter mX {"X", "", 0};
+    Parameter mY {"Y", "", 0};
+    Parameter mSize {"Size", "", 1.0};
+    Parameter mFrequency {"Frequency", "", 0.0};
+    Parameter mAttack {"Attack", "", 0.0};
+    Parameter mRelease {"Release", "", 0.0};
+};
+
+
+class MyApp : public App
+{
+public:
+
+    virtual void onCreate() override {
+        nav().pos(Vec3d(0,0,8)); // Set the camera to view the scene
+
+        gui << X << Y << AttackTime << ReleaseTime; // Register the parameters with the GUI
+        gui.init(); // Initialize GUI. Don't forget this!
+        navControl().active(false);
+
+        // Moving the X slider moves every sounding voice from the GUI thread
+        X.registerChangeCallback([this](float value) {
+            for (int midiNote: mHeldNotes) {
+                submitter.setField(midiNote, 0, value);
+            }
+        });
+
+        // Another thread that plays an arpeggio, scheduled ahead of time
+        mArpeggiator = std::thread([this]() {
+            int step = 0;
+            while (mRunning) {
+                uint64_t start = submitter.now() + 4410;
+                float freq = 220.0f * powf(2.0f, (step * 5 % 24) / 12.0f);
+                submitter.triggerOn<MyVoice>(1000, {-1.5f, 1.0f, 0.3f, freq, 0.01f, 0.2f}, start);
+                submitter.triggerOff(1000, start + 2205);
+                step++;
+                std::this_thread::sleep_for(std::chrono::milliseconds(250));
+            }
+        });
+    }
+
+    virtual void onExit() override {
+        mRunning = false;
+        mArpeggiator.join();
+        if (submitter.dropped() > 0) {
+            std::cout << submitter.dropped() << " commands dropped" << std::endl;
+        }
+    }
+
+    virtual void onDraw(Graphics &g) override
+    {
+        g.clear();
+        mPolySynth.render(g);
+        gui.draw(g);
+    }
+
+    virtual void onSound(AudioIOData &io) override {
+        submitter.process(io); // The only place the PolySynth is changed
+        mPolySynth.render(io);
+    }
+
+    virtual void onKeyDown(const Keyboard& k) override
+    {
+        int midiNote = asciiToMIDI(k.key());
+        float freq = 440.0f * powf(2, (midiNote - 69)/12.0f);
+        submitter.triggerOn<MyVoice>(midiNote, {X.get(), Y.get(), 0.5f, freq,
+                                                AttackTime.get(), ReleaseTime.get()});
+        mHeldNotes.push_back(midiNote);
+    }
+
+    virtual void onKeyUp(const Keyboard &k) override {
+        int midiNote = asciiToMIDI(k.key());
+        submitter.triggerOff(midiNote);
+        mHeldNotes.erase(std::remove(mHeldNotes.begin(), mHeldNotes.end(), midiNote), mHeldNotes.end());
+    }
+
+    PolySynth mPolySynth;
+    EventSubmitter submitter {mPolySynth};
+
+private:
+    Parameter X {"X", "Position", 0.0, "", -1.0f, 1.0f};
+    Parameter Y {"Y", "Position", 0.0, "", -1.0f, 1.0f};
+    Parameter AttackTime {"AttackTime", "Sound", 0.1, "", 0.001f, 2.0f};
+    Parameter ReleaseTime {"ReleaseTime", "Sound", 1.0, "", 0.001f, 5.0f};
+
+    std::vector<int> mHeldNotes; // Only used by the graphics thread
+    std::thread mArpeggiator;
+    std::atomic<bool> mRunning {true};
+
+    ControlGUI gui;
+};
+
+
+// Plays nothing, only remembers the first field it was triggered with
+class CheckVoice : public SynthVoice {
+public:
+    virtual bool setParamFields(float *pFields, int numFields) override {
+        mSequence = numFields > 0 ? uint64_t(pFields[0]) : 0;
+        return true;
+    }
+
+    virtual void onProcess(AudioIOData & /*io*/) override { free(); }
+
+    uint64_t sequence() const { return mSequence; }
+
+private:
+    uint64_t mSequence {0};
+};
+
+
+/*
+ * Several producer threads submit commands as fast as they can while this
+ * thread runs EventSubmitter::process() and renders the PolySynth, as the
+ * audio thread would. Each producer alternates trigger ons, numbered in
+ * their first field, and turnoffs for its own id. The PolySynth's trigger
+ * callbacks check that nothing is lost and that every producer's commands
+ * are applied in the order they were submitted.
+ *
+ * Then the pending list is filled with notes far in the future, to check
+ * that turnoffs submitted afterwards are still applied.
+ */
+void runBenchmark()
+{
+    const int numProducers = std::max(2, int(std::thread::hardware_concurrency()) - 1);
+    const uint64_t perProducer = 1000000;
+
+    AudioIOData io;
+    io.framesPerSecond(44100);
+    io.framesPerBuffer(256);
+    io.channelsOut(2);
+
+    PolySynth synth;
+    synth.allocatePolyphony<CheckVoice>(1024);
+    EventSubmitter submitter(synth, 4096);
+    submitter.registerVoice<CheckVoice>();
+
+    // The next command expected from each producer. Even numbers are
+    // trigger ons, odd numbers turnoffs.
+    std::vector<uint64_t> expected(numProducers, 0);
+    uint64_t applied = 0, outOfOrder = 0;
+    synth.registerTriggerOnCallback([&](SynthVoice *voice, int /*offset*/, int id, void * /*userData*/) {
+        uint64_t sequence = static_cast<CheckVoice *>(voice)->sequence();
+        if (sequence != expected[id]) {
+            outOfOrder++;
+        }
+        expected[id] = sequence + 1;
+        applied++;
+        return true;
+    });
+    synth.registerTriggerOffCallback([&](int id) {
+        if (expected[id] % 2 != 1) {
+            outOfOrder++;
+        }
+        expected[id]++;
+        applied++;
+        return true;
+    });
+
+    std::vector<uint64_t> fullCount(numProducers, 0);
+    std::vector<std::vector<double>> pushTimes(numProducers);
+    std::atomic<int> finished {0};
+
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<std::thread> producers;
+    for (int p = 0; p < numProducers; p++) {
+        producers.emplace_back([&, p]() {
+            pushTimes[p].reserve(perProducer);
+            for (uint64_t i = 0; i < perProducer; i++) {
+                while (true) {
+                    auto pushStart = std::chrono::high_resolution_clock::now();
+                    bool pushed = i % 2 == 0 ? submitter.triggerOn<CheckVoice>(p, {float(i)})
+                                             : submitter.triggerOff(p);
+                    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - pushStart;
+                    if (pushed) {
+                        pushTimes[p].push_back(elapsed.count());
+                        break;
+                    }
+                    fullCount[p]++;
+                    std::this_thread::yield();
+                }
+            }
+            finished++;
+        });
+    }
+
+    const uint64_t total = numProducers * perProducer;
+    uint64_t blocks = 0;
+    while (applied < total) { // Producers retry, so every command arrives
+        bool producing = finished < numProducers;
+        uint64_t before = applied;
+        submitter.process(io);
+        synth.render(io);
+        blocks++;
+        if (!producing && applied == before) {
+            break; // Commands were lost
+        }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+    for (auto &producer: producers) {
+        producer.join();
+    }
+
+    std::vector<double> allTimes;
+    uint64_t full = 0;
+    for (int p = 0; p < numProducers; p++) {
+        allTimes.insert(allTimes.end(), pushTimes[p].begin(), pushTimes[p].end());
+        full += fullCount[p];
+    }
+    std::sort(allTimes.begin(), allTimes.end());
+    std::cout << numProducers << " producers: applied " << applied << " of "
+              << total << " commands in " << blocks << " blocks, " << outOfOrder << " out of order, "
+              << full << " submits found the queue full" << std::endl;
+    std::cout << "Throughput " << applied / elapsed.count() / 1e6 << " M commands/s" << std::endl;
+    std::cout << "Submit time ns: median " << allTimes[allTimes.size() / 2] * 1e9
+              << " p99 " << allTimes[size_t(allTimes.size() * 0.99)] * 1e9
+              << " worst " << allTimes.back() * 1e9 << std::endl;
+
+    const int capacity = 64;
+    PolySynth fullSynth;
+    EventSubmitter fullSubmitter(fullSynth, capacity);
+    fullSubmitter.registerVoice<CheckVoice>();
+    int offsApplied = 0;
+    fullSynth.registerTriggerOffCallback([&](int /*id*/) {
+        offsApplied++;
+        return true;
+    });
+    for (int i = 0; i < capacity; i++) {
+        fullSubmitter.triggerOn<CheckVoice>(i, {0.0f}, uint64_t(1) << 40);
+    }
+    fullSubmitter.process(io);
+    for (int i = 0; i < capacity; i++) {
+        fullSubmitter.triggerOff(i);
+    }
+    for (int block = 0; block < 100 && offsApplied < capacity; block++) {
+        fullSubmitter.process(io);
+    }
+    std::cout << "Pending list full: " << offsApplied << " of " << capacity << " turnoffs applied, "
+              << fullSubmitter.dropped() << " trigger ons dropped" << std::endl;
+}
+
+
+int main(int argc, char *argv[])
+{
+    gam::sampleRate(44100);
+    if (argc > 1 && std::string(argv[1]) == "--benchmark") {
+        runBenchmark();
+        return 0;
+    }
+    MyApp app;
+    app.submitter.registerVoice<MyVoice>();
+    app.mPolySynth.allocatePolyphony<MyVoice>(64);
+    app.dimensions(800, 600);
+    app.initAudio(44100, 256, 2, 0);
+    app.start();
+    return 0;
+}
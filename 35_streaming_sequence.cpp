@@ -0,0 +1,536 @@
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <queue>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "al/core/app/al_App.hpp"
+#include "al/core/graphics/al_Shapes.hpp"
+#include "al/util/ui/al_Parameter.hpp"
+
+#include "al/util/scene/al_SynthSequencer.hpp"
+
+#include "Gamma/Oscillator.h"
+#include "Gamma/Envelope.h"
+#include "Gamma/Domain.h"
+
+using namespace al;
+
+/*
+ * This tutorial shows how to play .synthSequence files of any length
+ * without loading them first.
+ *
+ * SynthSequencer reads the whole file before playing it, which takes a
+ * while and a lot of memory for recordings that last hours. The
+ * SequenceStreamer reads the file in a background thread while it plays.
+ * The thread only reads ahead of the playhead by a window of a few
+ * seconds, and hands the events to the audio thread through a fixed size
+ * ring. Playback starts as soon as the first lines are read, and memory
+ * doesn't depend on the length of the file.
+ *
+ * It reads the commands described in the event recorder tutorial:
+ *
+ *   @ absTime duration synthName pFields...
+ *   + absTime eventId synthName pFields...
+ *   - absTime eventId
+ *   t absTime tempoBpm
+ *
+ * Times are in beats. The tempo is 60 bpm until a "t" line changes it, so
+ * by default beats are seconds. Lines must be sorted by time, as
+ * SynthRecorder writes them; an event that comes before the previous one
+ * plays as soon as possible. The turnoffs of "@" events are kept in a heap
+ * in the reading thread until their time comes, so the heap only holds the
+ * notes that are sounding.
+ *
+ * Voice classes must be registered with the streamer before playing.
+ * Events for other classes are skipped and counted. If the reader falls
+ * behind, events play late and are counted.
+ *
+ * Run with a file name to play it, or without to play a generated file.
+ * Run with "--benchmark" to write a sequence of a million events and stream
+ * it faster than realtime, then stream a denser sequence at realtime, as
+ * the audio thread would. Both runs report the events that played late.
+*/
+
+struct StreamEvent {
+    static const int MAX_FIELDS = 16;
+    enum Type : uint8_t { TRIGGER_ON, TRIGGER_OFF };
+
+    Type type;
+    uint8_t numFields;
+    uint16_t classIndex;
+    int32_t id;
+    uint64_t time; // In samples
+    float fields[MAX_FIELDS];
+};
+
+
+// A ring for one producer and one consumer thread
+template<class T>
+class SPSCRing
+{
+public:
+    SPSCRing(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        mData.resize(size);
+        mMask = size - 1;
+    }
+
+    bool push(const T &value) {
+        size_t tail = mTail.load(std::memory_order_relaxed);
+        if (tail - mHead.load(std::memory_order_acquire) == mData.size()) {
+            return false;
+        }
+        mData[tail & mMask] = value;
+        mTail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // The oldest value, or nullptr if the ring is empty
+    const T *front() const {
+        size_t head = mHead.load(std::memory_order_relaxed);
+        if (head == mTail.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        return &mData[head & mMask];
+    }
+
+    void pop() { mHead.store(mHead.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    size_t size() const { return mTail.load(std::memory_order_acquire) - mHead.load(std::memory_order_acquire); }
+    size_t capacity() const { return mData.size(); }
+
+private:
+    std::vector<T> mData;
+    size_t mMask;
+    alignas(64) std::atomic<size_t> mTail {0};
+    alignas(64) std::atomic<size_t> mHead {0};
+};
+
+
+class SequenceStreamer
+{
+public:
+    SequenceStreamer(double sampleRate, double windowSeconds = 2.0, size_t ringSize = 4096) :
+        mSampleRate(sampleRate), mWindow(uint64_t(windowSeconds * sampleRate)), mRing(ringSize)
+    {}
+
+    ~SequenceStreamer() { stop(); }
+
+    PolySynth &synth() { return mSynth; }
+
+    // Register each voice class before playing
+    template<class VoiceType>
+    void registerVoice(std::string name) {
+        mSynth.registerSynthClass<VoiceType>(name);
+        mClassIndex[name] = uint16_t(mFactories.size());
+        mFactories.push_back([this]() -> SynthVoice * { return mSynth.getVoice<VoiceType>(); });
+    }
+
+    /*
+     * Start reading fileName in the background. Its time 0 is the current
+     * playhead. Returns false if the file can't be opened.
+     */
+    bool play(std::string fileName) {
+        stop();
+        std::shared_ptr<std::ifstream> file = std::make_shared<std::ifstream>(fileName);
+        if (!file->is_open()) {
+            return false;
+        }
+        mRunning = true;
+        mFinished = false;
+        mReader = std::thread([this, file]() {
+            read(*file);
+            mFinished = true;
+        });
+        return true;
+    }
+
+    // Stop reading. Events already in the ring still play.
+    void stop() {
+        mRunning = false;
+        if (mReader.joinable()) {
+            mReader.join();
+        }
+    }
+
+    // True when the whole file has been read and played
+    bool finished() const { return mFinished && mRing.size() == 0; }
+
+    void render(AudioIOData &io) {
+        uint64_t blockStart = mPlayhead.load(std::memory_order_relaxed);
+        uint64_t blockEnd = blockStart + io.framesPerBuffer();
+        popDue(blockEnd, [&](const StreamEvent &event) {
+            apply(event, event.time > blockStart ? int(event.time - blockStart) : 0);
+        });
+        mSynth.render(io);
+        mPlayhead.store(blockEnd, std::memory_order_release);
+    }
+
+    void render(Graphics &g) { mSynth.render(g); }
+
+    // Pass the events due before time to function, in order
+    template<class Function>
+    void popDue(uint64_t time, Function function) {
+        uint64_t blockStart = mPlayhead.load(std::memory_order_relaxed);
+        const StreamEvent *event;
+        while ((event = mRing.front()) != nullptr && event->time < time) {
+            if (event->time < blockStart) {
+                mLate++;
+            }
+            function(*event);
+            mRing.pop();
+        }
+    }
+
+    // For driving the streamer without a PolySynth
+    void advance(uint64_t samples) { mPlayhead.store(mPlayhead.load() + samples, std::memory_order_release); }
+
+    size_t eventsInMemory() const { return mRing.size() + mPendingOffs; }
+    uint64_t late() const { return mLate; }
+    uint64_t skipped() const { return mSkipped; }
+
+private:
+    struct PendingOff {
+        uint64_t time;
+        int32_t id;
+        bool operator>(const PendingOff &other) const { return time > other.time; }
+    };
+
+    void read(std::ifstream &file) {
+        uint64_t start = mPlayhead.load(std::memory_order_acquire);
+        double beatsAtChange = 0, secondsAtChange = 0, secondsPerBeat = 1;
+        auto toSamples = [&](double beats) {
+            double seconds = secondsAtChange + (beats - beatsAtChange) * secondsPerBeat;
+            return start + uint64_t(std::max(0.0, seconds) * mSampleRate);
+        };
+        std::priority_queue<PendingOff, std::vector<PendingOff>, std::greater<PendingOff>> offs;
+        int32_t nextId = 1 << 24; // Ids for "@" events, above the ids of recorded notes
+        std::vector<const char *> tokens;
+        std::string line;
+
+        while (mRunning && std::getline(file, line)) {
+            tokenize(line, tokens);
+            if (tokens.size() < 2 || tokens[0][1] != '\0') {
+                continue;
+            }
+            char command = tokens[0][0];
+            double beats = std::atof(tokens[1]);
+            if (command == 't' && tokens.size() >= 3) {
+                secondsAtChange += (beats - beatsAtChange) * secondsPerBeat;
+                beatsAtChange = beats;
+                secondsPerBeat = 60.0 / std::atof(tokens[2]);
+                continue;
+            }
+            StreamEvent event;
+            event.time = toSamples(beats);
+            if (command == '-' && tokens.size() >= 3) {
+                event.type = StreamEvent::TRIGGER_OFF;
+                event.id = std::atoi(tokens[2]);
+            } else if ((command == '@' || command == '+') && tokens.size() >= 4) {
+                auto classIndex = mClassIndex.find(tokens[3]);
+                if (classIndex == mClassIndex.end()) {
+                    mSkipped++;
+                    continue;
+                }
+                event.type = StreamEvent::TRIGGER_ON;
+                event.classIndex = classIndex->second;
+                event.numFields = uint8_t(std::min(int(tokens.size()) - 4, int(StreamEvent::MAX_FIELDS)));
+                for (int i = 0; i < event.numFields; i++) {
+                    event.fields[i] = float(std::atof(tokens[4 + i]));
+                }
+                if (command == '@') {
+                    event.id = nextId++;
+                    offs.push({toSamples(beats + std::atof(tokens[2])), event.id});
+                } else {
+                    event.id = std::atoi(tokens[2]);
+                }
+            } else {
+                continue;
+            }
+            // Turnoffs that come first go first
+            while (!offs.empty() && offs.top().time <= event.time && mRunning) {
+                emitOff(offs.top());
+                offs.pop();
+            }
+            mPendingOffs = offs.size();
+            emit(event);
+        }
+        while (!offs.empty() && mRunning) {
+            emitOff(offs.top());
+            offs.pop();
+        }
+        mPendingOffs = 0;
+    }
+
+    void emitOff(const PendingOff &off) {
+        StreamEvent event;
+        event.type = StreamEvent::TRIGGER_OFF;
+        event.id = off.id;
+        event.time = off.time;
+        emit(event);
+    }
+
+    // Wait until the event is inside the window and there is room for it
+    void emit(const StreamEvent &event) {
+        while (mRunning) {
+            if (event.time < mPlayhead.load(std::memory_order_acquire) + mWindow && mRing.push(event)) {
+                return;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+    }
+
+    // Split line at whitespace, in place
+    static void tokenize(std::string &line, std::vector<const char *> &tokens) {
+        tokens.clear();
+        char *c = &line[0];
+        char *end = c + line.size();
+        while (c < end) {
+            while (c < end && isspace(*c)) {
+                *c++ = '\0';
+            }
+            if (c < end) {
+                tokens.push_back(c);
+            }
+            while (c < end && !isspace(*c)) {
+                c++;
+            }
+        }
+    }
+
+    void apply(const StreamEvent &event, int offset) {
+        if (event.type == StreamEvent::TRIGGER_OFF) {
+            mSynth.triggerOff(event.id);
+            return;
+        }
+        SynthVoice *voice = mFactories[event.classIndex]();
+        voice->setParamFields(const_cast<float *>(event.fields), event.numFields);
+        mSynth.triggerOn(voice, offset, event.id);
+    }
+
+    double mSampleRate;
+    uint64_t mWindow;
+    PolySynth mSynth;
+    SPSCRing<StreamEvent> mRing;
+    std::thread mReader;
+    std::atomic<bool> mRunning {false};
+    std::atomic<bool> mFinished {true};
+    std::atomic<uint64_t> mPlayhead {0};
+    std::atomic<size_t> mPendingOffs {0};
+    std::atomic<uint64_t> mLate {0};
+    std::atomic<uint64_t> mSkipped {0};
+    // Written before playing, read only afterwards
+    std::vector<std::function<SynthVoice *()>> mFactories;
+    std::unordered_map<std::string, uint16_t> mClassIndex;
+};
+
+
+class MyVoice : public SynthVoice {
+public:
+    MyVoice() {
+        addCone(mesh); // Prepare mesh to draw a cone
+
+        mEnvelope.lengths(0.1f,  0.5f);
+        mEnvelope.levels(0, 1, 0);
+        mEnvelope.sustainPoint(1);
+
+        mFrequency.registerChangeCallback([this](float value) {mSource.freq(value);});
+        mAttack.registerChangeCallback([this](float value) {mEnvelope.lengths()[0] = value;});
+        mRelease.registerChangeCallback([this](float value) {mEnvelope.lengths()[2] = value;});
+
+        *this << mX << mY << mSize << mFrequency << mAttack << mRelease;
+    }
+
+    virtual void onProcess(AudioIOData &io) override {
+        while(io()) {
+            io.out(0) += mEnvelope() * mSource() * 0.05;
+        }
+        if (mEnvelope.done()) {
+            free();
+        }
+    }
+
+    virtual void onProcess(Graphics &g) {
+        g.pushMatrix();
+        g.translate(mX, mY, 0);
+        g.scale(mSize * mEnvelope.value());
+        g.draw(mesh);
+        g.popMatrix();
+    }
+
+    virtual void onTriggerOn() override {
+        mEnvelope.reset();
+    }
+
+    virtual void onTriggerOff() override {
+        mEnvelope.release();
+    }
+
+private:
+    gam::Sine<> mSource;
+    gam::AD<> mEnvelope;
+
+    Mesh mesh;
+
+    Parameter mX {"X", "", 0};
+    Parameter mY {"Y", "", 0};
+    Parameter mSize {"Size", "", 1.0};
+    Parameter mFrequency {"Frequency", "", 0.0};
+    Parameter mAttack {"Attack", "", 0.0};
+    Parameter mRelease {"Release", "", 0.0};
+};
+
+
+class MyApp : public App
+{
+public:
+
+    virtual void onCreate() override {
+        nav().pos(Vec3d(0,0,8)); // Set the camera to view the scene
+        if (!streamer.play(fileName)) {
+            std::cout << "Can't open " << fileName << std::endl;
+        }
+    }
+
+    virtual void onDraw(Graphics &g) override
+    {
+        g.clear();
+        streamer.render(g);
+    }
+
+    virtual void onSound(AudioIOData &io) override {
+        streamer.render(io);
+    }
+
+    virtual void onExit() override {
+        streamer.stop();
+        std::cout << "Late events: " << streamer.late()
+                  << " skipped: " << streamer.skipped() << std::endl;
+    }
+
+    std::string fileName;
+    SequenceStreamer streamer {44100};
+};
+
+
+// A long sequence: an arpeggio of "@" events, with a tempo change halfway
+void writeSequence(std::string fileName, int numEvents, double spacing = 0.1)
+{
+    std::ofstream file(fileName);
+    for (int i = 0; i < numEvents; i++) {
+        if (i == numEvents / 2) {
+            file << "t " << i * spacing << " 90" << std::endl;
+        }
+        float step = float(i % 16);
+        file << "@ " << i * spacing << " " << spacing * 0.8 << " MyVoice " << step / 8.0f - 1.0f << " "
+             << float(i % 5) / 5.0f - 0.5f << " 0.3 " << 220.0f * powf(2.0f, (i * 7 % 24) / 12.0f)
+             << " 0.01 0.1" << std::endl;
+    }
+}
+
+
+/*
+ * Streams a million events, advancing the playhead a block at a time as
+ * fast as possible, without a PolySynth. The playhead doesn't wait for the
+ * reader, so events can play late when the reader falls behind. Then
+ * streams a sequence of a thousand events per second, advancing a block
+ * every block duration, as an audio callback would.
+ */
+void runBenchmark()
+{
+    const int numEvents = 1000000;
+    const double sampleRate = 44100;
+    const int blockSize = 256;
+    std::string fileName = "streaming_benchmark.synthSequence";
+    writeSequence(fileName, numEvents);
+
+    SequenceStreamer streamer(sampleRate);
+    streamer.registerVoice<MyVoice>("MyVoice");
+    auto start = std::chrono::high_resolution_clock::now();
+    streamer.play(fileName);
+
+    std::chrono::duration<double> firstEvent {0};
+    uint64_t ons = 0, offs = 0, time = 0, lastEvent = 0;
+    size_t maxInMemory = 0;
+    while (!streamer.finished()) {
+        time += blockSize;
+        streamer.popDue(time, [&](const StreamEvent &event) {
+            if (ons == 0) {
+                firstEvent = std::chrono::high_resolution_clock::now() - start;
+            }
+            (event.type == StreamEvent::TRIGGER_ON ? ons : offs)++;
+            lastEvent = std::max(lastEvent, event.time);
+        });
+        streamer.advance(blockSize);
+        maxInMemory = std::max(maxInMemory, streamer.eventsInMemory());
+    }
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+    std::cout << "First event after " << firstEvent.count() * 1e3 << " ms" << std::endl;
+    std::cout << "Streamed " << ons << " events and " << offs << " turnoffs ("
+              << lastEvent / sampleRate << " s of music) in " << elapsed.count() << " s" << std::endl;
+    std::cout << "At most " << maxInMemory << " events in memory ("
+              << maxInMemory * sizeof(StreamEvent) / 1024 << " kB) instead of " << numEvents
+              << " (" << numEvents * sizeof(StreamEvent) / 1024 << " kB)" << std::endl;
+    std::cout << "Late events: " << streamer.late()
+              << " (expected here, the playhead runs ahead of the reader)" << std::endl;
+    std::remove(fileName.c_str());
+
+    const double pacedSeconds = 5.0;
+    const double spacing = 0.001;
+    writeSequence(fileName, int(pacedSeconds / spacing), spacing);
+    SequenceStreamer paced(sampleRate);
+    paced.registerVoice<MyVoice>("MyVoice");
+    paced.play(fileName);
+    std::chrono::duration<double> blockDuration(blockSize / sampleRate);
+    auto deadline = std::chrono::steady_clock::now();
+    ons = offs = time = 0;
+    while (!paced.finished()) {
+        deadline += std::chrono::duration_cast<std::chrono::steady_clock::duration>(blockDuration);
+        std::this_thread::sleep_until(deadline);
+        time += blockSize;
+        paced.popDue(time, [&](const StreamEvent &event) {
+            (event.type == StreamEvent::TRIGGER_ON ? ons : offs)++;
+        });
+        paced.advance(blockSize);
+    }
+    std::cout << "Streamed " << ons << " events and " << offs << " turnoffs at realtime, "
+              << paced.late() << " late" << std::endl;
+    std::remove(fileName.c_str());
+}
+
+
+int main(int argc, char *argv[])
+{
+    gam::sampleRate(44100);
+    if (argc > 1 && std::string(argv[1]) == "--benchmark") {
+        runBenchmark();
+        return 0;
+    }
+    MyApp app;
+    if (argc > 1) {
+        app.fileName = argv[1];
+    } else {
+        app.fileName = "streaming_demo.synthSequence";
+        writeSequence(app.fileName, 100000);
+    }
+    app.streamer.registerVoice<MyVoice>("MyVoice");
+    app.streamer.synth().allocatePolyphony<MyVoice>(16);
+    app.dimensions(800, 600);
+    app.initAudio(44100, 256, 2, 0);
+    app.start();
+    return 0;
+}
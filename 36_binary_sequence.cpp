@@ -0,0 +1,906 @@
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "al/core/app/al_App.hpp"
+#include "al/core/graphics/al_Shapes.hpp"
+#include "al/util/ui/al_Parameter.hpp"
+
+#include "al/util/scene/al_SynthSequencer.hpp"
+
+#include "Gamma/Oscillator.h"
+#include "Gamma/Envelope.h"
+#include "Gamma/Domain.h"
+
+using namespace al;
+
+/*
+ * This tutorial shows a binary format for synth sequences that can be
+ * played straight from the file.
+ *
+ * The text format from the event recorder tutorial has to be parsed line
+ * by line before it can be played. A BinarySequence is converted once from
+ * the text format, and stored with this layout:
+ *
+ *   header   magic "ALSYNSEQ", version, a byte order mark, number of
+ *            classes, records between index entries, ticks per second,
+ *            number of records, number of index entries, size of the
+ *            records in bytes and the time of the last record
+ *   classes  the name of each voice class. Records refer to a class by
+ *            its position in this list.
+ *   index    the time and position of every 64th record
+ *   records  records sorted by time: the ticks (microseconds) since the
+ *            previous record, turnon or turnoff, the event id, and for a
+ *            turnon the class, the number of p-fields and only that many
+ *            p-fields as floats. Integers are stored as varints, 7 bits per
+ *            byte, so small numbers take a single byte. There is no
+ *            padding, a turnoff usually takes 3 to 6 bytes.
+ *
+ * "@" events become a turnon and a turnoff record, and tempo changes are
+ * applied to the times during conversion. As records have different sizes
+ * and times are relative, the player walks them from one to the next. To
+ * find the first record at a time, the index is searched in O(log n) and
+ * then at most 64 records are stepped through.
+ *
+ * A file can be damaged or come from somewhere else, so the counts in the
+ * header, record positions, record sizes and class indices are checked
+ * before they are used. The benchmark also checks that damaged files which
+ * used to crash the reader are rejected.
+ *
+ * When the file is opened it is memory-mapped, and the SequencePlayer
+ * decodes each record from the mapped file when it is due. Nothing is
+ * parsed up front. Files are read only on machines with the byte order
+ * they were written with.
+ * Sequences can be exported back to the text format, as "+" and "-" lines.
+ *
+ * Press a number key to jump to that many tens of seconds into the
+ * sequence, and 'e' to export it as text.
+ * Run with "--benchmark" to compare loading and size with the text format
+ * for a million events.
+*/
+
+class BinarySequence
+{
+public:
+    enum Type : uint8_t { TRIGGER_ON, TRIGGER_OFF };
+
+    static const uint32_t VERSION = 1;
+    // Written as is, so it reads differently on a machine with the other
+    // byte order
+    static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+    // Times are stored in microseconds
+    static const uint32_t TICKS_PER_SECOND = 1000000;
+    // Records between index entries
+    static const uint32_t INDEX_INTERVAL = 64;
+
+    struct Header {
+        char magic[8]; // "ALSYNSEQ"
+        uint32_t version;
+        uint32_t byteOrder;
+        uint32_t numClasses;
+        uint32_t indexInterval;
+        uint32_t ticksPerSecond;
+        uint32_t reserved;
+        uint64_t numRecords;
+        uint64_t numIndexEntries;
+        uint64_t recordsSize; // In bytes
+        uint64_t duration; // In ticks
+    };
+
+    // A record as read from the file
+    struct Record {
+        double time; // In seconds
+        int32_t id;
+        uint16_t classIndex;
+        Type type;
+        uint8_t numFields;
+        const char *fields; // numFields floats in the file, not aligned
+
+        float field(int i) const {
+            float value;
+            std::memcpy(&value, fields + i * sizeof(float), sizeof(float));
+            return value;
+        }
+    };
+
+    /*
+     * Where reading continues: the position of a record in bytes from the
+     * first record, and the time of the record before it, as the time of a
+     * record is stored as the ticks since the one before. Index entries
+     * are cursors.
+     */
+    struct Cursor {
+        uint64_t ticks;
+        uint64_t position;
+    };
+
+    ~BinarySequence() { close(); }
+
+    /*
+     * Convert a .synthSequence text file. Lines are sorted by time, keeping
+     * the order of the file for equal times.
+     */
+    static bool convertFromText(std::string textFile, std::string binaryFile) {
+        std::vector<std::string> classes;
+        std::vector<TextEvent> events;
+        std::vector<float> fields;
+        if (!readText(textFile, classes, events, fields)) {
+            return false;
+        }
+        std::stable_sort(events.begin(), events.end(),
+                         [](const TextEvent &a, const TextEvent &b) { return a.time < b.time; });
+        return write(binaryFile, classes, events, fields);
+    }
+
+    // Write the sequence as "+" and "-" lines
+    bool exportText(std::string textFile) {
+        std::ofstream f(textFile);
+        if (!f.is_open()) {
+            return false;
+        }
+        f.precision(9);
+        Cursor cursor = begin();
+        Record r;
+        while (read(cursor, r)) {
+            if (r.type == TRIGGER_OFF) {
+                f << "- " << r.time << " " << r.id << std::endl;
+                continue;
+            }
+            if (r.classIndex >= mClasses.size()) {
+                continue;
+            }
+            f << "+ " << r.time << " " << r.id << " " << mClasses[r.classIndex];
+            for (int field = 0; field < r.numFields; field++) {
+                f << " " << r.field(field);
+            }
+            f << std::endl;
+        }
+        return f.good();
+    }
+
+    bool open(std::string binaryFile) {
+        close();
+#ifdef _WIN32
+        std::ifstream f(binaryFile, std::ios::binary | std::ios::ate);
+        if (!f.is_open()) {
+            return false;
+        }
+        mSize = (size_t) f.tellg();
+        mBuffer.resize(mSize / sizeof(double) + 1);
+        f.seekg(0);
+        f.read((char *) mBuffer.data(), mSize);
+        mData = (const char *) mBuffer.data();
+#else
+        int fd = ::open(binaryFile.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            ::close(fd);
+            return false;
+        }
+        mSize = (size_t) st.st_size;
+        void *mapped = mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED) {
+            return false;
+        }
+        mData = (const char *) mapped;
+#endif
+        if (!parse()) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+#ifndef _WIN32
+        if (mData) {
+            munmap((void *) mData, mSize);
+        }
+#endif
+        mData = nullptr;
+        mSize = 0;
+        mIndex = nullptr;
+        mNumIndexEntries = 0;
+        mRecords = nullptr;
+        mRecordsSize = 0;
+        mNumRecords = 0;
+        mDuration = 0;
+        mClasses.clear();
+    }
+
+    uint64_t numRecords() const { return mNumRecords; }
+
+    // A cursor at the first record
+    Cursor begin() const { return {0, 0}; }
+
+    /*
+     * Read the record at cursor and move the cursor to the next one.
+     * Returns false at the end of the sequence, or if the record doesn't
+     * fit in the file.
+     */
+    bool read(Cursor &cursor, Record &record) const {
+        uint64_t position = cursor.position;
+        uint64_t delta, id, classIndex = 0;
+        if (!readVarint(position, delta) || position >= mRecordsSize) {
+            return false;
+        }
+        record.type = Type(mRecords[position++]);
+        if (record.type > TRIGGER_OFF || !readVarint(position, id)) {
+            return false;
+        }
+        record.numFields = 0;
+        if (record.type == TRIGGER_ON) {
+            if (!readVarint(position, classIndex) || classIndex > 0xFFFF
+                    || position >= mRecordsSize) {
+                return false;
+            }
+            record.numFields = uint8_t(mRecords[position++]);
+        }
+        if (record.numFields * sizeof(float) > mRecordsSize - position) {
+            return false;
+        }
+        record.fields = mRecords + position;
+        record.time = (cursor.ticks + delta) / double(mTicksPerSecond);
+        record.id = int32_t(uint32_t(id >> 1) ^ (0 - uint32_t(id & 1)));
+        record.classIndex = uint16_t(classIndex);
+        cursor.ticks += delta;
+        cursor.position = position + record.numFields * sizeof(float);
+        return true;
+    }
+
+    const std::vector<std::string> &classes() const { return mClasses; }
+
+    // A cursor at the first record at or after time
+    Cursor seek(double time) const {
+        // Rounded down, so that the entry found is before time
+        uint64_t ticks = time > 0 ? uint64_t(time * mTicksPerSecond) : 0;
+        // The last index entry before time, then step to the record
+        const Cursor *entry = std::lower_bound(
+                    mIndex, mIndex + mNumIndexEntries, ticks,
+                    [](const Cursor &e, uint64_t t) { return e.ticks < t; });
+        Cursor cursor = entry == mIndex ? begin() : *(entry - 1);
+        Cursor next = cursor;
+        Record r;
+        while (read(next, r) && r.time < time) {
+            cursor = next;
+        }
+        return cursor;
+    }
+
+    // The last time in the sequence
+    double duration() const { return mDuration; }
+
+    struct TextEvent {
+        double time;
+        int32_t id;
+        uint16_t classIndex;
+        Type type;
+        uint8_t numFields;
+        uint32_t firstField; // In the fields vector
+    };
+
+    /*
+     * Parse a .synthSequence text file. Times are in beats, and the tempo
+     * is 60 bpm until a "t" line changes it. The p-fields of all events are
+     * added to fields.
+     */
+    static bool readText(std::string textFile, std::vector<std::string> &classes,
+                         std::vector<TextEvent> &events, std::vector<float> &fields) {
+        std::ifstream f(textFile);
+        if (!f.is_open()) {
+            return false;
+        }
+        std::unordered_map<std::string, uint16_t> classIndex;
+        double beatsAtChange = 0, secondsAtChange = 0, secondsPerBeat = 1;
+        auto toSeconds = [&](double beats) {
+            return secondsAtChange + (beats - beatsAtChange) * secondsPerBeat;
+        };
+        int32_t nextId = 1 << 24; // Ids for "@" events, above the ids of recorded notes
+        std::vector<const char *> tokens;
+        std::string line;
+        while (std::getline(f, line)) {
+            tokenize(line, tokens);
+            if (tokens.size() < 2 || tokens[0][1] != '\0') {
+                continue;
+            }
+            char command = tokens[0][0];
+            double beats = std::atof(tokens[1]);
+            if (command == 't' && tokens.size() >= 3) {
+                secondsAtChange = toSeconds(beats);
+                beatsAtChange = beats;
+                secondsPerBeat = 60.0 / std::atof(tokens[2]);
+            } else if (command == '-' && tokens.size() >= 3) {
+                events.emplace_back();
+                events.back().time = toSeconds(beats);
+                events.back().id = std::atoi(tokens[2]);
+                events.back().classIndex = 0;
+                events.back().type = TRIGGER_OFF;
+                events.back().numFields = 0;
+                events.back().firstField = 0;
+            } else if ((command == '@' || command == '+') && tokens.size() >= 4) {
+                auto index = classIndex.find(tokens[3]);
+                if (index == classIndex.end()) {
+                    index = classIndex.insert({tokens[3], uint16_t(classes.size())}).first;
+                    classes.push_back(tokens[3]);
+                }
+                events.emplace_back();
+                TextEvent &event = events.back();
+                event.time = toSeconds(beats);
+                event.id = command == '@' ? nextId++ : std::atoi(tokens[2]);
+                event.classIndex = index->second;
+                event.type = TRIGGER_ON;
+                event.numFields = uint8_t(std::min(int(tokens.size()) - 4, 255));
+                event.firstField = uint32_t(fields.size());
+                for (int i = 0; i < event.numFields; i++) {
+                    fields.push_back(float(std::atof(tokens[4 + i])));
+                }
+                if (command == '@') {
+                    TextEvent off = event;
+                    off.time = toSeconds(beats + std::atof(tokens[2]));
+                    off.type = TRIGGER_OFF;
+                    off.numFields = 0;
+                    events.push_back(off);
+                }
+            }
+        }
+        return true;
+    }
+
+private:
+    // Split line at whitespace, in place
+    static void tokenize(std::string &line, std::vector<const char *> &tokens) {
+        tokens.clear();
+        char *c = &line[0];
+        char *end = c + line.size();
+        while (c < end) {
+            while (c < end && isspace(*c)) {
+                *c++ = '\0';
+            }
+            if (c < end) {
+                tokens.push_back(c);
+            }
+            while (c < end && !isspace(*c)) {
+                c++;
+            }
+        }
+    }
+
+    static void writeString(std::ofstream &f, const std::string &s) {
+        uint32_t length = (uint32_t) s.size();
+        f.write((const char *) &length, sizeof(length));
+        f.write(s.data(), length);
+    }
+
+    // 7 bits per byte, the high bit is set on all bytes but the last
+    static void writeVarint(std::vector<char> &out, uint64_t value) {
+        while (value >= 0x80) {
+            out.push_back(char(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back(char(value));
+    }
+
+    bool readVarint(uint64_t &position, uint64_t &value) const {
+        value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (position >= mRecordsSize) {
+                return false;
+            }
+            uint8_t byte = uint8_t(mRecords[position++]);
+            value |= uint64_t(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static uint64_t toTicks(double seconds, uint32_t ticksPerSecond) {
+        return seconds > 0 ? uint64_t(std::llround(seconds * ticksPerSecond)) : 0;
+    }
+
+    /*
+     * A record is: the ticks since the previous record, the type, the id,
+     * and for a turnon the class, the number of p-fields and the p-fields.
+     * Numbers are written as varints, and ids are zigzag encoded so that
+     * small negative ids stay small.
+     */
+    static bool write(std::string binaryFile, const std::vector<std::string> &classes,
+                      const std::vector<TextEvent> &events, const std::vector<float> &fields) {
+        std::ofstream f(binaryFile, std::ios::binary);
+        if (!f.is_open()) {
+            return false;
+        }
+        // Encode the records first, to know where the index entries point
+        std::vector<char> records;
+        std::vector<Cursor> index;
+        uint64_t previousTicks = 0;
+        for (size_t i = 0; i < events.size(); i++) {
+            const TextEvent &event = events[i];
+            if (i % INDEX_INTERVAL == 0) {
+                index.push_back({previousTicks, records.size()});
+            }
+            uint64_t ticks = std::max(toTicks(event.time, TICKS_PER_SECOND), previousTicks);
+            writeVarint(records, ticks - previousTicks);
+            previousTicks = ticks;
+            records.push_back(char(event.type));
+            writeVarint(records, (uint32_t(event.id) << 1) ^ uint32_t(event.id >> 31));
+            if (event.type == TRIGGER_ON) {
+                writeVarint(records, event.classIndex);
+                records.push_back(char(event.numFields));
+                const char *data = (const char *) (fields.data() + event.firstField);
+                records.insert(records.end(), data, data + event.numFields * sizeof(float));
+            }
+        }
+        Header header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, "ALSYNSEQ", 8);
+        header.version = VERSION;
+        header.byteOrder = BYTE_ORDER_MARK;
+        header.numClasses = (uint32_t) classes.size();
+        header.indexInterval = INDEX_INTERVAL;
+        header.ticksPerSecond = TICKS_PER_SECOND;
+        header.numRecords = events.size();
+        header.numIndexEntries = index.size();
+        header.recordsSize = records.size();
+        header.duration = previousTicks;
+        f.write((const char *) &header, sizeof(header));
+        for (auto &name: classes) {
+            writeString(f, name);
+        }
+        // Align the index so it can be read in place
+        size_t position = (size_t) f.tellp();
+        while (position % sizeof(uint64_t) != 0) {
+            f.put(0);
+            position++;
+        }
+        f.write((const char *) index.data(), index.size() * sizeof(Cursor));
+        f.write(records.data(), records.size());
+        return f.good();
+    }
+
+    static size_t alignUp(size_t size) {
+        return (size + sizeof(uint64_t) - 1) / sizeof(uint64_t) * sizeof(uint64_t);
+    }
+
+    bool readString(size_t &offset, std::string &s) {
+        uint32_t length;
+        if (offset + sizeof(length) > mSize) {
+            return false;
+        }
+        std::memcpy(&length, mData + offset, sizeof(length));
+        offset += sizeof(length);
+        if (offset + length > mSize) {
+            return false;
+        }
+        s.assign(mData + offset, length);
+        offset += length;
+        return true;
+    }
+
+    bool parse() {
+        Header header;
+        if (mSize < sizeof(header)) {
+            return false;
+        }
+        std::memcpy(&header, mData, sizeof(header));
+        if (std::memcmp(header.magic, "ALSYNSEQ", 8) != 0 || header.version != VERSION) {
+            return false;
+        }
+        if (header.byteOrder != BYTE_ORDER_MARK) {
+            return false; // Written on a machine with the other byte order
+        }
+        if (header.ticksPerSecond == 0) {
+            return false;
+        }
+        size_t offset = sizeof(header);
+        // Every name takes at least its length, so a damaged count can't
+        // make us allocate more names than the file could hold
+        if (header.numClasses > (mSize - offset) / sizeof(uint32_t)) {
+            return false;
+        }
+        mClasses.resize(header.numClasses);
+        for (auto &name: mClasses) {
+            if (!readString(offset, name)) {
+                return false;
+            }
+        }
+        offset = alignUp(offset);
+        if (offset > mSize) {
+            return false; // The file ends in the padding
+        }
+        // Compare counts rather than sizes, so large values can't overflow
+        if (header.numIndexEntries > (mSize - offset) / sizeof(Cursor)) {
+            return false;
+        }
+        const Cursor *index = (const Cursor *) (mData + offset);
+        offset += header.numIndexEntries * sizeof(Cursor);
+        if (header.recordsSize > mSize - offset) {
+            return false;
+        }
+        // seek() trusts the index, so check that it points at records in
+        // order. Records themselves are checked when they are read.
+        for (uint64_t i = 0; i < header.numIndexEntries; i++) {
+            if (index[i].position >= header.recordsSize
+                    || (i > 0 && (index[i].position <= index[i - 1].position
+                                  || index[i].ticks < index[i - 1].ticks))) {
+                return false;
+            }
+        }
+        mIndex = index;
+        mNumIndexEntries = header.numIndexEntries;
+        mRecords = mData + offset;
+        mRecordsSize = header.recordsSize;
+        mNumRecords = header.numRecords;
+        mTicksPerSecond = header.ticksPerSecond;
+        mDuration = header.duration / double(header.ticksPerSecond);
+        return true;
+    }
+
+    const char *mData {nullptr};
+    size_t mSize {0};
+    std::vector<double> mBuffer; // Used when memory mapping is not available
+    const Cursor *mIndex {nullptr};
+    uint64_t mNumIndexEntries {0};
+    const char *mRecords {nullptr};
+    uint64_t mRecordsSize {0};
+    uint64_t mNumRecords {0};
+    uint32_t mTicksPerSecond {TICKS_PER_SECOND};
+    double mDuration {0};
+    std::vector<std::string> mClasses;
+};
+
+
+class SequencePlayer
+{
+public:
+    SequencePlayer(double sampleRate) : mSampleRate(sampleRate) {}
+
+    PolySynth &synth() { return mSynth; }
+
+    // Register each voice class before opening a sequence
+    template<class VoiceType>
+    void registerVoice(std::string name) {
+        mSynth.registerSynthClass<VoiceType>(name);
+        mFactoryIndex[name] = int(mFactories.size());
+        mFactories.push_back([this]() -> SynthVoice * { return mSynth.getVoice<VoiceType>(); });
+    }
+
+    // Open before starting audio. Playback starts at time 0.
+    bool open(std::string binaryFile) {
+        if (!mSequence.open(binaryFile)) {
+            return false;
+        }
+        // Map the classes of the file to our voice classes once
+        mClassMap.clear();
+        for (auto &name: mSequence.classes()) {
+            auto index = mFactoryIndex.find(name);
+            mClassMap.push_back(index == mFactoryIndex.end() ? -1 : index->second);
+        }
+        mCursor = mSequence.begin();
+        mTime = 0;
+        return true;
+    }
+
+    BinarySequence &sequence() { return mSequence; }
+
+    // Jump to time in seconds. Can be called from any thread.
+    void seek(double time) { mSeekRequest.store(time); }
+
+    void render(AudioIOData &io) {
+        double seekTime = mSeekRequest.exchange(-1.0);
+        if (seekTime >= 0) {
+            mSynth.allNotesOff();
+            mCursor = mSequence.seek(seekTime);
+            mTime = uint64_t(seekTime * mSampleRate);
+        }
+        uint64_t blockEnd = mTime + io.framesPerBuffer();
+        BinarySequence::Cursor next = mCursor;
+        BinarySequence::Record record;
+        while (mSequence.read(next, record)) {
+            uint64_t time = uint64_t(record.time * mSampleRate);
+            if (time >= blockEnd) {
+                break;
+            }
+            apply(record, time > mTime ? int(time - mTime) : 0);
+            mCursor = next;
+        }
+        mSynth.render(io);
+        mTime = blockEnd;
+    }
+
+    void render(Graphics &g) { mSynth.render(g); }
+
+private:
+    void apply(const BinarySequence::Record &record, int offset) {
+        if (record.type == BinarySequence::TRIGGER_OFF) {
+            mSynth.triggerOff(record.id);
+            return;
+        }
+        if (record.classIndex >= mClassMap.size()) {
+            return; // Not a class in the file
+        }
+        int factory = mClassMap[record.classIndex];
+        if (factory < 0) {
+            return; // Not registered
+        }
+        SynthVoice *voice = mFactories[factory]();
+        for (int i = 0; i < record.numFields; i++) {
+            mFields[i] = record.field(i);
+        }
+        voice->setParamFields(mFields, record.numFields);
+        mSynth.triggerOn(voice, offset, record.id);
+    }
+
+    double mSampleRate;
+    PolySynth mSynth;
+    BinarySequence mSequence;
+    std::vector<int> mClassMap; // Factory for each class in the file
+    std::vector<std::function<SynthVoice *()>> mFactories;
+    std::unordered_map<std::string, int> mFactoryIndex;
+    BinarySequence::Cursor mCursor {0, 0}; // At the next record
+    float mFields[255]; // The p-fields of the record being applied
+    uint64_t mTime {0};
+    std::atomic<double> mSeekRequest {-1.0};
+};
+
+
+class MyVoice : public SynthVoice {
+public:
+    MyVoice() {
+        addCone(mesh); // Prepare mesh to draw a cone
+
+        mEnvelope.lengths(0.1f,  0.5f);
+        mEnvelope.levels(0, 1, 0);
+        mEnvelope.sustainPoint(1);
+
+        mFrequency.registerChangeCallback([this](float value) {mSource.freq(value);});
+        mAttack.registerChangeCallback([this](float value) {mEnvelope.lengths()[0] = value;});
+        mRelease.registerChangeCallback([this](float value) {mEnvelope.lengths()[2] = value;});
+
+        *this << mX << mY << mSize << mFrequency << mAttack << mRelease;
+    }
+
+    virtual void onProcess(AudioIOData &io) override {
+        while(io()) {
+            io.out(0) += mEnvelope() * mSource() * 0.05;
+        }
+        if (mEnvelope.done()) {
+            free();
+        }
+    }
+
+    virtual void onProcess(Graphics &g) {
+        g.pushMatrix();
+        g.translate(mX, mY, 0);
+        g.scale(mSize * mEnvelope.value());
+        g.draw(mesh);
+        g.popMatrix();
+    }
+
+    virtual void onTriggerOn() override {
+        mEnvelope.reset();
+    }
+
+    virtual void onTriggerOff() override {
+        mEnvelope.release();
+    }
+
+private:
+    gam::Sine<> mSource;
+    gam::AD<> mEnvelope;
+
+    Mesh mesh;
+
+    Parameter mX {"X", "", 0};
+    Parameter mY {"Y", "", 0};
+    Parameter mSize {"Size", "", 1.0};
+    Parameter mFrequency {"Frequency", "", 0.0};
+    Parameter mAttack {"Attack", "", 0.0};
+    Parameter mRelease {"Release", "", 0.0};
+};
+
+
+class MyApp : public App
+{
+public:
+
+    virtual void onCreate() override {
+        nav().pos(Vec3d(0,0,8)); // Set the camera to view the scene
+    }
+
+    virtual void onDraw(Graphics &g) override
+    {
+        g.clear();
+        player.render(g);
+    }
+
+    virtual void onSound(AudioIOData &io) override {
+        player.render(io);
+    }
+
+    virtual void onKeyDown(const Keyboard& k) override
+    {
+        if (k.isNumber()) {
+            player.seek(k.keyAsNumber() * 10.0);
+        } else if (k.key() == 'e') {
+            player.sequence().exportText("exported.synthSequence");
+        }
+    }
+
+    SequencePlayer player {44100};
+};
+
+
+// An arpeggio of "@" events, with a tempo change halfway
+void writeTextSequence(std::string fileName, int numEvents)
+{
+    std::ofstream file(fileName);
+    for (int i = 0; i < numEvents; i++) {
+        if (i == numEvents / 2) {
+            file << "t " << i * 0.1 << " 90" << std::endl;
+        }
+        float step = float(i % 16);
+        file << "@ " << i * 0.1 << " 0.08 MyVoice " << step / 8.0f - 1.0f << " "
+             << float(i % 5) / 5.0f - 0.5f << " 0.3 " << 220.0f * powf(2.0f, (i * 7 % 24) / 12.0f)
+             << " 0.01 0.1" << std::endl;
+    }
+}
+
+// Write a file with a BinarySequence header and one class name
+void writeDamagedFile(std::string fileName, uint32_t numClasses, std::string className,
+                      uint64_t recordsSize)
+{
+    BinarySequence::Header header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "ALSYNSEQ", 8);
+    header.version = BinarySequence::VERSION;
+    header.byteOrder = BinarySequence::BYTE_ORDER_MARK;
+    header.numClasses = numClasses;
+    header.indexInterval = BinarySequence::INDEX_INTERVAL;
+    header.ticksPerSecond = BinarySequence::TICKS_PER_SECOND;
+    header.numRecords = 1;
+    header.recordsSize = recordsSize;
+    std::ofstream f(fileName, std::ios::binary);
+    f.write((const char *) &header, sizeof(header));
+    uint32_t length = uint32_t(className.size());
+    f.write((const char *) &length, sizeof(length));
+    f.write(className.data(), length);
+}
+
+// Files that used to crash the reader. open() must reject them.
+bool checkDamagedFiles()
+{
+    std::string fileName = "damaged.synthSequenceBin";
+    BinarySequence sequence;
+    bool ok = true;
+
+    // More classes than the file could hold
+    writeDamagedFile(fileName, 0xFFFFFFFF, "MyVoice", 0);
+    ok = !sequence.open(fileName) && ok;
+
+    // Ending right after a name, before the padding to 8 bytes
+    writeDamagedFile(fileName, 1, "MyVoice", 1024);
+    ok = !sequence.open(fileName) && ok;
+
+    std::remove(fileName.c_str());
+    return ok;
+}
+
+size_t fileSize(std::string fileName)
+{
+    std::ifstream f(fileName, std::ios::binary | std::ios::ate);
+    return f.is_open() ? (size_t) f.tellg() : 0;
+}
+
+void runBenchmark()
+{
+    const int numEvents = 1000000;
+    const int numSeeks = 1000000;
+    std::string textFile = "benchmark.synthSequence";
+    std::string binaryFile = "benchmark.synthSequenceBin";
+    std::cout << "Damaged files " << (checkDamagedFiles() ? "rejected" : "NOT REJECTED") << std::endl;
+    writeTextSequence(textFile, numEvents);
+
+    // Text: parse every line into memory, as needed before playing
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<std::string> classes;
+    std::vector<BinarySequence::TextEvent> events;
+    std::vector<float> fields;
+    BinarySequence::readText(textFile, classes, events, fields);
+    std::chrono::duration<double> textLoad = std::chrono::high_resolution_clock::now() - start;
+
+    start = std::chrono::high_resolution_clock::now();
+    BinarySequence::convertFromText(textFile, binaryFile);
+    std::chrono::duration<double> conversion = std::chrono::high_resolution_clock::now() - start;
+
+    // Binary: map the file, then read every record once
+    BinarySequence sequence;
+    start = std::chrono::high_resolution_clock::now();
+    sequence.open(binaryFile);
+    std::chrono::duration<double> binaryOpen = std::chrono::high_resolution_clock::now() - start;
+    double checksum = 0;
+    BinarySequence::Cursor cursor = sequence.begin();
+    BinarySequence::Record r;
+    while (sequence.read(cursor, r)) {
+        checksum += r.time;
+    }
+    std::chrono::duration<double> binaryScan = std::chrono::high_resolution_clock::now() - start;
+
+    start = std::chrono::high_resolution_clock::now();
+    uint64_t found = 0;
+    for (int i = 0; i < numSeeks; i++) {
+        found += sequence.seek(sequence.duration() * (i % 1000) / 1000.0).position;
+    }
+    std::chrono::duration<double> seeking = std::chrono::high_resolution_clock::now() - start;
+
+    std::cout << numEvents << " events, " << sequence.numRecords() << " records" << std::endl;
+    std::cout << "Text:   " << fileSize(textFile) / 1024 << " kB, parsed in "
+              << textLoad.count() * 1e3 << " ms" << std::endl;
+    std::cout << "Binary: " << fileSize(binaryFile) / 1024 << " kB ("
+              << 100 * fileSize(binaryFile) / std::max<size_t>(fileSize(textFile), 1)
+              << "% of the text), opened in "
+              << binaryOpen.count() * 1e3 << " ms, every record read after "
+              << binaryScan.count() * 1e3 << " ms (checksum " << checksum << ")" << std::endl;
+    std::cout << "Conversion: " << conversion.count() * 1e3 << " ms" << std::endl;
+    std::cout << "Seek: " << seeking.count() * 1e9 / numSeeks << " ns (" << found % 10 << ")" << std::endl;
+
+    sequence.close();
+    std::remove(textFile.c_str());
+    std::remove(binaryFile.c_str());
+}
+
+
+int main(int argc, char *argv[])
+{
+    gam::sampleRate(44100);
+    if (argc > 1 && std::string(argv[1]) == "--benchmark") {
+        runBenchmark();
+        return 0;
+    }
+    std::string textFile = "binary_demo.synthSequence";
+    if (argc > 1) {
+        textFile = argv[1];
+    } else {
+        writeTextSequence(textFile, 10000);
+    }
+    std::string binaryFile = textFile + "Bin";
+    if (!BinarySequence::convertFromText(textFile, binaryFile)) {
+        std::cout << "Can't convert " << textFile << std::endl;
+        return 1;
+    }
+
+    MyApp app;
+    app.player.registerVoice<MyVoice>("MyVoice");
+    app.player.synth().allocatePolyphony<MyVoice>(16);
+    if (!app.player.open(binaryFile)) {
+        std::cout << "Can't open " << binaryFile << std::endl;
+        return 1;
+    }
+    app.dimensions(800, 600);
+    app.initAudio(44100, 256, 2, 0);
+    app.start();
+    return 0;
+}
@@ -0,0 +1,513 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <typeindex>
+#include <unordered_map>
+#include <vector>
+
+#include "al/core/app/al_App.hpp"
+#include "al/core/graphics/al_Shapes.hpp"
+#include "al/util/ui/al_Parameter.hpp"
+#include "al/util/ui/al_ControlGUI.hpp"
+
+#include "al/util/scene/al_SynthSequencer.hpp"
+
+#include "Gamma/Oscillator.h"
+#include "Gamma/Envelope.h"
+#include "Gamma/Domain.h"
+
+using namespace al;
+
+/*
+ * This tutorial shows how to record a PolySynth without formatting text or
+ * writing files on the threads that trigger voices.
+ *
+ * The AsyncRecorder registers trigger callbacks with the PolySynth, like
+ * SynthRecorder does. When a voice is triggered, the callback only copies
+ * the time, the id, the voice class and the parameter fields into a fixed
+ * size record, and pushes it into a preallocated lock-free queue. Voices
+ * can be triggered from several threads, so the queue accepts many
+ * producers. A writer thread takes the records out, formats them as the
+ * "+" and "-" lines of the .synthSequence format, and writes them to the
+ * file. The file can be played with SynthSequencer::playSequence().
+ *
+ * If the writer falls behind and the queue is full, records are dropped
+ * and counted. The callbacks never wait and never allocate. Events that
+ * the writer fails to write to the file are counted too, and stopRecord()
+ * returns false if anything could not be written, flushed or closed.
+ *
+ * Voice classes must be registered with the recorder, so that the callback
+ * finds the class name without building a string. Voices of other classes
+ * are counted as unknown.
+ *
+ * Press keys to trigger voices and 'r' to start and stop recording.
+ * Run with "--benchmark" to compare the time spent in the trigger callback
+ * with writing each event to the file directly.
+*/
+
+template<class T>
+class MPSCQueue
+{
+public:
+    MPSCQueue(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        mCells = std::vector<Cell>(size);
+        mMask = size - 1;
+        for (size_t i = 0; i < size; i++) {
+            mCells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // Any thread may push. Returns false if the queue is full.
+    bool push(const T &value) {
+        size_t position = mTail.load(std::memory_order_relaxed);
+        while (true) {
+            Cell &cell = mCells[position & mMask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t) sequence - (intptr_t) position;
+            if (diff == 0) {
+                if (mTail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    cell.value = value;
+                    cell.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false; // Full
+            } else {
+                position = mTail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Only one thread may pop
+    bool pop(T &value) {
+        Cell &cell = mCells[mHead & mMask];
+        size_t sequence = cell.sequence.load(std::memory_order_acquire);
+        if ((intptr_t) sequence - (intptr_t) (mHead + 1) < 0) {
+            return false; // Empty
+        }
+        value = cell.value;
+        cell.sequence.store(mHead + mMask + 1, std::memory_order_release);
+        mHead++;
+        return true;
+    }
+
+private:
+    struct Cell {
+        Cell() {}
+        Cell(const Cell &) {} // Only needed to build the vector
+        std::atomic<size_t> sequence {0};
+        T value;
+    };
+
+    std::vector<Cell> mCells;
+    size_t mMask;
+    alignas(64) std::atomic<size_t> mTail {0};
+    alignas(64) size_t mHead {0};
+};
+
+
+struct RecordedEvent {
+    static const int MAX_FIELDS = 16;
+    enum Type : uint8_t { TRIGGER_ON, TRIGGER_OFF };
+
+    Type type;
+    uint8_t numFields;
+    uint16_t classIndex;
+    int32_t id;
+    double time; // In seconds from the start of the recording
+    float fields[MAX_FIELDS];
+};
+
+
+class AsyncRecorder
+{
+public:
+    AsyncRecorder(size_t capacity = 8192) : mQueue(capacity) {}
+
+    ~AsyncRecorder() { stopRecord(); }
+
+    // Register the callbacks with a PolySynth
+    AsyncRecorder &operator<< (PolySynth &synth) {
+        synth.registerTriggerOnCallback(
+                    [this](SynthVoice *voice, int /*offset*/, int id, void * /*userData*/) {
+            recordOn(voice, id);
+            return true;
+        });
+        synth.registerTriggerOffCallback([this](int id) {
+            recordOff(id);
+            return true;
+        });
+        return *this;
+    }
+
+    // Register each voice class before recording
+    template<class VoiceType>
+    void registerVoice(std::string name) {
+        mClassIndex[std::type_index(typeid(VoiceType))] = uint16_t(mClassNames.size());
+        mClassNames.push_back(name);
+    }
+
+    bool startRecord(std::string fileName) {
+        stopRecord();
+        mFile = std::fopen(fileName.c_str(), "w");
+        if (!mFile) {
+            return false;
+        }
+        // Drop events pushed by other threads while the last recording stopped
+        RecordedEvent event;
+        while (mQueue.pop(event)) {}
+        mFailed = false;
+        mStart = std::chrono::steady_clock::now();
+        mRecording = true;
+        mWriter = std::thread([this]() { writeLoop(); });
+        return true;
+    }
+
+    /*
+     * Writes what is left in the queue and closes the file. Returns false
+     * if writing, flushing or closing the file failed since startRecord().
+     */
+    bool stopRecord() {
+        if (!mRecording) {
+            return !mFailed;
+        }
+        mRecording = false;
+        mWriter.join();
+        if (std::fclose(mFile) != 0) {
+            mFailed = true;
+        }
+        mFile = nullptr;
+        return !mFailed;
+    }
+
+    bool recording() const { return mRecording; }
+
+    // Called on the triggering thread. Only copies and pushes.
+    void recordOn(SynthVoice *voice, int id) {
+        if (!mRecording.load(std::memory_order_acquire)) {
+            return;
+        }
+        auto classIndex = mClassIndex.find(std::type_index(typeid(*voice)));
+        if (classIndex == mClassIndex.end()) {
+            mUnknown++;
+            return;
+        }
+        RecordedEvent event;
+        event.type = RecordedEvent::TRIGGER_ON;
+        event.classIndex = classIndex->second;
+        event.id = id;
+        event.time = elapsed();
+        int numFields = voice->getParamFields(event.fields, RecordedEvent::MAX_FIELDS);
+        event.numFields = uint8_t(std::max(0, std::min(numFields, int(RecordedEvent::MAX_FIELDS))));
+        push(event);
+    }
+
+    void recordOff(int id) {
+        if (!mRecording.load(std::memory_order_acquire)) {
+            return;
+        }
+        RecordedEvent event;
+        event.type = RecordedEvent::TRIGGER_OFF;
+        event.numFields = 0;
+        event.id = id;
+        event.time = elapsed();
+        push(event);
+    }
+
+    /*
+     * Events handed to the file and events fwrite() refused. Lines are
+     * buffered, so events lost when the buffer fails to flush are counted
+     * as written, and only reported by stopRecord() returning false.
+     */
+    uint64_t written() const { return mWritten; }
+    uint64_t overflows() const { return mOverflows; }
+    uint64_t writeFailures() const { return mWriteFailures; }
+    uint64_t unknown() const { return mUnknown; }
+
+private:
+    double elapsed() {
+        std::chrono::duration<double> time = std::chrono::steady_clock::now() - mStart;
+        return time.count();
+    }
+
+    void push(const RecordedEvent &event) {
+        if (!mQueue.push(event)) {
+            mOverflows++;
+        }
+    }
+
+    void writeLoop() {
+        std::string line;
+        char number[64];
+        RecordedEvent event;
+        while (true) {
+            bool stopping = !mRecording; // Check before the last drain
+            while (mQueue.pop(event)) {
+                if (event.type == RecordedEvent::TRIGGER_OFF) {
+                    std::snprintf(number, sizeof(number), "- %.6f %d\n", event.time, event.id);
+                    line = number;
+                } else {
+                    std::snprintf(number, sizeof(number), "+ %.6f %d ", event.time, event.id);
+                    line = number;
+                    line += mClassNames[event.classIndex];
+                    for (int i = 0; i < event.numFields; i++) {
+                        std::snprintf(number, sizeof(number), " %g", event.fields[i]);
+                        line += number;
+                    }
+                    line += '\n';
+                }
+                if (std::fwrite(line.data(), 1, line.size(), mFile) == line.size()) {
+                    mWritten++;
+                } else {
+                    mWriteFailures++;
+                    mFailed = true;
+                }
+            }
+            if (stopping) {
+                break;
+            }
+            if (std::fflush(mFile) != 0) {
+                mFailed = true;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+    }
+
+    MPSCQueue<RecordedEvent> mQueue;
+    std::FILE *mFile {nullptr};
+    std::thread mWriter;
+    std::atomic<bool> mRecording {false};
+    std::chrono::steady_clock::time_point mStart;
+    std::atomic<uint64_t> mWritten {0};
+    std::atomic<uint64_t> mOverflows {0};
+    std::atomic<uint64_t> mWriteFailures {0};
+    std::atomic<bool> mFailed {false};
+    std::atomic<uint64_t> mUnknown {0};
+    // Written before recording, read only afterwards
+    std::unordered_map<std::type_index, uint16_t> mClassIndex;
+    std::vector<std::string> mClassNames;
+};
+
+
+class MyVoice : public SynthVoice {
+public:
+    MyVoice() {
+        addCone(mesh); // Prepare mesh to draw a cone
+
+        mEnvelope.lengths(0.1f,  0.5f);
+        mEnvelope.levels(0, 1, 0);
+        mEnvelope.sustainPoint(1);
+
+        mFrequency.registerChangeCallback([this](float value) {mSource.freq(value);});
+        mAttack.registerChangeCallback([this](float value) {mEnvelope.lengths()[0] = value;});
+        mRelease.registerChangeCallback([this](float value) {mEnvelope.lengths()[2] = value;});
+
+        *this << mX << mY << mSize << mFrequency << mAttack << mRelease;
+    }
+
+    virtual void onProcess(AudioIOData &io) override {
+        while(io()) {
+            io.out(0) += mEnvelope() * mSource() * 0.05;
+        }
+        if (mEnvelope.done()) {
+            free();
+        }
+    }
+
+    virtual void onProcess(Graphics &g) {
+        g.pushMatrix();
+        g.translate(mX, mY, 0);
+        g.scale(mSize * mEnvelope.value());
+        g.draw(mesh);
+        g.popMatrix();
+    }
+
+    void set(float x, float y, float size, float frequency, float attackTime, float releaseTime) {
+        mX = x;
+        mY = y;
+        mSize = size;
+        mFrequency = frequency;
+        mAttack = attackTime;
+        mRelease = releaseTime;
+    }
+
+    virtual void onTriggerOn() override {
+        mEnvelope.reset();
+    }
+
+    virtual void onTriggerOff() override {
+        mEnvelope.release();
+    }
+
+private:
+    gam::Sine<> mSource;
+    gam::AD<> mEnvelope;
+
+    Mesh mesh;
+
+    Parameter mX {"X", "", 0};
+    Parameter mY {"Y", "", 0};
+    Parameter mSize {"Size", "", 1.0};
+    Parameter mFrequency {"Frequency", "", 0.0};
+    Parameter mAttack {"Attack", "", 0.0};
+    Parameter mRelease {"Release", "", 0.0};
+};
+
+
+class MyApp : public App
+{
+public:
+
+    virtual void onCreate() override {
+        nav().pos(Vec3d(0,0,8)); // Set the camera to view the scene
+
+        gui << X << Y << AttackTime << ReleaseTime; // Register the parameters with the GUI
+        gui.init(); // Initialize GUI. Don't forget this!
+        navControl().active(false);
+
+        mRecorder.registerVoice<MyVoice>("MyVoice");
+        mRecorder << mPolySynth;
+    }
+
+    virtual void onDraw(Graphics &g) override
+    {
+        g.clear();
+        mPolySynth.render(g);
+        gui.draw(g);
+    }
+
+    virtual void onSound(AudioIOData &io) override {
+        mPolySynth.render(io);
+    }
+
+    virtual void onKeyDown(const Keyboard& k) override
+    {
+        if (k.key() == 'r') {
+            if (mRecorder.recording()) {
+                if (!mRecorder.stopRecord()) {
+                    std::cout << "Error writing async.synthSequence" << std::endl;
+                }
+                std::cout << "Recorded " << mRecorder.written() << " events, "
+                          << mRecorder.overflows() << " dropped, "
+                          << mRecorder.writeFailures() << " failed to write" << std::endl;
+            } else {
+                mRecorder.startRecord("async.synthSequence");
+            }
+            return;
+        }
+        MyVoice *voice = mPolySynth.getVoice<MyVoice>();
+        int midiNote = asciiToMIDI(k.key());
+        float freq = 440.0f * powf(2, (midiNote - 69)/12.0f);
+        voice->set(X.get(), Y.get(), 0.5f, freq, AttackTime.get(), ReleaseTime.get());
+        mPolySynth.triggerOn(voice, 0, midiNote); // The recorder is called here
+    }
+
+    virtual void onKeyUp(const Keyboard &k) override {
+        mPolySynth.triggerOff(asciiToMIDI(k.key()));
+    }
+
+private:
+    Parameter X {"X", "Position", 0.0, "", -1.0f, 1.0f};
+    Parameter Y {"Y", "Position", 0.0, "", -1.0f, 1.0f};
+    Parameter AttackTime {"AttackTime", "Sound", 0.1, "", 0.001f, 2.0f};
+    Parameter ReleaseTime {"ReleaseTime", "Sound", 1.0, "", 0.001f, 5.0f};
+
+    PolySynth mPolySynth;
+    AsyncRecorder mRecorder;
+
+    ControlGUI gui;
+};
+
+
+void printTimes(std::string name, std::vector<double> &times)
+{
+    std::sort(times.begin(), times.end());
+    std::cout << name << " ns: median " << times[times.size() / 2] * 1e9
+              << " p99 " << times[size_t(times.size() * 0.99)] * 1e9
+              << " p99.9 " << times[size_t(times.size() * 0.999)] * 1e9
+              << " worst " << times.back() * 1e9 << std::endl;
+}
+
+/*
+ * Times each recorded event, first writing the text line on the calling
+ * thread, then pushing it to the AsyncRecorder. The recorder is called
+ * directly, so no PolySynth is needed.
+ */
+void runBenchmark()
+{
+    const int numEvents = 200000;
+    MyVoice voice;
+    voice.set(0.5f, -0.5f, 1.0f, 440.0f, 0.1f, 0.5f);
+    float fields[RecordedEvent::MAX_FIELDS];
+    std::vector<double> times;
+    times.reserve(numEvents);
+
+    {
+        std::ofstream file("sync_benchmark.synthSequence");
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < numEvents; i++) {
+            auto eventStart = std::chrono::steady_clock::now();
+            int numFields = voice.getParamFields(fields, RecordedEvent::MAX_FIELDS);
+            std::chrono::duration<double> time = eventStart - start;
+            file << "+ " << time.count() << " " << i << " MyVoice";
+            for (int f = 0; f < numFields; f++) {
+                file << " " << fields[f];
+            }
+            file << '\n'; // No flush per event
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - eventStart;
+            times.push_back(elapsed.count());
+        }
+    }
+    printTimes("Writing on the trigger thread", times);
+    times.clear();
+
+    AsyncRecorder recorder(8192);
+    recorder.registerVoice<MyVoice>("MyVoice");
+    if (!recorder.startRecord("async_benchmark.synthSequence")) {
+        std::cout << "Could not open async_benchmark.synthSequence" << std::endl;
+        return;
+    }
+    for (int i = 0; i < numEvents; i++) {
+        auto eventStart = std::chrono::steady_clock::now();
+        recorder.recordOn(&voice, i);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - eventStart;
+        times.push_back(elapsed.count());
+        if (i % 64 == 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(50)); // Trigger in bursts
+        }
+    }
+    bool ok = recorder.stopRecord();
+    printTimes("Pushing to the AsyncRecorder  ", times);
+    std::cout << "Written " << recorder.written() << " dropped " << recorder.overflows()
+              << " failed to write " << recorder.writeFailures() << std::endl;
+    if (!ok) {
+        std::cout << "Error writing async_benchmark.synthSequence" << std::endl;
+    }
+
+    std::remove("sync_benchmark.synthSequence");
+    std::remove("async_benchmark.synthSequence");
+}
+
+
+int main(int argc, char *argv[])
+{
+    gam::sampleRate(44100);
+    if (argc > 1 && std::string(argv[1]) == "--benchmark") {
+        runBenchmark();
+        return 0;
+    }
+    MyApp app;
+    app.dimensions(800, 600);
+    app.initAudio(44100, 256, 2, 0);
+    app.start();
+    return 0;
+}